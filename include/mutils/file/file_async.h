@@ -0,0 +1,17 @@
+#pragma once
+
+#include <mutils/file/file.h>
+#include <mutils/file/toml_utils.h>
+#include <mutils/thread/work_pool.h>
+
+namespace MUtils
+{
+
+// Loading on a background executor.  Each returns at once; chain on the result with .then(), or co_await it
+// (see thread/coroutine.h).  To get back to the main thread, e.g. to upload to GL:
+//   file_read_async(path).then(QueueExecutor::MainThread(), [](std::string text) { ... });
+Future<std::string> file_read_async(const fs::path& fileName, IExecutor& executor = WorkStealingPool::Instance());
+Future<std::string> runtree_load_asset_async(const fs::path& p, IExecutor& executor = WorkStealingPool::Instance());
+Future<toml::value> toml_read_async(const fs::path& path, IExecutor& executor = WorkStealingPool::Instance());
+
+} // namespace MUtils
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <mutils/file/file.h>
+
+namespace MUtils
+{
+
+// A read only view of a whole file, mapped into memory.  The pages are shared with any other process
+// mapping the same file, and only read from disk as they are touched
+class FileMapping
+{
+public:
+    ~FileMapping();
+
+    const uint8_t* Data() const
+    {
+        return m_pData;
+    }
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+private:
+    friend std::shared_ptr<const FileMapping> file_map(const fs::path& path);
+    FileMapping() = default;
+
+    const uint8_t* m_pData = nullptr;
+    size_t m_size = 0;
+#ifdef WIN32
+    void* m_hFile = nullptr;
+    void* m_hMapping = nullptr;
+#endif
+};
+
+// nullptr if the file can't be opened.  An empty file maps to an empty view
+std::shared_ptr<const FileMapping> file_map(const fs::path& path);
+
+} // namespace MUtils
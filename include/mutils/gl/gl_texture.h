@@ -1,10 +1,28 @@
 #pragma once
 
+#include <memory>
+
 #include <mutils/file/file.h>
+#include <mutils/thread/work_pool.h>
 #include <GL/gl3w.h>
 namespace MUtils
 {
 
+// Decoded pixels, ready to upload
+struct GLTextureImage
+{
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    std::shared_ptr<unsigned char> spPixels;
+};
+
+// Decode on any thread; upload on the GL thread.  gl_load_texture does both
+GLTextureImage gl_decode_texture(const fs::path& path);
+GLuint gl_upload_texture(const GLTextureImage& image);
 GLuint gl_load_texture(const fs::path& path);
 
+// Decodes on the I/O executor, then uploads on the GL one (the main thread, by default)
+Future<GLuint> gl_load_texture_async(const fs::path& path, IExecutor& io = WorkStealingPool::Instance(), IExecutor& gl = QueueExecutor::MainThread());
+
 }
\ No newline at end of file
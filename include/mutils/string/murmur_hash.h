@@ -1,6 +1,48 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 uint32_t murmur_hash(const void * key, int len, uint32_t seed);
 uint64_t murmur_hash_64(const void * key, uint32_t len, uint64_t seed);
+
+// The same hash as murmur_hash, usable at compile time; bytes are assembled little endian, as murmur_hash reads them
+constexpr uint32_t murmur_hash_constexpr(const char* key, size_t len, uint32_t seed)
+{
+    const uint32_t m = 0x5bd1e995;
+    const int r = 24;
+
+    uint32_t h = seed ^ uint32_t(len);
+
+    size_t index = 0;
+    for (; len - index >= 4; index += 4)
+    {
+        uint32_t k = uint32_t(uint8_t(key[index])) | (uint32_t(uint8_t(key[index + 1])) << 8) | (uint32_t(uint8_t(key[index + 2])) << 16) | (uint32_t(uint8_t(key[index + 3])) << 24);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h *= m;
+        h ^= k;
+    }
+
+    switch (len - index)
+    {
+    case 3:
+        h ^= uint32_t(uint8_t(key[index + 2])) << 16;
+        [[fallthrough]];
+    case 2:
+        h ^= uint32_t(uint8_t(key[index + 1])) << 8;
+        [[fallthrough]];
+    case 1:
+        h ^= uint32_t(uint8_t(key[index]));
+        h *= m;
+    };
+
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+
+    return h;
+}
@@ -1,13 +1,17 @@
 #pragma once
 
 #include <functional>
+#include <iterator>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 #include <iomanip>
 
+#include <mutils/string/murmur_hash.h>
+
 namespace MUtils
 {
 
@@ -96,47 +100,91 @@ inline std::wstring string_make_wstring(const std::string& str)
 std::string string_from_wstring(const std::wstring& str);
 std::string string_tolower(const std::string& str);
 
+// The strings behind StringIds, in one table shared by all threads.
+// Lookups are lock free, and a string is only copied in (to an append only arena) the first time its id is seen.
+// Returns false if a different string already has the id; see string_id_set_collision_handler
+bool string_id_intern(uint32_t id, std::string_view str);
+
+// The string for an id, or a null view if it was never interned.  Views stay valid for the life of the program
+std::string_view string_id_lookup(uint32_t id);
+
+// Called when two strings hash to the same id; the default asserts.  Collisions are counted either way
+using StringIdCollisionFn = std::function<void(uint32_t id, std::string_view existing, std::string_view incoming)>;
+void string_id_set_collision_handler(StringIdCollisionFn fn);
+uint32_t string_id_collision_count();
+
+// The id of a string, at compile time if the string is a constant
+constexpr uint32_t string_id_hash(std::string_view str)
+{
+    return murmur_hash_constexpr(str.data(), str.size(), 0);
+}
+
+// A name for an id made at compile time.  Nothing is hashed or stored until a ToString can't find an id;
+// then all deferred names are interned.  Must live as long as the program, like a function static
+struct StringIdDeferredName
+{
+    explicit StringIdDeferredName(const char* pszName);
+
+    const char* pszName;
+    const StringIdDeferredName* pNext = nullptr;
+};
+
+// Interns any deferred names; returns false if there were none
+bool string_id_resolve_deferred();
+
 struct StringId
 {
     uint32_t id = 0;
-    StringId()
+    constexpr StringId()
     {
     }
     StringId(const char* pszString);
     StringId(const std::string& str);
-    StringId(uint32_t _id)
+    constexpr StringId(uint32_t _id)
+        : id(_id)
     {
-        id = _id;
     }
 
-    bool operator==(const StringId& rhs) const
+    constexpr bool operator==(const StringId& rhs) const
     {
         return id == rhs.id;
     }
     const StringId& operator=(const char* pszString);
     const StringId& operator=(const std::string& str);
-    bool operator<(const StringId& rhs) const
+    constexpr bool operator<(const StringId& rhs) const
     {
         return id < rhs.id;
     }
 
     std::string ToString() const
     {
-        auto itr = LookupInstance().find(id);
-        if (itr == LookupInstance().end())
+        auto str = string_id_lookup(id);
+        if (str.data() == nullptr && string_id_resolve_deferred())
+        {
+            str = string_id_lookup(id);
+        }
+        if (str.data() == nullptr)
         {
             return "murmur:" + std::to_string(id);
         }
-        return itr->second;
-    }
-
-    std::unordered_map<uint32_t, std::string>& LookupInstance() const
-    {
-        static std::unordered_map<uint32_t, std::string> look;
-        return look;
+        return std::string(str);
     }
 };
 
+// A compile time id; "name"_sid.  The name isn't recorded, so ToString only finds it if it is also made at run time
+constexpr StringId operator""_sid(const char* pszString, size_t length)
+{
+    return StringId(murmur_hash_constexpr(pszString, length, 0));
+}
+
+// A compile time id whose name is deferred the first time the expression runs, for ToString to find later
+#define MUTILS_SID(str)                                            \
+    ([]() {                                                        \
+        constexpr auto sid = MUtils::string_id_hash(str);          \
+        static const MUtils::StringIdDeferredName sidName(str);    \
+        return MUtils::StringId(sid);                              \
+    }())
+
 inline std::ostream& operator<<(std::ostream& str, const StringId& id)
 {
     str << id.ToString();
@@ -153,6 +201,135 @@ void string_split_each(const std::string& text, const char* delims, std::functio
 void string_split_each(char* text, size_t start, size_t end, const char* delims, std::function<bool(size_t, size_t)> fn);
 size_t string_first_of(const char* text, size_t start, size_t end, const char* delims);
 size_t string_first_not_of(const char* text, size_t start, size_t end, const char* delims);
+// A set of delimiter characters, built once and reused for many scans.
+// Small sets are matched 16/32 characters at a time with SSE2/AVX2; larger ones use the bitmap
+struct StringDelims
+{
+    static constexpr uint32_t MaxVectorChars = 8;
+
+    StringDelims(const char* delims);
+
+    bool Contains(char c) const
+    {
+        auto index = uint8_t(c);
+        return (bits[index >> 6] >> (index & 63)) & 1;
+    }
+
+    uint64_t bits[4] = {};
+    char chars[MaxVectorChars] = {};
+    uint32_t charCount = 0; // More than MaxVectorChars means bitmap only
+};
+
+// Index of the first delimiter/non delimiter at or after start, or npos
+size_t string_first_of(std::string_view text, size_t start, const StringDelims& delims);
+size_t string_first_not_of(std::string_view text, size_t start, const StringDelims& delims);
+
+// Tokens point into text, so they are only valid while it is
+void string_split(std::string_view text, const StringDelims& delims, std::vector<std::string_view>& tokens);
+std::vector<std::string_view> string_split_view(std::string_view text, const StringDelims& delims);
+
+// Splits lazily, a token at a time: for (auto token : string_split_range(text, ", ")) ...
+class StringSplitRange
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        iterator(const StringSplitRange* pRange, size_t start)
+            : m_pRange(pRange)
+        {
+            Find(start);
+        }
+
+        reference operator*() const
+        {
+            return m_token;
+        }
+
+        pointer operator->() const
+        {
+            return &m_token;
+        }
+
+        iterator& operator++()
+        {
+            Find(m_tokenEnd);
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        bool operator==(const iterator& rhs) const
+        {
+            return m_tokenStart == rhs.m_tokenStart;
+        }
+
+        bool operator!=(const iterator& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    private:
+        void Find(size_t from)
+        {
+            auto& text = m_pRange->m_text;
+            m_tokenStart = from >= text.size() ? std::string_view::npos : string_first_not_of(text, from, m_pRange->m_delims);
+            if (m_tokenStart == std::string_view::npos)
+            {
+                m_token = std::string_view();
+                return;
+            }
+            m_tokenEnd = string_first_of(text, m_tokenStart, m_pRange->m_delims);
+            if (m_tokenEnd == std::string_view::npos)
+            {
+                m_tokenEnd = text.size();
+            }
+            m_token = text.substr(m_tokenStart, m_tokenEnd - m_tokenStart);
+        }
+
+        const StringSplitRange* m_pRange;
+        size_t m_tokenStart = std::string_view::npos;
+        size_t m_tokenEnd = 0;
+        std::string_view m_token;
+    };
+
+    StringSplitRange(std::string_view text, const StringDelims& delims)
+        : m_text(text),
+        m_delims(delims)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(this, 0);
+    }
+
+    iterator end() const
+    {
+        return iterator(this, std::string_view::npos);
+    }
+
+private:
+    std::string_view m_text;
+    StringDelims m_delims;
+};
+
+inline StringSplitRange string_split_range(std::string_view text, const StringDelims& delims)
+{
+    return StringSplitRange(text, delims);
+}
+
 std::pair<uint32_t, uint32_t> string_convert_index_to_line_offset(const std::string& str, uint32_t index);
 std::vector<int> string_get_integers(const std::string& str);
 std::vector<std::vector<int>> string_get_integer_grid(const std::string& str, const std::string& delims);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// wyhash (final version 4), a fast 64 bit hash for anything from short keys to large buffers such as
+// shader sources and asset contents.  Several times the throughput of murmur_hash_64; use murmur_hash
+// where ids must stay the same as before (StringId).
+uint64_t wyhash(const void* key, size_t len, uint64_t seed = 0);
+
+// Folds the 64 bit hash, for 32 bit keys
+inline uint32_t wyhash_32(const void* key, size_t len, uint64_t seed = 0)
+{
+    auto h = wyhash(key, len, seed);
+    return uint32_t(h ^ (h >> 32));
+}
+
+// Hashes a buffer given in pieces; the result is the same as wyhash over all of it
+class WyHashStream
+{
+public:
+    explicit WyHashStream(uint64_t seed = 0);
+
+    void Update(const void* data, size_t len);
+    uint64_t Final() const;
+
+private:
+    static constexpr size_t BlockSize = 48;
+    static constexpr size_t TailSize = 16;
+
+    void Block(const uint8_t* p);
+
+    uint64_t m_originalSeed;
+    uint64_t m_seed;
+    uint64_t m_see1;
+    uint64_t m_see2;
+    uint64_t m_length = 0;
+
+    // Bytes not yet in a block, after the last 16 bytes of the previous block; the final step can read back into those
+    uint8_t m_buffer[TailSize + BlockSize];
+    size_t m_bufferSize = 0;
+};
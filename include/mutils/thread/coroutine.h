@@ -0,0 +1,177 @@
+#pragma once
+
+// Coroutine tasks on top of MUtils::Future.
+// The library builds as C++17, so this is only available to code compiled with coroutine support (C++20);
+// check MUTILS_COROUTINES.  Everything here is a thin layer over Future, so C++17 callers can use the same
+// async functions with .then() instead.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+
+#include <mutils/thread/future.h>
+
+#define MUTILS_COROUTINES 1
+
+namespace MUtils
+{
+
+// co_await on a Future suspends until it is ready, and resumes on whichever thread completed it.
+// Use resume_on afterwards to pick a thread
+template <class T>
+class future_awaiter
+{
+public:
+    explicit future_awaiter(Future<T>&& future)
+        : m_future(std::move(future))
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return m_future.is_ready();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_future.on_ready(InlineExecutor::Instance(), [this, handle](Future<T>&& ready) {
+            m_future = std::move(ready);
+            handle.resume();
+        });
+    }
+
+    T await_resume()
+    {
+        return m_future.get();
+    }
+
+private:
+    Future<T> m_future;
+};
+
+template <class T>
+future_awaiter<T> operator co_await(Future<T>&& future)
+{
+    return future_awaiter<T>(std::move(future));
+}
+
+// co_await resume_on(executor) continues the coroutine on that executor;
+// e.g. a pool for file I/O, or QueueExecutor::MainThread() for GL calls
+class resume_on
+{
+public:
+    explicit resume_on(IExecutor& executor)
+        : m_executor(executor)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_executor.Execute([handle]() {
+            handle.resume();
+        });
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+
+private:
+    IExecutor& m_executor;
+};
+
+namespace detail
+{
+
+template <class T>
+struct task_promise_base
+{
+    Promise<T> promise;
+    Future<T> future = promise.get_future();
+
+    // Starts straight away on the calling thread, and cleans itself up when done
+    std::suspend_never initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    std::suspend_never final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        promise.set_exception(std::current_exception());
+    }
+};
+
+template <class T>
+struct task_promise : task_promise_base<T>
+{
+    template <class V>
+    void return_value(V&& value)
+    {
+        this->promise.set_value(std::forward<V>(value));
+    }
+};
+
+template <>
+struct task_promise<void> : task_promise_base<void>
+{
+    void return_void()
+    {
+        this->promise.set_value();
+    }
+};
+
+} // namespace detail
+
+// An eagerly started coroutine returning T.  Await it from another coroutine, or take its future
+template <class T = void>
+class task
+{
+public:
+    struct promise_type : detail::task_promise<T>
+    {
+        task get_return_object()
+        {
+            return task(std::move(this->future));
+        }
+    };
+
+    task(task&&) noexcept = default;
+    task& operator=(task&&) noexcept = default;
+
+    future_awaiter<T> operator co_await() noexcept
+    {
+        return future_awaiter<T>(std::move(m_future));
+    }
+
+    Future<T> future() noexcept
+    {
+        return std::move(m_future);
+    }
+
+    // Blocks; not for use on a thread the task needs to finish
+    T get()
+    {
+        return m_future.get();
+    }
+
+private:
+    explicit task(Future<T>&& future)
+        : m_future(std::move(future))
+    {
+    }
+
+    Future<T> m_future;
+};
+
+} // namespace MUtils
+
+#endif
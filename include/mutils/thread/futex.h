@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace MUtils
+{
+
+// Park/unpark threads on a 32 bit word.
+// Linux uses the futex syscall, Windows uses WaitOnAddress; other platforms fall back to a
+// small table of condition variables keyed on the address.
+// As with the OS primitives, waits can return spuriously, so callers must re-check their condition.
+
+// Sleeps while word == expected.  A negative timeout waits forever.
+// Returns false if the timeout expired.
+bool futex_wait(std::atomic<uint32_t>& word, uint32_t expected, int64_t timeoutNs = -1);
+
+void futex_wake_one(std::atomic<uint32_t>& word);
+void futex_wake_all(std::atomic<uint32_t>& word);
+
+// Priority inheriting locks; Linux only (FUTEX_LOCK_PI).
+// The word holds the owner's futex_thread_id(), or 0 when free; the kernel boosts the owner to the priority
+// of the highest waiter, so a low priority thread can't hold up the audio thread for long.
+bool futex_has_pi();
+uint32_t futex_thread_id();
+
+// Blocks until the word is owned by this thread.  Call after a failed compare_exchange(0 -> id).
+// Returns false, without the lock, if the kernel couldn't queue us (e.g. ENOMEM); the caller has to wait some other way
+bool futex_lock_pi(std::atomic<uint32_t>& word);
+
+// Call after a failed compare_exchange(id -> 0); hands the lock to the top waiter
+void futex_unlock_pi(std::atomic<uint32_t>& word);
+
+} // namespace MUtils
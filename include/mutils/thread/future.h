@@ -0,0 +1,586 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <concurrentqueue/concurrentqueue.h>
+
+#include <mutils/thread/futex.h>
+#include <mutils/thread/small_function.h>
+
+namespace MUtils
+{
+
+// Somewhere to run continuations: inline, on a pool, or queued for a particular thread
+class IExecutor
+{
+public:
+    virtual ~IExecutor() = default;
+    virtual void Execute(small_function<void()>&& fn) = 0;
+};
+
+// Runs the continuation on whichever thread completed the future
+class InlineExecutor : public IExecutor
+{
+public:
+    void Execute(small_function<void()>&& fn) override
+    {
+        fn();
+    }
+
+    static InlineExecutor& Instance()
+    {
+        static InlineExecutor executor;
+        return executor;
+    }
+};
+
+// Queues work for a thread that drains it with RunPending; e.g. the UI thread, once a frame
+class QueueExecutor : public IExecutor
+{
+public:
+    void Execute(small_function<void()>&& fn) override
+    {
+        m_queue.enqueue(std::move(fn));
+    }
+
+    // Returns the number of tasks run
+    size_t RunPending(size_t maxCount = SIZE_MAX)
+    {
+        small_function<void()> fn;
+        size_t count = 0;
+        while (count < maxCount && m_queue.try_dequeue(fn))
+        {
+            fn();
+            fn.reset();
+            count++;
+        }
+        return count;
+    }
+
+    // Drained by the app starter at the start of every frame
+    static QueueExecutor& MainThread()
+    {
+        static QueueExecutor executor;
+        return executor;
+    }
+
+private:
+    moodycamel::ConcurrentQueue<small_function<void()>> m_queue;
+};
+
+template <class T>
+class Future;
+
+template <class T>
+class Promise;
+
+namespace detail
+{
+
+template <class T>
+using FutureValue = std::conditional_t<std::is_void<T>::value, std::monostate, T>;
+
+// Shared between a Promise and its Future.  The state word is the only synchronization:
+// whoever sets the second of 'ready' and 'has continuation' dispatches the continuation
+template <class T>
+class FutureState
+{
+public:
+    enum : uint32_t
+    {
+        ReadyBit = (1 << 0),
+        ContinuationBit = (1 << 1),
+        WaiterBit = (1 << 2)
+    };
+
+    void AddRef() noexcept
+    {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release() noexcept
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete this;
+        }
+    }
+
+    bool IsReady() const noexcept
+    {
+        return (m_word.load(std::memory_order_acquire) & ReadyBit) != 0;
+    }
+
+    void Wait() noexcept
+    {
+        auto word = m_word.load(std::memory_order_acquire);
+        while (!(word & ReadyBit))
+        {
+            // Tell Complete that it needs to wake someone, then sleep unless it got in first
+            word = m_word.fetch_or(WaiterBit, std::memory_order_acq_rel) | WaiterBit;
+            if (!(word & ReadyBit))
+            {
+                futex_wait(m_word, word);
+            }
+            word = m_word.load(std::memory_order_acquire);
+        }
+    }
+
+    void Complete() noexcept
+    {
+        auto previous = m_word.fetch_or(ReadyBit, std::memory_order_acq_rel);
+        if (previous & ContinuationBit)
+        {
+            Dispatch();
+        }
+        if (previous & WaiterBit)
+        {
+            futex_wake_all(m_word);
+        }
+    }
+
+    void SetContinuation(IExecutor& executor, small_function<void()>&& fn) noexcept
+    {
+        assert(!m_continuation);
+        m_continuation = std::move(fn);
+        m_pExecutor = &executor;
+
+        auto previous = m_word.fetch_or(ContinuationBit, std::memory_order_acq_rel);
+        if (previous & ReadyBit)
+        {
+            Dispatch();
+        }
+    }
+
+    std::optional<FutureValue<T>> m_value;
+    std::exception_ptr m_spException;
+
+private:
+    void Dispatch() noexcept
+    {
+        // The continuation may hold the last reference to this state, so take it out before running it
+        auto pExecutor = m_pExecutor;
+        auto continuation = std::move(m_continuation);
+        pExecutor->Execute(std::move(continuation));
+    }
+
+    std::atomic<uint32_t> m_refs = 1;
+    std::atomic<uint32_t> m_word = 0;
+    small_function<void()> m_continuation;
+    IExecutor* m_pExecutor = nullptr;
+};
+
+template <class F, class T>
+struct continuation_result
+{
+    using type = std::invoke_result_t<F, T>;
+};
+
+template <class F>
+struct continuation_result<F, void>
+{
+    using type = std::invoke_result_t<F>;
+};
+
+template <class F, class T>
+using continuation_result_t = typename continuation_result<F, T>::type;
+
+} // namespace detail
+
+// A std::future replacement which can attach continuations instead of being polled.
+// Move only, single consumer.  The shared state is the only allocation; continuations are stored inline
+// if they fit in a small_function.
+template <class T>
+class Future
+{
+public:
+    using State = detail::FutureState<T>;
+
+    Future() noexcept = default;
+    explicit Future(State* pState) noexcept
+        : m_pState(pState)
+    {
+    }
+
+    Future(Future&& rhs) noexcept
+        : m_pState(std::exchange(rhs.m_pState, nullptr))
+    {
+    }
+
+    Future& operator=(Future&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            reset();
+            m_pState = std::exchange(rhs.m_pState, nullptr);
+        }
+        return *this;
+    }
+
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    ~Future()
+    {
+        reset();
+    }
+
+    static Future MakeReady(detail::FutureValue<T> value = {})
+    {
+        auto pState = new State();
+        pState->m_value.emplace(std::move(value));
+        pState->Complete();
+        return Future(pState);
+    }
+
+    static Future MakeException(std::exception_ptr spException)
+    {
+        auto pState = new State();
+        pState->m_spException = spException;
+        pState->Complete();
+        return Future(pState);
+    }
+
+    bool valid() const noexcept
+    {
+        return m_pState != nullptr;
+    }
+
+    bool is_ready() const noexcept
+    {
+        return m_pState && m_pState->IsReady();
+    }
+
+    bool has_exception() const noexcept
+    {
+        return is_ready() && m_pState->m_spException;
+    }
+
+    void wait() const noexcept
+    {
+        assert(m_pState);
+        m_pState->Wait();
+    }
+
+    // Blocks until ready, then takes the value (or rethrows).  The future is empty afterwards
+    T get()
+    {
+        assert(m_pState);
+        m_pState->Wait();
+
+        Future consumed(std::move(*this));
+        if (consumed.m_pState->m_spException)
+        {
+            std::rethrow_exception(consumed.m_pState->m_spException);
+        }
+
+        if constexpr (!std::is_void<T>::value)
+        {
+            return std::move(*consumed.m_pState->m_value);
+        }
+    }
+
+    // Calls fn(Future<T>&&) with the completed future on the executor; sees exceptions as well as values.
+    // Consumes this future
+    template <class F>
+    void on_ready(IExecutor& executor, F&& fn)
+    {
+        assert(m_pState);
+        auto pState = std::exchange(m_pState, nullptr);
+        pState->SetContinuation(executor, [fn = std::forward<F>(fn), ready = Future(pState)]() mutable {
+            fn(std::move(ready));
+        });
+    }
+
+    // Calls fn(value) on the executor once ready, returning a future for fn's result.
+    // Exceptions skip fn and pass straight through to the returned future.  Consumes this future
+    template <class F>
+    Future<detail::continuation_result_t<F, T>> then(IExecutor& executor, F&& fn)
+    {
+        using R = detail::continuation_result_t<F, T>;
+
+        Promise<R> promise;
+        auto result = promise.get_future();
+        on_ready(executor, [fn = std::forward<F>(fn), promise = std::move(promise)](Future<T>&& ready) mutable {
+            if (ready.m_pState->m_spException)
+            {
+                promise.set_exception(ready.m_pState->m_spException);
+                return;
+            }
+
+            promise.set_with([&]() {
+                if constexpr (std::is_void<T>::value)
+                {
+                    return fn();
+                }
+                else
+                {
+                    return fn(std::move(*ready.m_pState->m_value));
+                }
+            });
+        });
+        return result;
+    }
+
+    template <class F>
+    Future<detail::continuation_result_t<F, T>> then(F&& fn)
+    {
+        return then(InlineExecutor::Instance(), std::forward<F>(fn));
+    }
+
+private:
+    template <class>
+    friend class Future;
+
+    void reset() noexcept
+    {
+        if (m_pState)
+        {
+            std::exchange(m_pState, nullptr)->Release();
+        }
+    }
+
+    State* m_pState = nullptr;
+};
+
+template <class T>
+class Promise
+{
+public:
+    using State = detail::FutureState<T>;
+
+    Promise()
+        : m_pState(new State())
+    {
+    }
+
+    Promise(Promise&& rhs) noexcept
+        : m_pState(std::exchange(rhs.m_pState, nullptr))
+        , m_retrieved(rhs.m_retrieved)
+    {
+    }
+
+    Promise& operator=(Promise&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            abandon();
+            m_pState = std::exchange(rhs.m_pState, nullptr);
+            m_retrieved = rhs.m_retrieved;
+        }
+        return *this;
+    }
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    // An unfulfilled promise breaks its future, like std::promise
+    ~Promise()
+    {
+        abandon();
+    }
+
+    Future<T> get_future()
+    {
+        assert(m_pState && !m_retrieved);
+        m_retrieved = true;
+        m_pState->AddRef();
+        return Future<T>(m_pState);
+    }
+
+    template <class... V>
+    void set_value(V&&... value)
+    {
+        assert(m_pState);
+        m_pState->m_value.emplace(std::forward<V>(value)...);
+        complete();
+    }
+
+    void set_exception(std::exception_ptr spException)
+    {
+        assert(m_pState);
+        m_pState->m_spException = spException;
+        complete();
+    }
+
+    // Sets the value from fn(), or the exception it throws
+    template <class F>
+    void set_with(F&& fn)
+    {
+        try
+        {
+            if constexpr (std::is_void<T>::value)
+            {
+                fn();
+                set_value();
+            }
+            else
+            {
+                set_value(fn());
+            }
+        }
+        catch (...)
+        {
+            set_exception(std::current_exception());
+        }
+    }
+
+private:
+    void complete()
+    {
+        auto pState = std::exchange(m_pState, nullptr);
+        pState->Complete();
+        pState->Release();
+    }
+
+    void abandon()
+    {
+        if (m_pState)
+        {
+            set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    State* m_pState = nullptr;
+    bool m_retrieved = false;
+};
+
+// Runs fn() on the executor; the future gets its result, or what it threw
+template <class F>
+auto run_async(IExecutor& executor, F&& fn)
+{
+    using R = std::invoke_result_t<F>;
+    Promise<R> promise;
+    auto future = promise.get_future();
+    executor.Execute([promise = std::move(promise), fn = std::forward<F>(fn)]() mutable {
+        promise.set_with(fn);
+    });
+    return future;
+}
+
+template <class T>
+using when_all_result_t = std::conditional_t<std::is_void<T>::value, void, std::vector<detail::FutureValue<T>>>;
+
+// Ready when all the futures are; holds their values in order, or the first exception
+template <class T>
+Future<when_all_result_t<T>> when_all(std::vector<Future<T>>&& futures)
+{
+    using R = when_all_result_t<T>;
+    if (futures.empty())
+    {
+        return Future<R>::MakeReady();
+    }
+
+    struct Shared
+    {
+        std::atomic<size_t> remaining;
+        std::vector<detail::FutureValue<T>> values;
+        std::exception_ptr spException;
+        std::atomic_flag failed = ATOMIC_FLAG_INIT;
+        Promise<R> promise;
+    };
+
+    auto spShared = std::make_shared<Shared>();
+    spShared->remaining = futures.size();
+    spShared->values.resize(futures.size());
+    auto result = spShared->promise.get_future();
+
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        futures[i].on_ready(InlineExecutor::Instance(), [spShared, i](Future<T>&& ready) {
+            try
+            {
+                if constexpr (std::is_void<T>::value)
+                {
+                    ready.get();
+                }
+                else
+                {
+                    spShared->values[i] = ready.get();
+                }
+            }
+            catch (...)
+            {
+                if (!spShared->failed.test_and_set())
+                {
+                    spShared->spException = std::current_exception();
+                }
+            }
+
+            if (spShared->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                if (spShared->spException)
+                {
+                    spShared->promise.set_exception(spShared->spException);
+                }
+                else if constexpr (std::is_void<T>::value)
+                {
+                    spShared->promise.set_value();
+                }
+                else
+                {
+                    spShared->promise.set_value(std::move(spShared->values));
+                }
+            }
+        });
+    }
+    futures.clear();
+    return result;
+}
+
+// The index of the first future to complete, and its value
+template <class T>
+using when_any_result_t = std::conditional_t<std::is_void<T>::value, size_t, std::pair<size_t, detail::FutureValue<T>>>;
+
+// Ready when the first of the futures is, with its index and value (or exception).  The rest are dropped
+template <class T>
+Future<when_any_result_t<T>> when_any(std::vector<Future<T>>&& futures)
+{
+    using R = when_any_result_t<T>;
+    assert(!futures.empty());
+
+    struct Shared
+    {
+        std::atomic_flag done = ATOMIC_FLAG_INIT;
+        Promise<R> promise;
+    };
+
+    auto spShared = std::make_shared<Shared>();
+    auto result = spShared->promise.get_future();
+
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        futures[i].on_ready(InlineExecutor::Instance(), [spShared, i](Future<T>&& ready) {
+            if (spShared->done.test_and_set())
+            {
+                return;
+            }
+
+            spShared->promise.set_with([&]() {
+                if constexpr (std::is_void<T>::value)
+                {
+                    ready.get();
+                    return i;
+                }
+                else
+                {
+                    return R(i, ready.get());
+                }
+            });
+        });
+    }
+    futures.clear();
+    return result;
+}
+
+} // namespace MUtils
@@ -1,10 +1,16 @@
 
 #pragma once
 
+#include <atomic>
 #include <concurrentqueue/concurrentqueue.h>
 #include <cstdint>
 #include <cassert>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <ctti/type_id.hpp>
 
@@ -15,15 +21,119 @@ namespace MUtils
 
 struct IListItem;
 
+// Occupancy and churn counters for a pool.
+// Relaxed atomics; they are only ever read for reporting, so ordering doesn't matter
+struct MemoryPoolStats
+{
+    std::atomic<uint64_t> allocs = 0; // Calls to Alloc
+    std::atomic<uint64_t> frees = 0; // Calls to Free
+    std::atomic<uint64_t> heapAllocs = 0; // Allocs that missed the free list and called new
+    std::atomic<int64_t> liveCount = 0; // Items handed out and not yet returned
+    std::atomic<int64_t> freeCount = 0; // Items waiting in the free list
+    std::atomic<int64_t> highWater = 0; // Peak of liveCount
+    std::atomic<uint64_t> exhausted = 0; // Allocs a fixed pool couldn't serve from its free list
+    std::atomic<uint64_t> reserveFailures = 0; // Fixed pool setup steps (lock, prefault, huge pages) that failed
+
+    void OnAlloc(bool fromHeap)
+    {
+        allocs.fetch_add(1, std::memory_order_relaxed);
+        if (fromHeap)
+        {
+            heapAllocs.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            freeCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        auto live = liveCount.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto peak = highWater.load(std::memory_order_relaxed);
+        while (live > peak && !highWater.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void OnFree(uint64_t count = 1)
+    {
+        frees.fetch_add(count, std::memory_order_relaxed);
+        liveCount.fetch_sub(int64_t(count), std::memory_order_relaxed);
+        freeCount.fetch_add(int64_t(count), std::memory_order_relaxed);
+    }
+};
+
+// A copy of the stats at a point in time, with rates since the previous sample
+struct MemoryPoolSnapshot
+{
+    std::string name;
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t heapAllocs = 0;
+    int64_t liveCount = 0;
+    int64_t freeCount = 0;
+    int64_t highWater = 0;
+    uint64_t exhausted = 0;
+    uint64_t reserveFailures = 0;
+    double allocsPerSecond = 0.0;
+    double freesPerSecond = 0.0;
+};
+
 struct IMemoryPool
 {
+    IMemoryPool();
+    virtual ~IMemoryPool();
+
+    IMemoryPool(const IMemoryPool&) = delete;
+    IMemoryPool& operator=(const IMemoryPool&) = delete;
+
     virtual void Free(void* pEv) = 0;
+
+    // Return a detached strand of items, pBegin to pEnd inclusive, in one operation.
+    // A null pEnd means the rest of the strand.  Passing the count (if known) saves a walk of the strand.
+    // Note that PoolItem::Free is not called for the items.
+    virtual void FreeChain(IListItem* pBegin, IListItem* pEnd = nullptr, uint32_t count = 0) = 0;
+
+    void SetName(const char* pszName)
+    {
+        m_pszName = pszName;
+    }
+
+    const char* GetName() const
+    {
+        return m_pszName;
+    }
+
+    const MemoryPoolStats& GetStats() const
+    {
+        return m_stats;
+    }
     
     IListItem* m_pRoot = nullptr;
     IListItem* m_pLast = nullptr;
 
+protected:
+    const char* m_pszName = "MemoryPool";
+    MemoryPoolStats m_stats;
+
+private:
+    friend MemoryPoolSnapshot mempool_sample(IMemoryPool& pool);
+
+    // Owned by mempool_sample, for the rate calculation; any thread can sample, so they are guarded
+    std::mutex m_sampleMutex;
+    int64_t m_lastSampleTime = 0;
+    uint64_t m_lastSampleAllocs = 0;
+    uint64_t m_lastSampleFrees = 0;
+    double m_lastAllocRate = 0.0;
+    double m_lastFreeRate = 0.0;
 };
 
+// Every live pool is registered on construction, so it can be reported.
+// Sample from any thread; the rates are relative to the last sample of the pool, whoever took it
+MemoryPoolSnapshot mempool_sample(IMemoryPool& pool);
+std::vector<MemoryPoolSnapshot> mempool_sample_all();
+
+// Publish the stats of all pools as profiler counters; call once a frame
+void mempool_profile_counters();
+
 #define DECLARE_POOL_ITEM(className)                 \
     static ctti::type_id_t TypeID()                  \
     {                                                \
@@ -56,6 +166,35 @@ void list_insert_before(IListItem* pPos, gsl::not_null<IListItem*> pInsert);
 IListItem* list_disconnect(gsl::not_null<IListItem*> pEvent);
 IListItem* list_disconnect_range(IListItem* pBegin, IListItem* pEnd);
 IListItem* list_end(gsl::not_null<IListItem*> pEvent);
+uint32_t list_count(IListItem* pBegin, IListItem* pEnd = nullptr);
+
+// Slice a range out of its pool list and return it to the pool in one go; returns the item after the range
+IListItem* list_free_range(IListItem* pBegin, IListItem* pEnd);
+
+// Walks a strand of items for bulk queue operations
+template <class T>
+struct ListItemIterator
+{
+    IListItem* m_pItem = nullptr;
+
+    T* operator*() const
+    {
+        return static_cast<T*>(m_pItem);
+    }
+
+    ListItemIterator& operator++()
+    {
+        m_pItem = m_pItem->m_pNext;
+        return *this;
+    }
+
+    ListItemIterator operator++(int)
+    {
+        auto ret = *this;
+        m_pItem = m_pItem->m_pNext;
+        return ret;
+    }
+};
 
 class PoolItem : public IListItem
 {
@@ -83,6 +222,55 @@ public:
     uint64_t m_id = (uint64_t)-1;
 };
 
+namespace MemoryPoolFlags
+{
+enum
+{
+    None = (0),
+    Fixed = (1 << 0), // Allocate all items up front in one slab, and never call new after construction
+    Prefault = (1 << 1), // Touch every page of the slab so first use doesn't page fault
+    Lock = (1 << 2), // Lock the slab into physical memory (mlock/VirtualLock)
+    HugePages = (1 << 3), // Ask for transparent huge pages for the slab, where supported
+    RealTime = Fixed | Prefault | Lock
+};
+}
+
+struct MemoryPoolOptions
+{
+    uint32_t capacity = 0;
+    uint32_t flags = MemoryPoolFlags::None;
+
+    // Called instead of new when a fixed pool is empty.  Can return an item from elsewhere, or nullptr
+    std::function<PoolItem*(IMemoryPool&)> fnExhausted;
+};
+
+// The backing memory for a fixed pool.
+// Failures to lock/prefault are recorded in the stats; the slab is still usable, it just isn't real time safe
+struct MemoryPoolSlab
+{
+    ~MemoryPoolSlab()
+    {
+        // Every item lives in the slab, so they must all be back before it goes
+        assert((m_pStats == nullptr || m_pStats->liveCount.load(std::memory_order_relaxed) == 0) && "Items still allocated from a fixed pool");
+        Release();
+    }
+
+    bool Reserve(size_t bytes, uint32_t flags, MemoryPoolStats& stats);
+    void Release();
+
+    bool Contains(const void* pItem) const
+    {
+        return pItem >= m_pMemory && pItem < (m_pMemory + m_size);
+    }
+
+    uint8_t* m_pMemory = nullptr;
+    size_t m_size = 0;
+    uint32_t m_flags = 0;
+
+    // The owning pool's stats, for the outstanding item check
+    const MemoryPoolStats* m_pStats = nullptr;
+};
+
 // Thread safe memory pool
 template <class T>
 class TSMemoryPool : public IMemoryPool
@@ -94,7 +282,32 @@ public:
     {
         for (uint32_t i = 0; i < initialSize; i++)
         {
-            m_freeItems.enqueue(Alloc());
+            m_freeItems.enqueue(new T(this, m_nextId++));
+        }
+        m_stats.freeCount.fetch_add(initialSize, std::memory_order_relaxed);
+    }
+
+    TSMemoryPool(const MemoryPoolOptions& options)
+        : m_fnExhausted(options.fnExhausted)
+    {
+        if (!(options.flags & MemoryPoolFlags::Fixed))
+        {
+            for (uint32_t i = 0; i < options.capacity; i++)
+            {
+                m_freeItems.enqueue(new T(this, m_nextId++));
+            }
+            m_stats.freeCount.fetch_add(options.capacity, std::memory_order_relaxed);
+            return;
+        }
+
+        m_fixed = true;
+        if (m_slab.Reserve(sizeof(T) * options.capacity, options.flags, m_stats))
+        {
+            for (uint32_t i = 0; i < options.capacity; i++)
+            {
+                m_freeItems.enqueue(new (m_slab.m_pMemory + i * sizeof(T)) T(this, m_nextId++));
+            }
+            m_stats.freeCount.fetch_add(options.capacity, std::memory_order_relaxed);
         }
     }
 
@@ -109,7 +322,15 @@ public:
         T* pVictim = nullptr;
         while (m_freeItems.try_dequeue(pVictim))
         {
-            delete pVictim;
+            if (m_slab.Contains(pVictim))
+            {
+                pVictim->~T();
+            }
+            else
+            {
+                delete pVictim;
+            }
+            m_stats.freeCount.fetch_sub(1, std::memory_order_relaxed);
         }
     }
 
@@ -117,14 +338,25 @@ public:
     {
         T* pRet = nullptr;
 
-        if (!m_freeItems.try_dequeue(pRet))
+        bool fromHeap = !m_freeItems.try_dequeue(pRet);
+        if (fromHeap && m_fixed)
+        {
+            // Never grow a fixed pool
+            m_stats.exhausted.fetch_add(1, std::memory_order_relaxed);
+            return AllocExhausted();
+        }
+        else if (fromHeap)
         {
             pRet = new T(this, m_nextId++);
         }
         else
         {
+            // Items returned by FreeChain still have their links
+            pRet->m_pNext = nullptr;
+            pRet->m_pPrevious = nullptr;
             pRet->m_id = m_nextId++;
         }
+        m_stats.OnAlloc(fromHeap);
         pRet->Init();
         return pRet;
     }
@@ -134,11 +366,48 @@ public:
         // store the free item for later
         auto pTyped = (T*)pVal;
         m_freeItems.enqueue(pTyped);
+        m_stats.OnFree();
+    }
+
+    virtual void FreeChain(IListItem* pBegin, IListItem* pEnd = nullptr, uint32_t count = 0) override
+    {
+        if (pBegin == nullptr)
+        {
+            return;
+        }
+        assert(pBegin->m_pPrevious == nullptr);
+        assert(pEnd == nullptr || pEnd->m_pNext == nullptr);
+
+        if (count == 0)
+        {
+            count = list_count(pBegin, pEnd);
+        }
+
+        // One bulk enqueue; the items are not visible to Alloc until it completes
+        m_freeItems.enqueue_bulk(ListItemIterator<T>{ pBegin }, count);
+        m_stats.OnFree(count);
     }
 
 private:
+    // The fallback item is initialised like any other; it stays owned by wherever it came from
+    T* AllocExhausted()
+    {
+        auto pRet = m_fnExhausted ? static_cast<T*>(m_fnExhausted(*this)) : nullptr;
+        if (pRet)
+        {
+            pRet->m_pNext = nullptr;
+            pRet->m_pPrevious = nullptr;
+            pRet->Init();
+        }
+        return pRet;
+    }
+
     moodycamel::ConcurrentQueue<T*> m_freeItems;
-    uint64_t m_nextId = 0;
+    std::atomic<uint64_t> m_nextId = 0;
+
+    bool m_fixed = false;
+    MemoryPoolSlab m_slab;
+    std::function<PoolItem*(IMemoryPool&)> m_fnExhausted;
 };
 
 // Memory pool, not thread safe
@@ -152,7 +421,32 @@ public:
     {
         for (uint32_t i = 0; i < initialSize; i++)
         {
-            m_freeItems.emplace_back(Alloc());
+            PushFree(new T(this, m_nextId++));
+        }
+        m_stats.freeCount.fetch_add(initialSize, std::memory_order_relaxed);
+    }
+
+    MemoryPool(const MemoryPoolOptions& options)
+        : m_fnExhausted(options.fnExhausted)
+    {
+        if (!(options.flags & MemoryPoolFlags::Fixed))
+        {
+            for (uint32_t i = 0; i < options.capacity; i++)
+            {
+                PushFree(new T(this, m_nextId++));
+            }
+            m_stats.freeCount.fetch_add(options.capacity, std::memory_order_relaxed);
+            return;
+        }
+
+        m_fixed = true;
+        if (m_slab.Reserve(sizeof(T) * options.capacity, options.flags, m_stats))
+        {
+            for (uint32_t i = 0; i < options.capacity; i++)
+            {
+                PushFree(new (m_slab.m_pMemory + i * sizeof(T)) T(this, m_nextId++));
+            }
+            m_stats.freeCount.fetch_add(options.capacity, std::memory_order_relaxed);
         }
     }
 
@@ -164,26 +458,49 @@ public:
     void Clear()
     {
         // Final delete of free items
-        for (auto& pVictim : m_freeItems)
+        int64_t count = 0;
+        while (m_pFreeList)
         {
-            delete pVictim;
+            auto pVictim = static_cast<T*>(m_pFreeList);
+            m_pFreeList = m_pFreeList->m_pNext;
+            if (m_slab.Contains(pVictim))
+            {
+                pVictim->~T();
+            }
+            else
+            {
+                delete pVictim;
+            }
+            count++;
         }
+        m_stats.freeCount.fetch_sub(count, std::memory_order_relaxed);
     }
 
     T* Alloc()
     {
         T* pRet = nullptr;
-        if (m_freeItems.empty())
+        bool fromHeap = m_pFreeList == nullptr;
+        if (fromHeap && m_fixed)
+        {
+            // Never grow a fixed pool
+            m_stats.exhausted.fetch_add(1, std::memory_order_relaxed);
+            return AllocExhausted();
+        }
+        else if (fromHeap)
         {
             pRet = new T(this, m_nextId++);
         }
         else
         {
-            pRet = m_freeItems.back();
-            m_freeItems.pop_back();
+            pRet = static_cast<T*>(m_pFreeList);
+            m_pFreeList = m_pFreeList->m_pNext;
 
+            // Items returned by FreeChain still have their back links
+            pRet->m_pNext = nullptr;
+            pRet->m_pPrevious = nullptr;
             pRet->m_id = m_nextId++;
         }
+        m_stats.OnAlloc(fromHeap);
         pRet->Init();
         return pRet;
     }
@@ -192,12 +509,60 @@ public:
     {
         // store the free item for later
         auto pTyped = (T*)pVal;
-        m_freeItems.push_back(pTyped);
+        PushFree(pTyped);
+        m_stats.OnFree();
+    }
+
+    virtual void FreeChain(IListItem* pBegin, IListItem* pEnd = nullptr, uint32_t count = 0) override
+    {
+        if (pBegin == nullptr)
+        {
+            return;
+        }
+        assert(pBegin->m_pPrevious == nullptr);
+
+        // The free list is linked through the items, so the whole strand is spliced on the front
+        if (pEnd == nullptr || count == 0)
+        {
+            count = list_count(pBegin, pEnd);
+            pEnd = pEnd ? pEnd : list_end(gsl::not_null<IListItem*>(pBegin));
+        }
+        assert(pEnd->m_pNext == nullptr);
+
+        pEnd->m_pNext = m_pFreeList;
+        m_pFreeList = pBegin;
+        m_stats.OnFree(count);
     }
 
 private:
-    std::vector<T*> m_freeItems;
+    // The fallback item is initialised like any other; it stays owned by wherever it came from
+    T* AllocExhausted()
+    {
+        auto pRet = m_fnExhausted ? static_cast<T*>(m_fnExhausted(*this)) : nullptr;
+        if (pRet)
+        {
+            pRet->m_pNext = nullptr;
+            pRet->m_pPrevious = nullptr;
+            pRet->Init();
+        }
+        return pRet;
+    }
+
+    void PushFree(IListItem* pItem)
+    {
+        // Only the next pointer is used in the free list
+        pItem->m_pPrevious = nullptr;
+        pItem->m_pNext = m_pFreeList;
+        m_pFreeList = pItem;
+    }
+
+private:
+    IListItem* m_pFreeList = nullptr;
     uint64_t m_nextId = 0;
+
+    bool m_fixed = false;
+    MemoryPoolSlab m_slab;
+    std::function<PoolItem*(IMemoryPool&)> m_fnExhausted;
 };
 
 }; // namespace MUtils
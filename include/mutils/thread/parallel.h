@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <mutils/thread/work_pool.h>
+
+namespace MUtils
+{
+
+namespace detail
+{
+
+// Splits [0, count) into chunks which the caller and up to WorkerCount() helper tasks grab as they go.
+// Chunks start big and shrink towards the grain as the range runs out (guided scheduling),
+// so uneven work still balances.  fn(participant, begin, end); the caller is participant 0.
+// Returns the number of participants.
+template <class Fn>
+size_t parallel_run(WorkStealingPool& pool, size_t count, size_t grain, Fn&& fn)
+{
+    grain = std::max(grain, size_t(1));
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    auto chunks = (count + grain - 1) / grain;
+    auto helpers = std::min(pool.WorkerCount(), chunks - 1);
+
+    // No workers, or not worth splitting; just run it here, like TPool does
+    if (helpers == 0)
+    {
+        fn(size_t(0), size_t(0), count);
+        return 1;
+    }
+
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> finished = 0;
+    std::exception_ptr spException;
+    std::mutex exceptionMutex;
+
+    auto work = [&](size_t participant) {
+        try
+        {
+            for (;;)
+            {
+                auto remaining = count - std::min(count, next.load(std::memory_order_relaxed));
+                auto chunk = std::max(grain, remaining / (2 * (helpers + 1)));
+                auto start = next.fetch_add(chunk, std::memory_order_relaxed);
+                if (start >= count)
+                {
+                    break;
+                }
+                fn(participant, start, std::min(start + chunk, count));
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(exceptionMutex);
+            if (!spException)
+            {
+                spException = std::current_exception();
+            }
+
+            // Stop everyone else picking up more work
+            next.store(count);
+        }
+    };
+
+    for (size_t i = 0; i < helpers; i++)
+    {
+        pool.run([&work, &finished, i]() {
+            work(i + 1);
+            finished.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    work(0);
+
+    // The helpers reference this stack frame, so wait for all of them, even ones that never got to start.
+    // Help out with other work while waiting, in case we are a worker and our helpers are queued behind us
+    while (finished.load(std::memory_order_acquire) != helpers)
+    {
+        if (!pool.TryRunOne())
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    if (spException)
+    {
+        std::rethrow_exception(spException);
+    }
+    return helpers + 1;
+}
+
+// One participant's partial result, on its own cache line; also keeps vector<bool> from packing them
+template <class T>
+struct alignas(64) Partial
+{
+    T value;
+};
+
+} // namespace detail
+
+// Calls fn(subBegin, subEnd) over pieces of [begin, end), in parallel on the pool.
+// Pieces are at least 'grain' long (except the last); pick a grain that makes each call worth a task
+template <class Index, class Fn>
+void parallel_for(WorkStealingPool& pool, Index begin, Index end, Index grain, Fn&& fn)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    detail::parallel_run(pool, size_t(end - begin), size_t(grain), [&](size_t, size_t b, size_t e) {
+        fn(Index(begin + b), Index(begin + e));
+    });
+}
+
+template <class Index, class Fn>
+void parallel_for(Index begin, Index end, Index grain, Fn&& fn)
+{
+    parallel_for(WorkStealingPool::Instance(), begin, end, grain, std::forward<Fn>(fn));
+}
+
+// Reduces [begin, end) with fn(subBegin, subEnd, accumulator) -> accumulator, then
+// joins the partial results with combine(lhs, rhs).
+// Each thread starts from identity; the partial results are combined in a fixed order, but how the range
+// is split between threads is not, so combine should be associative
+template <class Index, class T, class Fn, class Combine>
+T parallel_reduce(WorkStealingPool& pool, Index begin, Index end, Index grain, T identity, Fn&& fn, Combine&& combine)
+{
+    if (end <= begin)
+    {
+        return identity;
+    }
+
+    std::vector<detail::Partial<T>> partials(pool.WorkerCount() + 1, detail::Partial<T>{ identity });
+    auto participants = detail::parallel_run(pool, size_t(end - begin), size_t(grain), [&](size_t participant, size_t b, size_t e) {
+        auto& partial = partials[participant].value;
+        partial = fn(Index(begin + b), Index(begin + e), std::move(partial));
+    });
+
+    T result = std::move(partials[0].value);
+    for (size_t i = 1; i < participants; i++)
+    {
+        result = combine(std::move(result), std::move(partials[i].value));
+    }
+    return result;
+}
+
+template <class Index, class T, class Fn, class Combine>
+T parallel_reduce(Index begin, Index end, Index grain, T identity, Fn&& fn, Combine&& combine)
+{
+    return parallel_reduce(WorkStealingPool::Instance(), begin, end, grain, std::move(identity), std::forward<Fn>(fn), std::forward<Combine>(combine));
+}
+
+// Sorts blocks in parallel, then merges neighbouring blocks in parallel passes.
+// Not stable.  Falls back to std::sort for small ranges or a pool without workers
+template <class RandomIt, class Compare>
+void parallel_sort(WorkStealingPool& pool, RandomIt first, RandomIt last, Compare comp, size_t grain = 4096)
+{
+    auto count = size_t(std::distance(first, last));
+    grain = std::max(grain, size_t(1));
+    if (pool.WorkerCount() == 0 || count <= grain * 2)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    auto blocks = std::min(pool.WorkerCount() + 1, (count + grain - 1) / grain);
+    auto blockSize = (count + blocks - 1) / blocks;
+
+    parallel_for(pool, size_t(0), blocks, size_t(1), [&](size_t b, size_t e) {
+        for (auto block = b; block < e; block++)
+        {
+            auto blockBegin = std::min(count, block * blockSize);
+            auto blockEnd = std::min(count, blockBegin + blockSize);
+            std::sort(first + blockBegin, first + blockEnd, comp);
+        }
+    });
+
+    for (auto width = blockSize; width < count; width *= 2)
+    {
+        auto pairs = (count + (width * 2) - 1) / (width * 2);
+        parallel_for(pool, size_t(0), pairs, size_t(1), [&](size_t b, size_t e) {
+            for (auto pair = b; pair < e; pair++)
+            {
+                auto left = pair * width * 2;
+                auto middle = std::min(count, left + width);
+                auto right = std::min(count, middle + width);
+                std::inplace_merge(first + left, first + middle, first + right, comp);
+            }
+        });
+    }
+}
+
+template <class RandomIt>
+void parallel_sort(WorkStealingPool& pool, RandomIt first, RandomIt last)
+{
+    parallel_sort(pool, first, last, std::less<>());
+}
+
+template <class RandomIt, class Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp)
+{
+    parallel_sort(WorkStealingPool::Instance(), first, last, comp);
+}
+
+template <class RandomIt>
+void parallel_sort(RandomIt first, RandomIt last)
+{
+    parallel_sort(WorkStealingPool::Instance(), first, last, std::less<>());
+}
+
+} // namespace MUtils
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace MUtils
+{
+
+// A move-only std::function replacement which stores small callables inline.
+// Callables bigger than InlineSize (or which can throw when moved) go on the heap as a fallback.
+// Used for task storage, where std::function's copy requirement and allocation per task hurt.
+template <class Signature, size_t InlineSize = 48>
+class small_function;
+
+template <class R, class... Args, size_t InlineSize>
+class small_function<R(Args...), InlineSize>
+{
+public:
+    small_function() noexcept = default;
+    small_function(std::nullptr_t) noexcept
+    {
+    }
+
+    template <class F, class = std::enable_if_t<!std::is_same<std::decay_t<F>, small_function>::value>>
+    small_function(F&& fn)
+    {
+        using TFn = std::decay_t<F>;
+        if constexpr (fits_inline<TFn>())
+        {
+            new (&m_storage) TFn(std::forward<F>(fn));
+            m_pOps = &inline_ops<TFn>;
+        }
+        else
+        {
+            *reinterpret_cast<TFn**>(&m_storage) = new TFn(std::forward<F>(fn));
+            m_pOps = &heap_ops<TFn>;
+        }
+    }
+
+    small_function(small_function&& rhs) noexcept
+    {
+        if (rhs.m_pOps)
+        {
+            rhs.m_pOps->move(&m_storage, &rhs.m_storage);
+            m_pOps = rhs.m_pOps;
+            rhs.m_pOps = nullptr;
+        }
+    }
+
+    small_function& operator=(small_function&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            reset();
+            if (rhs.m_pOps)
+            {
+                rhs.m_pOps->move(&m_storage, &rhs.m_storage);
+                m_pOps = rhs.m_pOps;
+                rhs.m_pOps = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    small_function& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    small_function(const small_function&) = delete;
+    small_function& operator=(const small_function&) = delete;
+
+    ~small_function()
+    {
+        reset();
+    }
+
+    R operator()(Args... args)
+    {
+        assert(m_pOps);
+        return m_pOps->invoke(&m_storage, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_pOps != nullptr;
+    }
+
+    void reset() noexcept
+    {
+        if (m_pOps)
+        {
+            m_pOps->destroy(&m_storage);
+            m_pOps = nullptr;
+        }
+    }
+
+    // True if a callable of this type will be stored without allocating
+    template <class TFn>
+    static constexpr bool fits_inline()
+    {
+        return sizeof(TFn) <= InlineSize && alignof(TFn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<TFn>::value;
+    }
+
+private:
+    using Storage = std::aligned_storage_t<InlineSize, alignof(std::max_align_t)>;
+
+    struct Ops
+    {
+        R (*invoke)(void*, Args&&...);
+        void (*move)(void*, void*);
+        void (*destroy)(void*);
+    };
+
+    template <class TFn>
+    static constexpr Ops inline_ops = {
+        [](void* pStorage, Args&&... args) -> R {
+            return (*static_cast<TFn*>(pStorage))(std::forward<Args>(args)...);
+        },
+        [](void* pDest, void* pSource) {
+            new (pDest) TFn(std::move(*static_cast<TFn*>(pSource)));
+            static_cast<TFn*>(pSource)->~TFn();
+        },
+        [](void* pStorage) {
+            static_cast<TFn*>(pStorage)->~TFn();
+        }
+    };
+
+    template <class TFn>
+    static constexpr Ops heap_ops = {
+        [](void* pStorage, Args&&... args) -> R {
+            return (**static_cast<TFn**>(pStorage))(std::forward<Args>(args)...);
+        },
+        [](void* pDest, void* pSource) {
+            *static_cast<TFn**>(pDest) = *static_cast<TFn**>(pSource);
+        },
+        [](void* pStorage) {
+            delete *static_cast<TFn**>(pStorage);
+        }
+    };
+
+    Storage m_storage;
+    const Ops* m_pOps = nullptr;
+};
+
+} // namespace MUtils
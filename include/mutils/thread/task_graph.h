@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mutils/thread/small_function.h>
+#include <mutils/thread/work_pool.h>
+
+namespace MUtils
+{
+
+class TaskGraph;
+
+// One unit of work in a TaskGraph; either a function or a nested graph.
+// Owned by the graph, so hold on to references, not copies
+class TaskNode
+{
+public:
+    TaskNode(const TaskNode&) = delete;
+    TaskNode& operator=(const TaskNode&) = delete;
+
+    // This node runs before 'other'
+    TaskNode& Precede(TaskNode& other);
+
+    // This node runs after 'other'
+    TaskNode& Succeed(TaskNode& other);
+
+    const char* GetName() const
+    {
+        return m_pszName;
+    }
+
+    size_t PredecessorCount() const
+    {
+        return m_predecessorCount;
+    }
+
+    const std::vector<TaskNode*>& Successors() const
+    {
+        return m_successors;
+    }
+
+private:
+    friend class TaskGraph;
+    TaskNode(TaskGraph& owner, const std::string& name);
+
+    TaskGraph& m_owner;
+    const char* m_pszName;
+    uint32_t m_color = 0;
+
+    small_function<void()> m_fn;
+    TaskGraph* m_pSubGraph = nullptr;
+
+    std::vector<TaskNode*> m_successors;
+    uint32_t m_predecessorCount = 0;
+
+    // Predecessors still to finish on this run
+    std::atomic<uint32_t> m_pending = 0;
+};
+
+// A dependency graph of tasks that runs on a WorkStealingPool.
+// Build it once, then Run it as often as needed (each frame, each audio block, etc.); the nodes are reset
+// on each run and nothing is allocated unless the node functions don't fit the inline task storage.
+// A graph can only be running once at a time, so don't Compose the same sub graph twice.
+// If a node throws, the rest of the graph still runs and the first exception is rethrown from Run.
+class TaskGraph
+{
+public:
+    explicit TaskGraph(const std::string& name = "TaskGraph");
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    template <class F>
+    TaskNode& Emplace(const std::string& name, F&& fn)
+    {
+        auto& node = AddNode(name);
+        node.m_fn = std::forward<F>(fn);
+        return node;
+    }
+
+    // Run another graph as one node of this one.  The sub graph must outlive this graph
+    TaskNode& Compose(const std::string& name, TaskGraph& subGraph);
+
+    // Runs the graph to completion; the calling thread helps out with the work.
+    // Returns false without running anything if the graph has a cycle
+    bool Run(WorkStealingPool& pool);
+    bool Run();
+
+    // Check that the graph is a DAG
+    bool Validate() const;
+
+    void Clear();
+
+    size_t NodeCount() const
+    {
+        return m_nodes.size();
+    }
+
+    const char* GetName() const
+    {
+        return m_pszName;
+    }
+
+private:
+    friend class TaskNode;
+    TaskNode& AddNode(const std::string& name);
+    void Schedule(WorkStealingPool& pool, TaskNode* pNode);
+    void Execute(WorkStealingPool& pool, TaskNode* pNode);
+
+private:
+    const char* m_pszName;
+    std::vector<std::unique_ptr<TaskNode>> m_nodes;
+    std::vector<TaskNode*> m_roots;
+    bool m_dirty = true;
+    bool m_valid = false;
+
+    // Per run state
+    std::atomic<uint32_t> m_remaining = 0;
+    std::exception_ptr m_spException;
+    std::mutex m_exceptionMutex;
+};
+
+} // namespace MUtils
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace MUtils
+{
+
+enum class ThreadPriority
+{
+    Normal,
+    High, // Highest non real time priority
+    RealTimeFIFO, // SCHED_FIFO; runs until it blocks or a higher priority thread wants the core
+    RealTimeRR // SCHED_RR; like FIFO, but round robins with threads of the same priority
+};
+
+namespace ThreadConfigFlags
+{
+enum
+{
+    None = (0),
+    Isolate = (1 << 0), // Pin to the isolated core, claiming one if none is set (see thread_isolated_core)
+    AvoidIsolated = (1 << 1) // Keep off the isolated core, if there is one; for workers that would otherwise disturb it
+};
+}
+
+struct ThreadConfig
+{
+    // Shown in the profiler and OS tools (top, debuggers); Linux only shows the first 15 characters
+    std::string name;
+
+    // CPUs this thread may run on; empty for any.  Limited to the cpus the thread already had
+    std::vector<uint32_t> cpus;
+
+    // Normal leaves the scheduling and nice value the thread inherited alone
+    ThreadPriority priority = ThreadPriority::Normal;
+
+    // For the real time policies; 1 (lowest) - 99.  Clamped to what the OS supports
+    int realTimePriority = 80;
+
+    uint32_t flags = ThreadConfigFlags::None;
+
+    // The audio/time thread: real time, on its own core
+    static ThreadConfig RealTime(const std::string& name)
+    {
+        ThreadConfig config;
+        config.name = name;
+        config.priority = ThreadPriority::RealTimeFIFO;
+        config.flags = ThreadConfigFlags::Isolate;
+        return config;
+    }
+
+    // Default scheduling; just a name
+    static ThreadConfig Named(const std::string& name)
+    {
+        ThreadConfig config;
+        config.name = name;
+        return config;
+    }
+
+    // Pool workers: default scheduling, away from the real time thread
+    static ThreadConfig Worker(const std::string& name = "worker")
+    {
+        ThreadConfig config;
+        config.name = name;
+        config.flags = ThreadConfigFlags::AvoidIsolated;
+        return config;
+    }
+};
+
+// What thread_configure managed to do; anything missing has been logged once, and left at the OS default
+struct ThreadConfigResult
+{
+    bool name = false;
+    bool affinity = false;
+    bool priority = false;
+};
+
+// Apply a config to the calling thread.  Never fails hard: without the privileges for real time scheduling
+// it falls back to ThreadPriority::High, and then to Normal
+ThreadConfigResult thread_configure(const ThreadConfig& config);
+
+// Name the calling thread for the OS and the profiler
+bool thread_set_name(const std::string& name);
+bool thread_set_affinity(const std::vector<uint32_t>& cpus);
+bool thread_set_priority(ThreadPriority priority, int realTimePriority = 80);
+
+uint32_t thread_cpu_count();
+
+// The core kept for the real time thread, or -1 for none.  None is kept unless the kernel has isolated
+// one (isolcpus=), a thread has been configured with Isolate (which claims the last core, given 3 or more),
+// or one is set here.  Workers configured before the claim are not moved
+int thread_isolated_core();
+void thread_set_isolated_core(int core);
+
+} // namespace MUtils
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <emmintrin.h>
 #include <future>
+#include <memory>
 #include <thread>
+#include <type_traits>
 
 namespace MUtils
 {
@@ -84,4 +88,560 @@ private:
     std::atomic_flag flag = ATOMIC_FLAG_INIT;
 };
 
+namespace HybridMutexFlags
+{
+enum
+{
+    None = (0),
+    Stats = (1 << 0), // Count spins/parks/wait time, and show them as profiler counters
+    PriorityInherit = (1 << 1) // Park on a priority inheriting futex, where the OS has one
+};
+}
+
+struct HybridMutexStats
+{
+    std::atomic<uint64_t> locks = 0;
+    std::atomic<uint64_t> contended = 0; // Didn't get it first time
+    std::atomic<uint64_t> spins = 0;
+    std::atomic<uint64_t> parks = 0;
+    std::atomic<uint64_t> waitNs = 0; // Total time spent waiting on contended locks
+};
+
+// A lock that spins for a short, adaptive time and then sleeps on a futex, instead of burning a core
+// while a preempted owner gets back on the CPU.
+// The spin count tracks how long the lock usually takes to come free, so short critical sections rarely park.
+// With HybridMutexFlags::PriorityInherit on Linux the owner gets boosted while the audio thread waits for it.
+// Works with LOCK_GUARD; only contended locks show up in the profile.
+class hybrid_mutex
+{
+public:
+    explicit hybrid_mutex(uint32_t flags = HybridMutexFlags::None, const char* pszName = nullptr);
+    ~hybrid_mutex();
+
+    hybrid_mutex(const hybrid_mutex&) = delete;
+    hybrid_mutex& operator=(const hybrid_mutex&) = delete;
+
+    void lock() noexcept
+    {
+        if (!try_acquire())
+        {
+            lock_slow();
+        }
+        else if (m_flags & HybridMutexFlags::Stats)
+        {
+            m_stats.locks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_lock() noexcept
+    {
+        if (!try_acquire())
+        {
+            return false;
+        }
+
+        if (m_flags & HybridMutexFlags::Stats)
+        {
+            m_stats.locks.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    void unlock() noexcept
+    {
+        if (m_flags & HybridMutexFlags::PriorityInherit)
+        {
+            // Waiters set a bit in the word, so this only fails if someone is queued in the kernel
+            auto expected = lock_value();
+            if (!m_word.compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed))
+            {
+                unlock_slow();
+            }
+        }
+        else if (m_word.exchange(0, std::memory_order_release) == Parked)
+        {
+            unlock_slow();
+        }
+    }
+
+    const char* GetName() const
+    {
+        return m_pszName;
+    }
+
+    uint32_t GetFlags() const
+    {
+        return m_flags;
+    }
+
+    // Only counted with HybridMutexFlags::Stats
+    const HybridMutexStats& GetStats() const
+    {
+        return m_stats;
+    }
+
+private:
+    // Without priority inheritance the word is 0 = free, 1 = locked, 2 = locked with sleepers
+    static const uint32_t Locked = 1;
+    static const uint32_t Parked = 2;
+
+    bool try_acquire() noexcept
+    {
+        uint32_t expected = 0;
+        return m_word.compare_exchange_strong(expected, lock_value(), std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    uint32_t lock_value() const noexcept;
+    void lock_slow() noexcept;
+    void unlock_slow() noexcept;
+
+private:
+    std::atomic<uint32_t> m_word = 0;
+    std::atomic<uint32_t> m_spinEstimate;
+    uint32_t m_flags;
+    const char* m_pszName;
+    HybridMutexStats m_stats;
+};
+
+// Publish PROFILE_COUNTERs for all named hybrid_mutexes with stats turned on
+void hybrid_mutex_profile_counters();
+
+// Keeps the producer and consumer ends of the queues below out of each other's cache lines
+constexpr size_t ring_cache_line = 64;
+
+inline size_t ring_round_capacity(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+// Bounded single producer, single consumer ring buffer; wait free on both ends.
+// Capacity is rounded up to a power of two, and nothing is allocated after construction,
+// so it is safe to use from the audio thread.
+template <typename T>
+class spsc_ring
+{
+    static_assert(std::is_trivially_copyable<T>::value, "spsc_ring needs trivially copyable payloads");
+
+public:
+    explicit spsc_ring(size_t capacity)
+        : m_capacity(ring_round_capacity(capacity))
+        , m_mask(m_capacity - 1)
+        , m_spBuffer(new T[m_capacity])
+    {
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // Producer
+    bool try_push(const T& value) noexcept
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead == m_capacity)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead == m_capacity)
+            {
+                return false;
+            }
+        }
+        m_spBuffer[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer; pushes as many as will fit and returns how many that was
+    size_t try_push_bulk(const T* pValues, size_t count) noexcept
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        auto space = m_capacity - (tail - m_cachedHead);
+        if (space < count)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            space = m_capacity - (tail - m_cachedHead);
+        }
+
+        count = std::min(count, space);
+        copy_in(tail, pValues, count);
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer
+    bool try_pop(T& value) noexcept
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail)
+            {
+                return false;
+            }
+        }
+        value = m_spBuffer[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer; pops up to maxCount and returns how many it got
+    size_t try_pop_bulk(T* pValues, size_t maxCount) noexcept
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        auto available = m_cachedTail - head;
+        if (available < maxCount)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            available = m_cachedTail - head;
+        }
+
+        auto count = std::min(maxCount, available);
+        copy_out(head, pValues, count);
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Only exact when called from one of the two ends, with the other end idle
+    size_t size_approx() const noexcept
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+private:
+    void copy_in(size_t pos, const T* pValues, size_t count) noexcept
+    {
+        auto start = pos & m_mask;
+        auto first = std::min(count, m_capacity - start);
+        std::memcpy(&m_spBuffer[start], pValues, first * sizeof(T));
+        std::memcpy(&m_spBuffer[0], pValues + first, (count - first) * sizeof(T));
+    }
+
+    void copy_out(size_t pos, T* pValues, size_t count) const noexcept
+    {
+        auto start = pos & m_mask;
+        auto first = std::min(count, m_capacity - start);
+        std::memcpy(pValues, &m_spBuffer[start], first * sizeof(T));
+        std::memcpy(pValues + first, &m_spBuffer[0], (count - first) * sizeof(T));
+    }
+
+private:
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<T[]> m_spBuffer;
+
+    // Consumer owned
+    alignas(ring_cache_line) std::atomic<size_t> m_head = 0;
+    size_t m_cachedTail = 0;
+
+    // Producer owned
+    alignas(ring_cache_line) std::atomic<size_t> m_tail = 0;
+    size_t m_cachedHead = 0;
+};
+
+// Bounded multiple producer, single consumer ring buffer.
+// Producers claim slots with a CAS on the tail (lock free), the consumer is wait free.
+// Each slot carries a sequence number so the consumer knows when the producer has finished writing it.
+template <typename T>
+class mpsc_ring
+{
+    static_assert(std::is_trivially_copyable<T>::value, "mpsc_ring needs trivially copyable payloads");
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+public:
+    explicit mpsc_ring(size_t capacity)
+        : m_capacity(ring_round_capacity(capacity))
+        , m_mask(m_capacity - 1)
+        , m_spSlots(new Slot[m_capacity])
+    {
+        // A slot is ready when its sequence is one past the position it holds, so nothing starts out ready
+        for (size_t i = 0; i < m_capacity; i++)
+        {
+            m_spSlots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpsc_ring(const mpsc_ring&) = delete;
+    mpsc_ring& operator=(const mpsc_ring&) = delete;
+
+    // Producers
+    bool try_push(const T& value) noexcept
+    {
+        return try_push_bulk(&value, 1) == 1;
+    }
+
+    // Producers; claims as many slots as are free, up to count, in one go, so a batch stays contiguous.
+    // Returns how many were pushed
+    size_t try_push_bulk(const T* pValues, size_t count) noexcept
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        size_t claimed;
+        for (;;)
+        {
+            // Everything before head has been consumed, so the slots up to head + capacity are free
+            auto head = m_head.load(std::memory_order_acquire);
+            auto used = tail - head;
+            if (used > m_capacity)
+            {
+                // Stale tail; the consumer has moved past it
+                tail = m_tail.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            claimed = std::min(count, m_capacity - used);
+            if (claimed == 0)
+            {
+                return 0;
+            }
+
+            if (m_tail.compare_exchange_weak(tail, tail + claimed, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < claimed; i++)
+        {
+            auto& slot = m_spSlots[(tail + i) & m_mask];
+            slot.value = pValues[i];
+            slot.sequence.store(tail + i + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    // Consumer
+    bool try_pop(T& value) noexcept
+    {
+        return try_pop_bulk(&value, 1) == 1;
+    }
+
+    // Consumer; stops at the first slot a producer hasn't finished writing
+    size_t try_pop_bulk(T* pValues, size_t maxCount) noexcept
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count < maxCount)
+        {
+            auto& slot = m_spSlots[(head + count) & m_mask];
+            if (slot.sequence.load(std::memory_order_acquire) != head + count + 1)
+            {
+                break;
+            }
+            pValues[count++] = slot.value;
+        }
+
+        if (count != 0)
+        {
+            m_head.store(head + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    size_t size_approx() const noexcept
+    {
+        auto head = m_head.load(std::memory_order_acquire);
+        auto tail = m_tail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+private:
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_spSlots;
+
+    alignas(ring_cache_line) std::atomic<size_t> m_head = 0;
+    alignas(ring_cache_line) std::atomic<size_t> m_tail = 0;
+};
+
+// Single writer, many reader snapshot of a small trivially copyable struct.
+// Readers never block and never see a half written value; they retry if a write overlapped their copy.
+// The value is kept in atomic words so the racing copies are well defined.
+// Writes must be serialized by the caller if there is more than one writer thread.
+template <typename T>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock needs a trivially copyable value");
+    static const size_t WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+public:
+    seqlock(const T& value = T{})
+    {
+        write_words(value);
+    }
+
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    T load() const noexcept
+    {
+        uint64_t words[WordCount];
+        for (;;)
+        {
+            auto before = m_sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                // Writer is half way through
+                _mm_pause();
+                continue;
+            }
+
+            for (size_t i = 0; i < WordCount; i++)
+            {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) == before)
+            {
+                break;
+            }
+        }
+
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+    void store(const T& value) noexcept
+    {
+        auto sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        write_words(value);
+
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Read, modify and write back; for the writer thread
+    template <typename F>
+    void update(F&& fn)
+    {
+        auto value = load();
+        fn(value);
+        store(value);
+    }
+
+    // Bumped twice by every store
+    uint64_t sequence() const noexcept
+    {
+        return m_sequence.load(std::memory_order_acquire);
+    }
+
+private:
+    void write_words(const T& value) noexcept
+    {
+        uint64_t words[WordCount] = {};
+        std::memcpy(words, &value, sizeof(T));
+        for (size_t i = 0; i < WordCount; i++)
+        {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+private:
+    alignas(ring_cache_line) std::atomic<uint64_t> m_sequence = 0;
+    std::atomic<uint64_t> m_words[WordCount];
+};
+
+// Wait free hand over of a whole struct from one writer thread to one reader thread.
+// The writer fills the back buffer and publishes it; the reader picks up the latest published buffer.
+// Neither side ever waits, and the reader skips any frames it was too slow to see.
+// For large payloads, write into write_buffer()/read from read_buffer() directly: publishing only swaps indices.
+// write()/read() are the copying versions, for small structs.
+template <typename T>
+class triple_buffer
+{
+public:
+    explicit triple_buffer(const T& value = T{})
+    {
+        for (auto& slot : m_slots)
+        {
+            slot.value = value;
+        }
+    }
+
+    triple_buffer(const triple_buffer&) = delete;
+    triple_buffer& operator=(const triple_buffer&) = delete;
+
+    // Writer: the buffer to fill in.  Holds whatever was in it 2 publishes ago, not the last published value
+    T& write_buffer() noexcept
+    {
+        return m_slots[m_back].value;
+    }
+
+    // Writer: hand the write buffer to the reader, and take the spare one back
+    void publish() noexcept
+    {
+        auto middle = m_middle.exchange(uint8_t(m_back | Fresh), std::memory_order_acq_rel);
+        m_back = middle & IndexMask;
+    }
+
+    void write(const T& value)
+    {
+        write_buffer() = value;
+        publish();
+    }
+
+    // Reader: swap in the latest published buffer, if there is one.  Returns true if read_buffer() changed
+    bool update() noexcept
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & Fresh))
+        {
+            return false;
+        }
+
+        auto middle = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = middle & IndexMask;
+        return true;
+    }
+
+    // Reader: the latest value it has picked up.  Stable until the next update()
+    const T& read_buffer() const noexcept
+    {
+        return m_slots[m_front].value;
+    }
+
+    bool read(T& value)
+    {
+        auto changed = update();
+        value = read_buffer();
+        return changed;
+    }
+
+private:
+    static const uint8_t IndexMask = 0x3;
+    static const uint8_t Fresh = 0x4;
+
+    struct alignas(ring_cache_line) Slot
+    {
+        T value;
+    };
+    Slot m_slots[3];
+
+    // Each thread owns one buffer index; the middle one is passed between them, with a bit to say it's new
+    alignas(ring_cache_line) uint8_t m_back = 0;
+    alignas(ring_cache_line) std::atomic<uint8_t> m_middle = 1;
+    alignas(ring_cache_line) uint8_t m_front = 2;
+};
+
 } // namespace MUtils
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <concurrentqueue/concurrentqueue.h>
+
+#include <mutils/thread/future.h>
+#include <mutils/thread/mempool.h>
+#include <mutils/thread/small_function.h>
+
+namespace MUtils
+{
+
+// A task waiting to run.  Pooled, so submitting small tasks doesn't allocate
+class WorkItem : public PoolItem
+{
+public:
+    DECLARE_POOL_ITEM(WorkItem);
+
+    WorkItem(IMemoryPool* pPool, uint64_t id)
+        : PoolItem(pPool, id)
+    {
+    }
+
+    virtual void Init() override
+    {
+    }
+
+    small_function<void()> task;
+};
+
+// Chase-Lev work stealing deque, using the C11 memory orderings from
+// 'Correct and Efficient Work-Stealing for Weak Memory Models' (Le, Pop, Cohen, Zappa Nardelli)
+// The owning thread pushes and pops at the bottom; any other thread steals from the top.
+// The capacity is fixed; Push returns false when full and the caller puts the item elsewhere.
+template <class T>
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(uint32_t capacity = 4096)
+        : m_items(capacity)
+        , m_mask(int64_t(capacity) - 1)
+    {
+        assert(capacity != 0 && (capacity & (capacity - 1)) == 0);
+    }
+
+    // Owner only
+    bool Push(T* pItem)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+        if (b - t > m_mask)
+        {
+            return false;
+        }
+        m_items[b & m_mask].store(pItem, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only
+    T* Pop()
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // Empty
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        auto pItem = m_items[b & m_mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // Last item; race the thieves for it
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                pItem = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return pItem;
+    }
+
+    // Any thread.  pAborted is set if another thread won the race; the deque may not be empty
+    T* Steal(bool* pAborted = nullptr)
+    {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+        {
+            return nullptr;
+        }
+
+        auto pItem = m_items[t & m_mask].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            if (pAborted)
+            {
+                *pAborted = true;
+            }
+            return nullptr;
+        }
+        return pItem;
+    }
+
+    bool Empty() const
+    {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> m_top = 0;
+    alignas(64) std::atomic<int64_t> m_bottom = 0;
+    std::vector<std::atomic<T*>> m_items;
+    int64_t m_mask;
+};
+
+// Thread pool with a deque per worker and work stealing; a drop in replacement for TPool.
+// Tasks submitted from a worker go on its own deque, other threads submit to a shared queue.
+// Idle workers spin briefly and then park on a futex until new work arrives.
+// Like TPool, with 1 or fewer threads there are no workers and tasks run immediately on the caller.
+class WorkStealingPool : public IExecutor
+{
+public:
+    WorkStealingPool(size_t threads_n = std::thread::hardware_concurrency());
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    WorkStealingPool(WorkStealingPool&&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool&&) = delete;
+
+    // A shared pool with a worker per hardware thread
+    static WorkStealingPool& Instance();
+
+    // Same as TPool::enqueue.  The future's shared state is the only allocation
+    template <class F, class... Args>
+    std::future<std::invoke_result_t<F, Args...>> enqueue(F&& f, Args&&... args)
+    {
+        using R = std::invoke_result_t<F, Args...>;
+        std::packaged_task<R()> task([fn = std::forward<F>(f), tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            return std::apply(std::move(fn), std::move(tuple));
+        });
+        auto res = task.get_future();
+        run(std::move(task));
+        return res;
+    }
+
+    // Like enqueue, but returns a MUtils::Future, which can take continuations instead of being polled
+    template <class F, class... Args>
+    Future<std::invoke_result_t<F, Args...>> async(F&& f, Args&&... args)
+    {
+        using R = std::invoke_result_t<F, Args...>;
+        Promise<R> promise;
+        auto res = promise.get_future();
+        run([promise = std::move(promise), fn = std::forward<F>(f), tuple = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            promise.set_with([&]() {
+                return std::apply(std::move(fn), std::move(tuple));
+            });
+        });
+        return res;
+    }
+
+    // IExecutor, so continuations can be sent to the pool
+    void Execute(small_function<void()>&& fn) override
+    {
+        run(std::move(fn));
+    }
+
+    // Fire and forget.  Doesn't allocate if the callable fits in the task storage.
+    // The task must not throw
+    template <class F>
+    void run(F&& f)
+    {
+        if (m_workers.empty())
+        {
+            f();
+            return;
+        }
+
+        auto pItem = m_itemPool.Alloc();
+        pItem->task = std::forward<F>(f);
+        Submit(pItem);
+    }
+
+    // Run one waiting task on the calling thread; lets a thread help instead of blocking while it waits.
+    // Returns false if there was nothing to do
+    bool TryRunOne();
+
+    size_t WorkerCount() const
+    {
+        return m_workers.size();
+    }
+
+    void StopAll();
+
+private:
+    struct Worker
+    {
+        WorkStealingDeque<WorkItem> deque;
+        std::thread thread;
+    };
+
+    void Submit(WorkItem* pItem);
+    WorkItem* FindWork(uint32_t workerIndex);
+    void Execute(WorkItem* pItem);
+    void WorkerLoop(uint32_t workerIndex);
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    moodycamel::ConcurrentQueue<WorkItem*> m_injected;
+    TSMemoryPool<WorkItem> m_itemPool;
+
+    alignas(64) std::atomic<uint32_t> m_wakeEpoch = 0;
+    std::atomic<uint32_t> m_sleepers = 0;
+    std::atomic_bool m_stop = false;
+};
+
+} // namespace MUtils
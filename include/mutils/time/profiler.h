@@ -1,6 +1,8 @@
 #pragma once
 
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <mutils/time/timer.h>
 #include <mutils/math/math.h>
 #include <mutils/ui/theme.h>
@@ -81,6 +83,9 @@ void ShowProfile(bool* opened);
 void HideThread();
 void Finish();
 
+// Named values shown in the profiler window; the latest value wins
+void SetCounter(const char* pszName, double value);
+
 struct ProfileScope
 {
     ProfileScope(const char* szSection, uint32_t color, const char* szFile, int line)
@@ -106,12 +111,24 @@ struct RegionScope
 };
 #define PROFILE_COL_LOCK 0xFF0000FF
 
+template <class _Mutex, class = void>
+struct has_lock_stats : std::false_type {};
+
+template <class _Mutex>
+struct has_lock_stats<_Mutex, std::void_t<decltype(std::declval<_Mutex&>().GetStats())>> : std::true_type {};
+
 template <class _Mutex>
 class profile_lock_guard { // class with destructor that unlocks a mutex
 public:
     using mutex_type = _Mutex;
 
     explicit profile_lock_guard(_Mutex& _Mtx, const char* name = "Mutex", const char* szFile = nullptr, int line = 0) : _MyMutex(_Mtx) { // construct and lock
+        // Mutexes that keep their own contention stats only show up in the profile when they had to wait
+        if constexpr (has_lock_stats<_Mutex>::value) {
+            if (_MyMutex.try_lock()) {
+                return;
+            }
+        }
         PushSectionBase(name, PROFILE_COL_LOCK, szFile, line);
         _MyMutex.lock();
         PopSection();
@@ -154,6 +171,10 @@ MUtils::Profiler::RegionScope name##_region;
 #define PROFILE_NAME_THREAD(name) \
 MUtils::Profiler::NameThread(#name);
 
+// Set a counter value, shown in the profile window
+#define PROFILE_COUNTER(name, value) \
+MUtils::Profiler::SetCounter(#name, double(value));
+
 // Hide a thread.  Not sure this is tested or works....
 #define PROFILE_HIDE_THREAD() \
 MUtils::Profiler::HideThread();
@@ -12,6 +12,7 @@
 #include <mutils/logger/logger.h>
 #include <mutils/time/time_utils.h>
 #include <mutils/time/profiler.h>
+#include <mutils/thread/thread_config.h>
 #include <mutils/thread/thread_utils.h>
 
 #include <concurrentqueue/concurrentqueue.h>
@@ -44,6 +45,10 @@ public:
     void StartThread();
     void EndThread();
 
+    // How the tick thread is scheduled; takes effect on the next StartThread.
+    // Defaults to normal scheduling; pass ThreadConfig::RealTime to run it real time on its own core
+    void SetThreadConfig(const ThreadConfig& config);
+
     void SetTempo(double bpm, double quantum);
     void SetBeat(double beat);
     void SetFrame(uint32_t frame);
@@ -54,7 +59,7 @@ public:
     double GetQuantum() const;
     std::chrono::microseconds GetTimePerBeat() const;
 
-    double GetBeatAtTime(TimePoint time);
+    double GetBeatAtTime(TimePoint time) const;
 
 private:
     TimePoint m_startTime;
@@ -63,14 +68,21 @@ private:
 
     std::atomic_bool m_quitTimer = false;
     std::thread m_tickThread;
-    std::atomic<double> m_quantum = 4;
-    std::atomic<double> m_tempo = 120;
+    ThreadConfig m_threadConfig = ThreadConfig::Named("Time_Provider");
     std::atomic<double> m_beat = 0;
     std::atomic<uint32_t> m_frame = 0;
 
-    TimePoint m_lastTime; // Should probably be atomic, but compile error on GCC?
-    std::atomic<double> m_lastBeat;
-    std::chrono::microseconds m_timePerBeat = std::chrono::microseconds(1000000 / 120);
+    // Everything the audio thread needs to turn a time into a beat, read as one consistent snapshot.
+    // Written under m_spin_mutex
+    struct TempoState
+    {
+        double tempo = 120;
+        double quantum = 4;
+        std::chrono::microseconds timePerBeat = std::chrono::microseconds(1000000 / 120);
+        TimePoint lastTime;
+        double lastBeat = 0;
+    };
+    seqlock<TempoState> m_tempoState;
 };
 
 }; // namespace MUtils
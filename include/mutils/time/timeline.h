@@ -69,9 +69,11 @@ template <class T>
 class Timeline
 {
 public:
-    Timeline()
-        : m_timeEventPool(1000)
+    // The pool stats (see mempool_sample) show the high water mark for sizing the initial pool
+    Timeline(uint32_t initialPoolSize = 1000)
+        : m_timeEventPool(initialPoolSize)
     {
+        m_timeEventPool.SetName("Timeline");
         m_startTime = TimeProvider::Instance().Now();
     }
 
@@ -98,6 +100,10 @@ public:
 
         auto startTime = TimeProvider::Instance().Now();
 
+        // Neighbouring expired events are freed as a run; one slice and one pool operation
+        IListItem* pRunBegin = nullptr;
+        IListItem* pRunEnd = nullptr;
+
         auto pCurrent = (T*)m_timeEventPool.m_pRoot;
         while (pCurrent)
         {
@@ -105,17 +111,32 @@ public:
             // Need to track and remove long events
             if ((startTime - (pCurrent->m_time + pCurrent->m_duration)) > std::chrono::seconds(secondsOld))
             {
-                auto pVictim = pCurrent;
-                pCurrent = (T*)list_disconnect(gsl::not_null<IListItem*>(pCurrent));
-                pVictim->Free();
+                if (pRunBegin == nullptr)
+                {
+                    pRunBegin = pCurrent;
+                }
+                pRunEnd = pCurrent;
+                pCurrent = (T*)pCurrent->m_pNext;
                 continue;
             }
-            else if ((startTime - pCurrent->m_time) < std::chrono::seconds(16))
+
+            if (pRunBegin)
+            {
+                list_free_range(pRunBegin, pRunEnd);
+                pRunBegin = nullptr;
+            }
+
+            if ((startTime - pCurrent->m_time) < std::chrono::seconds(16))
             {
                 break;
             }
             pCurrent = (T*)pCurrent->m_pNext;
         }
+
+        if (pRunBegin)
+        {
+            list_free_range(pRunBegin, pRunEnd);
+        }
     }
 
     void StoreTimeEvent(T* ev)
@@ -14,7 +14,7 @@ namespace Theme
 {
 
 #ifdef DECLARE_THEME_COLOR
-#define DECLARE_THEME_COLOR(name) MUtils::StringId color_##name(#name);
+#define DECLARE_THEME_COLOR(name) MUtils::StringId color_##name = MUTILS_SID(#name);
 #else
 #define DECLARE_THEME_COLOR(name) extern MUtils::StringId color_##name;
 #endif
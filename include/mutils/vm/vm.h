@@ -1,8 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
-#include <deque>
 #include <map>
 #include <memory>
 #include <sstream>
@@ -13,6 +13,12 @@
 #include <iomanip>
 #include <functional>
 
+// GCC and Clang can dispatch through a table of label addresses ("computed goto"), which gives each
+// opcode its own indirect branch.  Elsewhere a dense switch compiles to a jump table
+#if defined(__GNUC__) || defined(__clang__)
+#define MUTILS_VM_COMPUTED_GOTO 1
+#endif
+
 namespace MUtils
 {
 
@@ -37,281 +43,331 @@ enum class VM_IType
     Ret,
     Call,
     Add,
-    Mov
+    Mov,
+    CallArgs // Call arg1 with the argument count in arg2, rather than on the stack
+};
+
+// The compiled instruction set; Link lowers each VInstruction to one of these, picking the
+// register or constant form of the operands up front
+enum class VM_Op : uint8_t
+{
+    PushReg,    // Push registers[operand]
+    PushConst,  // Push constants[operand]
+    Pop,        // Pop into registers[reg]
+    PopArgs,
+    MovReg,     // registers[reg] = registers[operand]
+    MovConst,   // registers[reg] = constants[operand]
+    AddReg,     // registers[reg] += registers[operand]
+    AddConst,   // registers[reg] += constants[operand]
+    Call,       // Call functions[operand]
+    CallNative, // Call native functions[operand]
+    CallArgs,   // Call functions[operand] with reg arguments
+    CallNativeArgs,
+    Ret,
+    End         // Appended to every function; same as Ret
+};
+
+// 8 bytes, so a few thousand instructions fit in L1.  Values live in the VM's constant pool
+struct VCode
+{
+    VM_Op op;
+    uint8_t pad = 0;
+    uint16_t reg = 0;
+    uint32_t operand = 0;
+};
+static_assert(sizeof(VCode) == 8, "VCode should stay small");
+
+// Why a run stopped before its entry function returned.  These are checked in release builds too,
+// since a script can recurse or pop as far as it likes
+enum class VM_Fault : uint8_t
+{
+    None,
+    StackOverflow,
+    StackUnderflow,
+    CallDepth,
+    BadCall
 };
 
+inline const char* vm_fault_string(VM_Fault fault)
+{
+    switch (fault)
+    {
+    case VM_Fault::None:
+        return "None";
+    case VM_Fault::StackOverflow:
+        return "Stack overflow";
+    case VM_Fault::StackUnderflow:
+        return "Stack underflow";
+    case VM_Fault::CallDepth:
+        return "Call stack overflow";
+    case VM_Fault::BadCall:
+        return "Call to an unresolved function";
+    }
+    return "Unknown";
+}
+
 template <class TValue>
-class VM
+class VMContext;
+
+// The code: functions, their compiled form and the constant pool.
+// Build it, Link it, then run it on as many VMContexts as you like; once linked, it is only read.
+template <class TValue>
+class VMProgram
 {
 public:
-    using DumpArgFn = std::function<void(std::ostringstream&, const TValue&)>;
+    static constexpr uint32_t InvalidTarget = 0xFFFFFFFF;
 
     struct VInstruction
     {
         VM_IType type;
         TValue arg1;
         TValue arg2;
+
+        // Filled in by Link; for a Call, the index of the target in m_functions
+        uint32_t target = InvalidTarget;
     };
 
-    using JNativeFunction = std::function<TValue(int argCount)>;
+    // Natives read their arguments from the context's registers
+    using JNativeFunction = std::function<TValue(VMContext<TValue>& context, uint32_t argCount)>;
+
     struct VFunction
     {
         std::string name;
         std::vector<TValue> args;
         std::vector<VInstruction> instructions;
         JNativeFunction pFnNative = nullptr;
-    };
 
-public:
-    VM(std::ostringstream& log, DumpArgFn fn)
-        : m_log(log),
-        m_dumpArgFn(fn)
-    {
-    }
+        // Built from instructions by Link
+        std::vector<VCode> code;
 
-    ~VM()
-    {
-    }
+        // What runs; code, or code in a loaded module (see vm_module.h), which has no instructions
+        const VCode* pCode = nullptr;
+        uint32_t codeCount = 0;
+        bool external = false;
+
+        // Number of arguments the function takes, checked by Link; -1 uses args, or accepts any count if that is empty
+        int arity = -1;
+    };
 
-    const VInstruction& Instruction() const
+    // Register operands are limited to this
+    static constexpr uint32_t MaxRegisters = 1024;
+
+    // Functions were added, or instructions were added to a function since the last Link
+    bool NeedsLink() const
     {
-        assert(!m_callStack.empty());
-        return m_callStack.front()->instructions[m_pc];
+        if (m_linkDirty)
+        {
+            return true;
+        }
+        for (auto& spFn : m_functions)
+        {
+            if (!spFn->pFnNative && !spFn->external && spFn->code.size() != spFn->instructions.size() + 1)
+            {
+                return true;
+            }
+        }
+        return false;
     }
 
-    void Dump()
+    // Compile each function's instructions to code, and resolve every Call to an index into m_functions,
+    // so Run doesn't have to look names up.
+    // Where the call is preceded by a literal argument count, it is checked against the target's arity.
+    // Returns a message for each problem; the calls involved are left unresolved, and stop the run with VM_Fault::BadCall.
+    // Run links for you if functions or instructions were added since the last Link; call it again if you edit instructions
+    std::vector<std::string> Link()
     {
-        std::ostringstream& code = m_log;
-        code << "\nVM:\n";
-
-        for (auto& fn : m_functions)
+        std::vector<std::string> errors;
+        // Constants and registers from a loaded module come first, and stay
+        m_constants.resize(m_moduleConstantCount);
+        m_registerCount = m_moduleRegisterCount;
+        for (auto& spFn : m_functions)
         {
-            code << "\n"
-                 << fn->name << ":\n";
+            if (spFn->pFnNative || spFn->external)
+            {
+                continue;
+            }
 
-            uint32_t index = 0;
-            for (auto& i : fn->instructions)
+            auto& instructions = spFn->instructions;
+            spFn->code.clear();
+
+            spFn->code.reserve(instructions.size() + 1);
+            for (size_t index = 0; index < instructions.size(); index++)
             {
-                code << index++ << ": ";
-                switch (i.type)
-                {
-                case VM_IType::Call:
+                auto& i = instructions[index];
+                VCode code;
+                if (!CheckOperands(*spFn, index, errors))
                 {
-                    code << "CALL ";
-                    m_dumpArgFn(code, i.arg1);
-                    auto pFn = GetFunction(std::get<std::string>(i.arg1));
-                    if (pFn->pFnNative)
+                    // Compiled to a call which stops the run, in case it is run anyway
+                    if (i.type == VM_IType::CallArgs)
                     {
-                        code << " (native)";
+                        i.target = InvalidTarget;
                     }
+                    spFn->code.push_back(VCode{ VM_Op::CallArgs, 0, 0, InvalidTarget });
+                    continue;
                 }
-                break;
-                case VM_IType::Ret:
-                    code << "RET\n";
-                    break;
+
+                switch (i.type)
+                {
                 case VM_IType::Push:
-                    code << "PUSH ";
-                    m_dumpArgFn(code, i.arg1);
+                    CompileOperand(code, VM_Op::PushReg, VM_Op::PushConst, i.arg1);
                     break;
                 case VM_IType::Pop:
-                    code << "POP ";
-                    m_dumpArgFn(code, i.arg1);
+                    code.op = VM_Op::Pop;
+                    code.reg = RegOperand(i.arg1);
                     break;
                 case VM_IType::PopArgs:
-                    code << "POPARGS";
+                    code.op = VM_Op::PopArgs;
                     break;
                 case VM_IType::Mov:
-                    code << "MOV ";
-                    m_dumpArgFn(code, i.arg1);
-                    code << ", ";
-                    m_dumpArgFn(code, i.arg2);
+                    CompileOperand(code, VM_Op::MovReg, VM_Op::MovConst, i.arg2);
+                    code.reg = RegOperand(i.arg1);
+                    break;
+                case VM_IType::Add:
+                    CompileOperand(code, VM_Op::AddReg, VM_Op::AddConst, i.arg2);
+                    code.reg = RegOperand(i.arg1);
+                    break;
+                case VM_IType::Ret:
+                    code.op = VM_Op::Ret;
                     break;
+                case VM_IType::Call:
+                case VM_IType::CallArgs:
+                {
+                    i.target = ResolveCall(*spFn, index, errors);
+                    bool native = i.target != InvalidTarget && m_functions[i.target]->pFnNative;
+                    if (i.type == VM_IType::CallArgs)
+                    {
+                        code.op = native ? VM_Op::CallNativeArgs : VM_Op::CallArgs;
+                        code.reg = uint16_t(std::get<int>(i.arg2));
+                    }
+                    else
+                    {
+                        code.op = native ? VM_Op::CallNative : VM_Op::Call;
+                    }
+                    code.operand = i.target;
                 }
-
-                code << "\n";
+                break;
+                }
+                CountRegisters(code);
+                spFn->code.push_back(code);
             }
-            code << "\n";
+            spFn->code.push_back(VCode{ VM_Op::End });
+            spFn->pCode = spFn->code.data();
+            spFn->codeCount = uint32_t(spFn->code.size());
         }
+        m_linkDirty = false;
+        m_linkFailed = !errors.empty();
+        return errors;
     }
 
-    void Execute(const VInstruction& instruction)
+    // The last Link, whoever called it, reported errors
+    bool LinkFailed() const
     {
-        switch (instruction.type)
-        {
-        case VM_IType::Call:
-        {
-            assert(std::holds_alternative<std::string>(instruction.arg1));
-            auto fnName = std::get<std::string>(instruction.arg1);
-
-            auto fun = GetFunction(fnName);
-
-            // Pop into registers, backwards ;)
-            int count = std::get<int>(m_stack.front());
-            int keptCount = count;
-
-            m_stack.pop_front();
-            while (count > 0)
-            {
-                m_registers[count - 1] = m_stack.front();
-                m_stack.pop_front();
-
-                count--;
-            }
+        return m_linkFailed;
+    }
 
-            // If native, just call it with the VM State, and then we'll return to the next instruction
-            if (fun->pFnNative)
+private:
+    // Registers must be below MaxRegisters, and CallArgs counts must fit the 16 bit reg field
+    bool CheckOperands(const VFunction& fn, size_t index, std::vector<std::string>& errors) const
+    {
+        auto& i = fn.instructions[index];
+        auto location = fn.name + ":" + std::to_string(index) + ": ";
+        auto checkRegister = [&](const TValue& value, bool registerOnly) {
+            if (!std::holds_alternative<VM_Reg>(value))
             {
-                m_registers[0] = fun->pFnNative(keptCount);
+                if (registerOnly)
+                {
+                    errors.push_back(location + "Operand is not a register");
+                    return false;
+                }
+                return true;
             }
-            else
+            auto reg = uint32_t(std::get<VM_Reg>(value));
+            if (reg >= MaxRegisters)
             {
-                // Push the PC
-                m_stack.push_front(m_pc + 1);
-                m_pc = 0;
-                m_callStack.push_front(fun);
+                errors.push_back(location + "Register " + std::to_string(reg) + " is out of range, registers go up to " + std::to_string(MaxRegisters - 1));
+                return false;
             }
-        }
-        break;
-        case VM_IType::Ret:
+            return true;
+        };
+
+        switch (i.type)
         {
-            assert(!m_callStack.empty());
-            m_pc = std::get<int>(m_stack.front());
-            m_stack.pop_back();
-            m_callStack.pop_front();
-        }
-        break;
         case VM_IType::Push:
-        {
-            if (std::holds_alternative<VM_Reg>(instruction.arg1))
-            {
-                m_stack.push_front(m_registers[(int)std::get<VM_Reg>(instruction.arg1)]);
-            }
-            else
-            {
-                m_stack.push_front(instruction.arg1);
-            }
-        }
-        break;
+            return checkRegister(i.arg1, false);
         case VM_IType::Pop:
-        {
-            // Pop into a register - validate?
-            assert(std::holds_alternative<VM_Reg>(instruction.arg1));
-            m_registers[(int)std::get<VM_Reg>(instruction.arg1)] = m_stack.front();
-            m_stack.pop_front();
-        }
-        break;
-        case VM_IType::PopArgs:
-        {
-            // Pop into registers
-            VM_Reg r = VM_Reg::R0;
-            int count = std::get<int>(m_stack.front());
-            int args = count;
-            m_stack.pop_front();
-            while (count > 0)
+            return checkRegister(i.arg1, true);
+        case VM_IType::Mov:
+        case VM_IType::Add:
+            return checkRegister(i.arg1, true) && checkRegister(i.arg2, false);
+        case VM_IType::CallArgs:
+            if (!std::holds_alternative<int>(i.arg2) || std::get<int>(i.arg2) < 0 || std::get<int>(i.arg2) > 0xFFFF)
             {
-                assert(!"");
-                m_registers[args - count] = m_stack.front();
-                m_stack.pop_front();
+                errors.push_back(location + "Argument count is not an int from 0 to 65535");
+                return false;
             }
+            return true;
+        default:
+            return true;
         }
-        break;
-        case VM_IType::Mov:
+    }
+
+    uint32_t ResolveCall(const VFunction& fn, size_t index, std::vector<std::string>& errors) const
+    {
+        auto& instructions = fn.instructions;
+        auto& i = instructions[index];
+        auto location = fn.name + ":" + std::to_string(index) + ": ";
+        if (!std::holds_alternative<std::string>(i.arg1))
         {
-            assert(std::holds_alternative<VM_Reg>(instruction.arg1));
-            m_registers[(uint32_t)std::get<VM_Reg>(instruction.arg1)] = instruction.arg2;
+            errors.push_back(location + "Call target is not a function name");
+            return InvalidTarget;
         }
-        break;
-        case VM_IType::Add:
+
+        auto& name = std::get<std::string>(i.arg1);
+        auto itr = m_functionMap.find(name);
+        if (itr == m_functionMap.end())
         {
-            assert(std::holds_alternative<VM_Reg>(instruction.arg1));
-            auto& target = m_registers[(uint32_t)std::get<VM_Reg>(instruction.arg1)];
+            errors.push_back(location + "Unresolved function '" + name + "'");
+            return InvalidTarget;
+        }
 
-            TValue source;
-            if (std::holds_alternative<VM_Reg>(instruction.arg2))
+        auto pTarget = m_functions[itr->second].get();
+        auto arity = pTarget->arity >= 0 ? pTarget->arity : int(pTarget->args.size());
+        if (pTarget->arity >= 0 || !pTarget->args.empty())
+        {
+            // The count is either an operand, or usually pushed just before the call
+            const TValue* pCount = nullptr;
+            if (i.type == VM_IType::CallArgs)
             {
-                source = m_registers[(uint32_t)std::get<VM_Reg>(instruction.arg1)];
+                pCount = &i.arg2;
             }
-            else
+            else if (index > 0 && instructions[index - 1].type == VM_IType::Push)
             {
-                source = instruction.arg1;
+                pCount = &instructions[index - 1].arg1;
             }
 
-            extern TValue Add(const TValue& lhs, const TValue& rhs);
-            target = Add(target, source);
-        }
-        break;
+            if (pCount && std::holds_alternative<int>(*pCount) && std::get<int>(*pCount) != arity)
+            {
+                errors.push_back(location + "'" + name + "' takes " + std::to_string(arity) + " arguments, called with " + std::to_string(std::get<int>(*pCount)));
+                return InvalidTarget;
+            }
         }
+        return itr->second;
     }
-    void Run(VFunction* pFn)
-    {
-        m_callStack.push_front(pFn);
-        m_pc = 0;
 
-        std::ostringstream& code = m_log;
-        code << "\nRunning " << pFn->name << "\n";
+public:
 
-        while (m_pc < m_callStack.front()->instructions.size())
+    // Look up a function without creating it
+    VFunction* FindFunction(const std::string& name) const
+    {
+        auto itr = m_functionMap.find(name);
+        if (itr == m_functionMap.end())
         {
-            auto& i = m_callStack.front()->instructions[m_pc];
-
-            Execute(i);
-
-            std::ostringstream inst;
-            switch (i.type)
-            {
-            case VM_IType::Call:
-            {
-                inst << "CALL ";
-                m_dumpArgFn(inst, i.arg1);
-                auto pFn = GetFunction(std::get<std::string>(i.arg1));
-                if (pFn->pFnNative)
-                {
-                    inst << " (native)";
-                }
-            }
-            break;
-            case VM_IType::Ret:
-                inst << "RET";
-                break;
-            case VM_IType::Push:
-                inst << "PUSH ";
-                m_dumpArgFn(inst, i.arg1);
-                break;
-            case VM_IType::Pop:
-                inst << "POP ";
-                m_dumpArgFn(inst, i.arg1);
-                break;
-            case VM_IType::PopArgs:
-                inst << "POPARGS";
-                break;
-            case VM_IType::Mov:
-                inst << "MOV ";
-                m_dumpArgFn(inst, i.arg1);
-                inst << ", ";
-                m_dumpArgFn(inst, i.arg2);
-                break;
-            case VM_IType::Add:
-                inst << "Add ";
-                m_dumpArgFn(inst, i.arg1);
-                inst << ", ";
-                m_dumpArgFn(inst, i.arg2);
-                break;
-            }
-
-            code << std::setw(20) << std::left << inst.str() << "Stack:";
-
-            bool first = true;
-            for (const auto& s : m_stack)
-            {
-                code << " [";
-                m_dumpArgFn(code, s);
-                code << "]";
-            }
-            code << "\n";
-            m_pc++;
+            return nullptr;
         }
+        return m_functions[itr->second].get();
     }
 
+    // Find or create
     VFunction* GetFunction(const std::string& name)
     {
         auto itr = m_functionMap.find(name);
@@ -321,17 +377,47 @@ public:
             pFn->name = name;
             m_functions.push_back(pFn);
             m_functionMap[name] = (uint32_t)(m_functions.size() - 1);
+            m_linkDirty = true;
             return pFn.get();
         }
         return (m_functions[itr->second].get());
     }
 
+    // Make sure contexts have enough registers for this instruction
+    void CountRegisters(const VCode& code)
+    {
+        uint32_t count = 1;
+        switch (code.op)
+        {
+        case VM_Op::PushReg:
+            count = code.operand + 1;
+            break;
+        case VM_Op::Pop:
+        case VM_Op::MovConst:
+        case VM_Op::AddConst:
+            count = code.reg + 1u;
+            break;
+        case VM_Op::MovReg:
+        case VM_Op::AddReg:
+            count = std::max(code.reg + 1u, code.operand + 1);
+            break;
+        case VM_Op::CallArgs:
+        case VM_Op::CallNativeArgs:
+            count = code.reg;
+            break;
+        default:
+            break;
+        }
+        m_registerCount = std::max(m_registerCount, count);
+    }
+
     void AddFunction(const std::string& name, std::shared_ptr<VFunction> spFunction)
     {
         assert(m_functionMap.find(name) == m_functionMap.end());
         spFunction->name = name;
         m_functions.push_back(spFunction);
         m_functionMap[name] = (uint32_t)(m_functions.size() - 1);
+        m_linkDirty = true;
     }
 
     VM_Reg RegisterByIndex(uint32_t index) const
@@ -339,6 +425,60 @@ public:
         return VM_Reg((uint32_t)VM_Reg::R0 + index);
     }
 
+    // The instruction a piece of linked code came from; for tracing and dumping module functions,
+    // which have no instructions.  End comes back as a Ret
+    VInstruction Decompile(const VCode& code) const
+    {
+        VInstruction i{ VM_IType::Ret };
+        auto operand = [&]() {
+            bool isConst = code.op == VM_Op::PushConst || code.op == VM_Op::MovConst || code.op == VM_Op::AddConst;
+            return isConst ? m_constants[code.operand] : TValue(RegisterByIndex(code.operand));
+        };
+        switch (code.op)
+        {
+        case VM_Op::PushReg:
+        case VM_Op::PushConst:
+            i.type = VM_IType::Push;
+            i.arg1 = operand();
+            break;
+        case VM_Op::Pop:
+            i.type = VM_IType::Pop;
+            i.arg1 = RegisterByIndex(code.reg);
+            break;
+        case VM_Op::PopArgs:
+            i.type = VM_IType::PopArgs;
+            break;
+        case VM_Op::MovReg:
+        case VM_Op::MovConst:
+            i.type = VM_IType::Mov;
+            i.arg1 = RegisterByIndex(code.reg);
+            i.arg2 = operand();
+            break;
+        case VM_Op::AddReg:
+        case VM_Op::AddConst:
+            i.type = VM_IType::Add;
+            i.arg1 = RegisterByIndex(code.reg);
+            i.arg2 = operand();
+            break;
+        case VM_Op::Call:
+        case VM_Op::CallNative:
+        case VM_Op::CallArgs:
+        case VM_Op::CallNativeArgs:
+            i.type = (code.op == VM_Op::Call || code.op == VM_Op::CallNative) ? VM_IType::Call : VM_IType::CallArgs;
+            i.arg1 = code.operand < m_functions.size() ? m_functions[code.operand]->name : std::string("<unresolved>");
+            if (i.type == VM_IType::CallArgs)
+            {
+                i.arg2 = int(code.reg);
+            }
+            i.target = code.operand;
+            break;
+        case VM_Op::Ret:
+        case VM_Op::End:
+            break;
+        }
+        return i;
+    }
+
     // TODO: These are reserved keywords!
     uint32_t AddReservedVariable(const std::string& name)
     {
@@ -348,49 +488,780 @@ public:
         return uint32_t(m_variables.size() - 1);
     }
 
-    template <class T>
-    T RegAs(uint32_t index) const
+
+    void AddNativeFunction(const std::string& name, JNativeFunction fn, int arity = -1)
     {
-        return std::get<T>(m_registers[index]);
+        auto pFunction = std::make_shared<VFunction>();
+        AddFunction(name, pFunction);
+        pFunction->pFnNative = fn;
+        pFunction->arity = arity;
     }
 
-    template <class T>
-    T* RegAsPtr(uint32_t index) const
+    // The user supplies MUtils::Add for their value type
+    static TValue AddValues(const TValue& lhs, const TValue& rhs)
     {
-        return std::get<std::shared_ptr<T>>(m_registers[index]).get();
+        extern TValue Add(const TValue& lhs, const TValue& rhs);
+        return Add(lhs, rhs);
     }
 
-    template <class T>
-    bool RegIs(uint32_t index)
+    uint32_t RegisterCount() const
     {
-        return std::holds_alternative<T>(m_registers[index]);
+        return m_registerCount;
     }
 
-    void AddNativeFunction(const std::string& name, std::function<TValue(uint32_t argCount)> fn) 
+private:
+    // CheckOperands has made sure it is a register, and in range
+    static uint16_t RegOperand(const TValue& value)
     {
-        auto pFunction = std::make_shared<VFunction>();
-        AddFunction(name, pFunction);
-        pFunction->pFnNative = fn;
-    };
-       
+        assert(std::holds_alternative<VM_Reg>(value));
+        return uint16_t(std::get<VM_Reg>(value));
+    }
+
+    uint32_t AddConstant(const TValue& value)
+    {
+        m_constants.push_back(value);
+        return uint32_t(m_constants.size() - 1);
+    }
+
+    // A register, or a constant pool entry
+    void CompileOperand(VCode& code, VM_Op regOp, VM_Op constOp, const TValue& value)
+    {
+        if (std::holds_alternative<VM_Reg>(value))
+        {
+            code.op = regOp;
+            code.operand = uint32_t(std::get<VM_Reg>(value));
+        }
+        else
+        {
+            code.op = constOp;
+            code.operand = AddConstant(value);
+        }
+    }
+
 public:
     std::map<std::string, uint32_t> m_functionMap;
     std::vector<std::shared_ptr<VFunction>> m_functions;
 
-    // Runtime data
-    int m_pc = 0;
-    std::deque<TValue> m_stack;
-    std::deque<VFunction*> m_callStack;
+    // Constants referenced by the compiled code
+    std::vector<TValue> m_constants;
+
+    // A loaded module's data, which external functions point into
+    std::shared_ptr<const void> m_spModule;
+    uint32_t m_moduleConstantCount = 0;
+    uint32_t m_moduleRegisterCount = 1;
 
-    // TODO: This could blow if we were building, say, a large pattern.
-    // Perhaps function returns should push onto the stack instead?
-    std::array<TValue, 1024> m_registers;
+    // The most registers any instruction uses; natives return in R0, so at least 1
+    uint32_t m_registerCount = 1;
 
     std::vector<TValue> m_variables;
     std::map<std::string, uint32_t> m_mapVariables;
 
+    bool m_linkDirty = false;
+    bool m_linkFailed = false;
+};
+
+// The state of one run of a program: registers, value stack and call frames.
+// Contexts are independent, so several can run the same linked program at once, one per thread.
+template <class TValue>
+class VMContext
+{
+public:
+    using Program = VMProgram<TValue>;
+    using VFunction = typename Program::VFunction;
+    using VInstruction = typename Program::VInstruction;
+
+    // Called after each instruction when tracing; see SetTraceHook
+    using TraceFn = std::function<void(VMContext&, const VInstruction&)>;
+
+    static constexpr uint32_t MaxStack = 1024;
+    static constexpr uint32_t MaxCallDepth = 256;
+
+    explicit VMContext(const Program& program)
+        : m_program(program)
+    {
+        m_stack.resize(MaxStack);
+        m_callStack.reserve(MaxCallDepth);
+        m_registers.resize(program.RegisterCount());
+    }
+
+    const Program& GetProgram() const
+    {
+        return m_program;
+    }
+
+    // Tracing is off by default; Run takes a slower path which calls the hook after every instruction
+    void SetTraceHook(TraceFn fn)
+    {
+        m_traceHook = fn;
+    }
+
+    // The instruction at the pc; decompiled from the code for module functions
+    VInstruction Instruction() const
+    {
+        assert(!m_callStack.empty());
+        auto pFn = m_callStack.back().pFn;
+        if (m_pc < pFn->instructions.size())
+        {
+            return pFn->instructions[m_pc];
+        }
+        return m_program.Decompile(pFn->pCode[m_pc]);
+    }
+
+    // Runs until the entry function returns, or runs off its end.  The program must be linked.
+    // Returns false if the run stopped on a fault; see m_fault.  The stack and frames are unwound either way
+    bool Run(const VFunction* pFn)
+    {
+        assert(!m_program.NeedsLink() && "Link the program before running it");
+        assert(pFn->pCode);
+
+        // The program may have grown since the last run
+        if (m_registers.size() < m_program.RegisterCount())
+        {
+            m_registers.resize(m_program.RegisterCount());
+        }
+
+        m_fault = VM_Fault::None;
+        m_callStack.push_back(VFrame{ pFn, 0, m_sp });
+        m_pc = 0;
+
+        // The user's Add and natives can throw; leave the context ready for the next run
+        try
+        {
+            if (m_traceHook)
+            {
+                RunTraced();
+            }
+            else
+            {
+                RunFast();
+            }
+        }
+        catch (...)
+        {
+            Unwind();
+            throw;
+        }
+        return m_fault == VM_Fault::None;
+    }
+
+    template <class T>
+    T RegAs(uint32_t index) const
+    {
+        return std::get<T>(m_registers[index]);
+    }
+
+    template <class T>
+    T* RegAsPtr(uint32_t index) const
+    {
+        return std::get<std::shared_ptr<T>>(m_registers[index]).get();
+    }
+
+    template <class T>
+    bool RegIs(uint32_t index) const
+    {
+        return std::holds_alternative<T>(m_registers[index]);
+    }
+
+private:
+    void RunTraced()
+    {
+        while (!m_callStack.empty())
+        {
+            auto pFn = m_callStack.back().pFn;
+            auto pc = m_pc;
+            auto code = pFn->pCode[pc];
+            Step(code);
+            if (m_fault != VM_Fault::None)
+            {
+                return;
+            }
+
+            // Module functions have no instructions, so their code is decompiled; the trailing End isn't traced
+            if (pc < pFn->instructions.size())
+            {
+                m_traceHook(*this, pFn->instructions[pc]);
+            }
+            else if (pFn->external && code.op != VM_Op::End)
+            {
+                m_traceHook(*this, m_program.Decompile(code));
+            }
+        }
+    }
+
+    void RunFast()
+    {
+        // Every function finishes with an End, so there is no need to check the pc
+        const VCode* pCode = m_callStack.back().pFn->pCode;
+
+#ifdef MUTILS_VM_COMPUTED_GOTO
+        // Same order as VM_Op
+        static const void* const dispatch[] = {
+            &&op_PushReg,
+            &&op_PushConst,
+            &&op_Pop,
+            &&op_PopArgs,
+            &&op_MovReg,
+            &&op_MovConst,
+            &&op_AddReg,
+            &&op_AddConst,
+            &&op_Call,
+            &&op_CallNative,
+            &&op_CallArgs,
+            &&op_CallNativeArgs,
+            &&op_Ret,
+            &&op_End
+        };
+
+#define VM_DISPATCH() goto* dispatch[int(pCode[m_pc].op)]
+#define VM_CHECKED(op) if (!op(pCode[m_pc])) return
+#define VM_NEXT_FUNCTION()                      \
+    if (m_callStack.empty()) return;            \
+    pCode = m_callStack.back().pFn->pCode; \
+    VM_DISPATCH()
+
+        VM_DISPATCH();
+
+    op_PushReg:
+        VM_CHECKED(OpPushReg);
+        VM_DISPATCH();
+    op_PushConst:
+        VM_CHECKED(OpPushConst);
+        VM_DISPATCH();
+    op_Pop:
+        VM_CHECKED(OpPop);
+        VM_DISPATCH();
+    op_PopArgs:
+        VM_CHECKED(OpPopArgs);
+        VM_DISPATCH();
+    op_MovReg:
+        OpMovReg(pCode[m_pc]);
+        VM_DISPATCH();
+    op_MovConst:
+        OpMovConst(pCode[m_pc]);
+        VM_DISPATCH();
+    op_AddReg:
+        OpAddReg(pCode[m_pc]);
+        VM_DISPATCH();
+    op_AddConst:
+        OpAddConst(pCode[m_pc]);
+        VM_DISPATCH();
+    op_CallNative:
+        VM_CHECKED(OpCallNative);
+        VM_DISPATCH();
+    op_CallNativeArgs:
+        VM_CHECKED(OpCallNativeArgs);
+        VM_DISPATCH();
+    op_Call:
+        VM_CHECKED(OpCall);
+        VM_NEXT_FUNCTION();
+    op_CallArgs:
+        VM_CHECKED(OpCallArgs);
+        VM_NEXT_FUNCTION();
+    op_Ret:
+    op_End:
+        OpRet();
+        VM_NEXT_FUNCTION();
+
+#undef VM_NEXT_FUNCTION
+#undef VM_CHECKED
+#undef VM_DISPATCH
+#else
+        for (;;)
+        {
+            if (Step(pCode[m_pc]))
+            {
+                if (m_callStack.empty())
+                {
+                    return;
+                }
+                pCode = m_callStack.back().pFn->pCode;
+            }
+        }
+#endif
+    }
+
+    // Execute one instruction and move the pc on.  Returns true if the current function changed,
+    // or the run stopped on a fault (the call stack is then empty)
+    bool Step(const VCode& code)
+    {
+        switch (code.op)
+        {
+        case VM_Op::PushReg:
+            return !OpPushReg(code);
+        case VM_Op::PushConst:
+            return !OpPushConst(code);
+        case VM_Op::Pop:
+            return !OpPop(code);
+        case VM_Op::PopArgs:
+            return !OpPopArgs(code);
+        case VM_Op::MovReg:
+            OpMovReg(code);
+            break;
+        case VM_Op::MovConst:
+            OpMovConst(code);
+            break;
+        case VM_Op::AddReg:
+            OpAddReg(code);
+            break;
+        case VM_Op::AddConst:
+            OpAddConst(code);
+            break;
+        case VM_Op::CallNative:
+            return !OpCallNative(code);
+        case VM_Op::CallNativeArgs:
+            return !OpCallNativeArgs(code);
+        case VM_Op::Call:
+            OpCall(code);
+            return true;
+        case VM_Op::CallArgs:
+            OpCallArgs(code);
+            return true;
+        case VM_Op::Ret:
+        case VM_Op::End:
+            OpRet();
+            return true;
+        }
+        return false;
+    }
+
+    // Stops the run: the frames are dropped and the stack goes back to where the run started
+    bool Stop(VM_Fault fault)
+    {
+        m_fault = fault;
+        Unwind();
+        return false;
+    }
+
+    // Drop the frames, and put the stack back to where the run started
+    void Unwind()
+    {
+        if (!m_callStack.empty())
+        {
+            m_sp = m_callStack.front().framePointer;
+            m_callStack.clear();
+        }
+    }
+
+    bool Push(const TValue& value)
+    {
+        if (m_sp == MaxStack)
+        {
+            return Stop(VM_Fault::StackOverflow);
+        }
+        m_stack[m_sp++] = value;
+        return true;
+    }
+
+    // Pops the argument count; counts which aren't on the stack are an underflow
+    bool PopCount(int& count)
+    {
+        if (m_sp == 0)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        count = std::get<int>(m_stack[--m_sp]);
+        if (count < 0 || uint32_t(count) > m_sp)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        return true;
+    }
+
+    // The arguments land in registers 0..count-1; the count has been checked against the stack
+    void PopCallArgs(int count)
+    {
+        // Counts pushed at run time can be more than the program uses
+        if (size_t(count) > m_registers.size())
+        {
+            m_registers.resize(count);
+        }
+        for (int reg = count - 1; reg >= 0; reg--)
+        {
+            m_registers[reg] = std::move(m_stack[--m_sp]);
+        }
+    }
+
+    bool CallFunction(const VCode& code, int count)
+    {
+        // Unresolved calls are left as InvalidTarget by Link
+        if (code.operand >= m_program.m_functions.size())
+        {
+            return Stop(VM_Fault::BadCall);
+        }
+        auto pFn = m_program.m_functions[code.operand].get();
+        if (m_callStack.size() == MaxCallDepth)
+        {
+            return Stop(VM_Fault::CallDepth);
+        }
+        PopCallArgs(count);
+
+        m_callStack.push_back(VFrame{ pFn, m_pc + 1, m_sp });
+        m_pc = 0;
+        return true;
+    }
+
+    void CallNative(const VCode& code, int count)
+    {
+        // Natives read their arguments from the registers and return into R0
+        auto pFn = m_program.m_functions[code.operand].get();
+        PopCallArgs(count);
+        m_registers[0] = pFn->pFnNative(*this, count);
+        m_pc++;
+    }
+
+    // The count is on top of the stack
+    bool OpCall(const VCode& code)
+    {
+        int count;
+        return PopCount(count) && CallFunction(code, count);
+    }
+
+    bool OpCallNative(const VCode& code)
+    {
+        int count;
+        if (!PopCount(count))
+        {
+            return false;
+        }
+        CallNative(code, count);
+        return true;
+    }
+
+    bool OpCallArgs(const VCode& code)
+    {
+        if (code.reg > m_sp)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        return CallFunction(code, code.reg);
+    }
+
+    bool OpCallNativeArgs(const VCode& code)
+    {
+        if (code.reg > m_sp)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        CallNative(code, code.reg);
+        return true;
+    }
+
+    void OpRet()
+    {
+        // Anything the function left on the stack is dropped; it may also have popped its caller's values (PopArgs)
+        assert(!m_callStack.empty());
+        auto& frame = m_callStack.back();
+        m_sp = std::min(m_sp, frame.framePointer);
+        m_pc = frame.returnPc;
+        m_callStack.pop_back();
+    }
+
+    bool OpPushReg(const VCode& code)
+    {
+        m_pc++;
+        return Push(m_registers[code.operand]);
+    }
+
+    bool OpPushConst(const VCode& code)
+    {
+        m_pc++;
+        return Push(m_program.m_constants[code.operand]);
+    }
+
+    bool OpPop(const VCode& code)
+    {
+        if (m_sp == 0)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        m_registers[code.reg] = std::move(m_stack[--m_sp]);
+        m_pc++;
+        return true;
+    }
+
+    bool OpPopArgs(const VCode&)
+    {
+        // Pop into registers
+        int count;
+        if (!PopCount(count))
+        {
+            return false;
+        }
+        if (size_t(count) > m_registers.size())
+        {
+            m_registers.resize(count);
+        }
+        for (int reg = 0; reg < count; reg++)
+        {
+            m_registers[reg] = std::move(m_stack[--m_sp]);
+        }
+        m_pc++;
+        return true;
+    }
+
+    void OpMovReg(const VCode& code)
+    {
+        m_registers[code.reg] = m_registers[code.operand];
+        m_pc++;
+    }
+
+    void OpMovConst(const VCode& code)
+    {
+        m_registers[code.reg] = m_program.m_constants[code.operand];
+        m_pc++;
+    }
+
+    void OpAddReg(const VCode& code)
+    {
+        auto& target = m_registers[code.reg];
+        target = Program::AddValues(target, m_registers[code.operand]);
+        m_pc++;
+    }
+
+    void OpAddConst(const VCode& code)
+    {
+        auto& target = m_registers[code.reg];
+        target = Program::AddValues(target, m_program.m_constants[code.operand]);
+        m_pc++;
+    }
+
+public:
+    struct VFrame
+    {
+        const VFunction* pFn;
+        uint32_t returnPc;
+        uint32_t framePointer; // Stack pointer on entry; restored on return
+    };
+
+    const Program& m_program;
+
+    uint32_t m_pc = 0;
+    std::vector<TValue> m_stack; // Sized up front; m_sp is the next free slot
+    uint32_t m_sp = 0;
+    std::vector<VFrame> m_callStack;
+
+    // Sized to the program; grows if a call passes more arguments
+    std::vector<TValue> m_registers;
+
+    // Why the last run stopped early, if it did
+    VM_Fault m_fault = VM_Fault::None;
+
+    TraceFn m_traceHook;
+};
+
+// A program with a context to run it on, and a log for dumps and traces
+template <class TValue>
+class VM : public VMProgram<TValue>
+{
+public:
+    using Program = VMProgram<TValue>;
+    using Context = VMContext<TValue>;
+    using VFunction = typename Program::VFunction;
+    using VInstruction = typename Program::VInstruction;
+    using DumpArgFn = std::function<void(std::ostringstream&, const TValue&)>;
+
+    // Called after each instruction when tracing; see SetTraceHook
+    using TraceFn = std::function<void(VM&, const VInstruction&)>;
+
+    using Program::FindFunction;
+    using Program::m_functions;
+
+public:
+    VM(std::ostringstream& log, DumpArgFn fn)
+        : m_log(log),
+        m_dumpArgFn(fn),
+        m_context(*this)
+    {
+    }
+
+    ~VM()
+    {
+    }
+
+    VInstruction Instruction() const
+    {
+        return m_context.Instruction();
+    }
+
+    void DumpInstruction(std::ostringstream& code, const VInstruction& i)
+    {
+        switch (i.type)
+        {
+        case VM_IType::Call:
+        case VM_IType::CallArgs:
+        {
+            code << "CALL ";
+            m_dumpArgFn(code, i.arg1);
+            if (i.type == VM_IType::CallArgs)
+            {
+                code << ", ";
+                m_dumpArgFn(code, i.arg2);
+            }
+            auto pFn = FindFunction(std::get<std::string>(i.arg1));
+            if (pFn && pFn->pFnNative)
+            {
+                code << " (native)";
+            }
+        }
+        break;
+        case VM_IType::Ret:
+            code << "RET";
+            break;
+        case VM_IType::Push:
+            code << "PUSH ";
+            m_dumpArgFn(code, i.arg1);
+            break;
+        case VM_IType::Pop:
+            code << "POP ";
+            m_dumpArgFn(code, i.arg1);
+            break;
+        case VM_IType::PopArgs:
+            code << "POPARGS";
+            break;
+        case VM_IType::Mov:
+            code << "MOV ";
+            m_dumpArgFn(code, i.arg1);
+            code << ", ";
+            m_dumpArgFn(code, i.arg2);
+            break;
+        case VM_IType::Add:
+            code << "ADD ";
+            m_dumpArgFn(code, i.arg1);
+            code << ", ";
+            m_dumpArgFn(code, i.arg2);
+            break;
+        }
+    }
+
+    void Dump()
+    {
+        std::ostringstream& code = m_log;
+        code << "\nVM:\n";
+
+        for (auto& fn : m_functions)
+        {
+            code << "\n"
+                 << fn->name << ":\n";
+
+            uint32_t index = 0;
+            for (auto& i : fn->instructions)
+            {
+                code << index++ << ": ";
+                DumpInstruction(code, i);
+                code << "\n";
+            }
+
+            // Loaded from a module; everything but the End
+            if (fn->external)
+            {
+                for (; index + 1 < fn->codeCount; index++)
+                {
+                    code << index << ": ";
+                    DumpInstruction(code, this->Decompile(fn->pCode[index]));
+                    code << "\n";
+                }
+            }
+            code << "\n";
+        }
+    }
+
+    // Tracing is off by default; Run takes a slower path which calls the hook after every instruction
+    void SetTraceHook(TraceFn fn)
+    {
+        if (!fn)
+        {
+            m_context.SetTraceHook(nullptr);
+            return;
+        }
+        m_context.SetTraceHook([this, fn](Context&, const VInstruction& i) {
+            fn(*this, i);
+        });
+    }
+
+    // Trace each instruction and the stack to the log, as the VM always used to
+    void TraceToLog()
+    {
+        SetTraceHook([](VM& vm, const VInstruction& i) {
+            std::ostringstream inst;
+            vm.DumpInstruction(inst, i);
+
+            std::ostringstream& code = vm.m_log;
+            code << std::setw(20) << std::left << inst.str() << "Stack:";
+            auto& context = vm.m_context;
+            for (auto index = context.m_sp; index-- > 0;)
+            {
+                code << " [";
+                vm.m_dumpArgFn(code, context.m_stack[index]);
+                code << "]";
+            }
+            code << "\n";
+        });
+    }
+
+    // Links if needed, then runs on the VM's own context.  Link errors and faults go to the log,
+    // and return false; a program which didn't link is never run
+    bool Run(VFunction* pFn)
+    {
+        if (this->NeedsLink())
+        {
+            for (auto& error : this->Link())
+            {
+                m_log << error << "\n";
+            }
+        }
+
+        if (this->LinkFailed())
+        {
+            m_log << "Not running " << pFn->name << ": the program has link errors\n";
+            return false;
+        }
+
+        if (m_context.m_traceHook)
+        {
+            m_log << "\nRunning " << pFn->name << "\n";
+        }
+        if (!m_context.Run(pFn))
+        {
+            m_log << "Stopped " << pFn->name << ": " << vm_fault_string(m_context.m_fault) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Natives which only run on the VM's own context can read its registers directly
+    void AddNativeFunction(const std::string& name, std::function<TValue(uint32_t argCount)> fn, int arity = -1)
+    {
+        Program::AddNativeFunction(
+            name, [fn](Context&, uint32_t argCount) { return fn(argCount); }, arity);
+    }
+
+    void AddNativeFunction(const std::string& name, typename Program::JNativeFunction fn, int arity = -1)
+    {
+        Program::AddNativeFunction(name, fn, arity);
+    }
+
+    template <class T>
+    T RegAs(uint32_t index) const
+    {
+        return m_context.template RegAs<T>(index);
+    }
+
+    template <class T>
+    T* RegAsPtr(uint32_t index) const
+    {
+        return m_context.template RegAsPtr<T>(index);
+    }
+
+    template <class T>
+    bool RegIs(uint32_t index) const
+    {
+        return m_context.template RegIs<T>(index);
+    }
+
+public:
     std::ostringstream& m_log;
     DumpArgFn m_dumpArgFn;
+    Context m_context;
 };
 
 } // namespace MUtils
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include <mutils/vm/vm.h>
+
+namespace MUtils
+{
+
+// Runs one program for many independent states ("lanes") in lockstep, e.g. a modulation script for
+// every voice.  The VM has no branches, so all lanes always take the same path, and each instruction
+// is dispatched once per batch rather than once per lane.
+// Registers and stack slots are stored lane-contiguous (structure of arrays).  If TLane is a plain
+// number, constants are converted once up front and Add/Mov become simple loops the compiler vectorises;
+// otherwise lanes hold TValue and Add goes through the user's Add.
+// Natives are per batch; see SetNative.
+template <class TValue, class TLane = TValue>
+class VMBatch
+{
+public:
+    using Program = VMProgram<TValue>;
+    using VFunction = typename Program::VFunction;
+
+    // Turn a program constant into a lane value; needed when TLane isn't TValue
+    using ConvertFn = std::function<TLane(const TValue& value)>;
+
+    // Read arguments from Lanes(0..argCount-1), write the result to Lanes(0)
+    using NativeFn = std::function<void(VMBatch& batch, uint32_t argCount)>;
+
+    static constexpr uint32_t MaxStack = 256;
+    static constexpr uint32_t MaxCallDepth = 256;
+
+    VMBatch(const Program& program, uint32_t laneCount, ConvertFn convert = nullptr)
+        : m_program(program),
+        m_laneCount(laneCount)
+    {
+        assert(!program.NeedsLink() && "Link the program before batching it");
+        m_registerCount = program.RegisterCount();
+        m_registers.resize(size_t(m_registerCount) * laneCount);
+        m_stack.resize(size_t(MaxStack) * laneCount);
+        m_callStack.reserve(MaxCallDepth);
+        m_natives.resize(program.m_functions.size());
+
+        // Each constant is splatted across the lanes, so constant operands are the same shape as registers
+        m_constants.resize(program.m_constants.size() * laneCount);
+        for (size_t index = 0; index < program.m_constants.size(); index++)
+        {
+            TLane value;
+            if constexpr (std::is_same_v<TLane, TValue>)
+            {
+                value = convert ? convert(program.m_constants[index]) : program.m_constants[index];
+            }
+            else
+            {
+                assert(convert && "Batches of plain lanes need a ConvertFn");
+                value = convert(program.m_constants[index]);
+            }
+            std::fill_n(&m_constants[index * laneCount], laneCount, value);
+        }
+    }
+
+    uint32_t LaneCount() const
+    {
+        return m_laneCount;
+    }
+
+    // Can grow past the program's count when a call pushes more arguments
+    uint32_t RegisterCount() const
+    {
+        return m_registerCount;
+    }
+
+    // The lanes of a register
+    TLane* Lanes(uint32_t reg)
+    {
+        assert(reg < m_registerCount);
+        return &m_registers[size_t(reg) * m_laneCount];
+    }
+
+    // Set one for every native the program calls; a call to one without stops the run with VM_Fault::BadCall
+    void SetNative(const std::string& name, NativeFn fn)
+    {
+        auto itr = m_program.m_functionMap.find(name);
+        assert(itr != m_program.m_functionMap.end());
+        m_natives[itr->second] = fn;
+    }
+
+    // Why the last run stopped early, if it did
+    VM_Fault GetFault() const
+    {
+        return m_fault;
+    }
+
+    // Runs all lanes until the entry function returns, or runs off its end.
+    // Returns false if the run stopped on a fault; the stack and frames are unwound either way
+    bool Run(const VFunction* pFn)
+    {
+        assert(pFn->pCode);
+        m_fault = VM_Fault::None;
+        m_callStack.push_back(VFrame{ pFn, 0, m_sp });
+        m_pc = 0;
+
+        // The lane Add and natives can throw; leave the batch ready for the next run
+        try
+        {
+            return RunLanes(pFn->pCode);
+        }
+        catch (...)
+        {
+            Unwind();
+            throw;
+        }
+    }
+
+private:
+    bool RunLanes(const VCode* pCode)
+    {
+        for (;;)
+        {
+            auto& code = pCode[m_pc];
+            switch (code.op)
+            {
+            case VM_Op::PushReg:
+                if (!CheckStack(0, 1))
+                {
+                    return false;
+                }
+                Copy(PushSlot(), Lanes(code.operand));
+                break;
+            case VM_Op::PushConst:
+                if (!CheckStack(0, 1))
+                {
+                    return false;
+                }
+                Copy(PushSlot(), Constant(code.operand));
+                break;
+            case VM_Op::Pop:
+                if (!CheckStack(1, 0))
+                {
+                    return false;
+                }
+                Copy(Lanes(code.reg), PopSlot());
+                break;
+            case VM_Op::PopArgs:
+            {
+                // The count is the same in every lane
+                uint32_t count;
+                if (!PopCount(count))
+                {
+                    return false;
+                }
+                ReserveRegisters(count);
+                for (uint32_t reg = 0; reg < count; reg++)
+                {
+                    Copy(Lanes(reg), PopSlot());
+                }
+            }
+            break;
+            case VM_Op::MovReg:
+                Copy(Lanes(code.reg), Lanes(code.operand));
+                break;
+            case VM_Op::MovConst:
+                Copy(Lanes(code.reg), Constant(code.operand));
+                break;
+            case VM_Op::AddReg:
+                Add(Lanes(code.reg), Lanes(code.operand));
+                break;
+            case VM_Op::AddConst:
+                Add(Lanes(code.reg), Constant(code.operand));
+                break;
+            case VM_Op::Call:
+            case VM_Op::CallArgs:
+            {
+                uint32_t count = code.reg;
+                if ((code.op == VM_Op::Call ? !PopCount(count) : !CheckStack(count, 0)) || !EnterFunction(code, count))
+                {
+                    return false;
+                }
+                pCode = m_callStack.back().pFn->pCode;
+                continue;
+            }
+            case VM_Op::CallNative:
+            case VM_Op::CallNativeArgs:
+            {
+                uint32_t count = code.reg;
+                if ((code.op == VM_Op::CallNative ? !PopCount(count) : !CheckStack(count, 0)) || !CallNative(code, count))
+                {
+                    return false;
+                }
+            }
+            break;
+            case VM_Op::Ret:
+            case VM_Op::End:
+            {
+                auto& frame = m_callStack.back();
+                m_sp = std::min(m_sp, frame.framePointer);
+                m_pc = frame.returnPc;
+                m_callStack.pop_back();
+                if (m_callStack.empty())
+                {
+                    return true;
+                }
+                pCode = m_callStack.back().pFn->pCode;
+                continue;
+            }
+            }
+            m_pc++;
+        }
+    }
+
+    TLane* Constant(uint32_t index)
+    {
+        return &m_constants[size_t(index) * m_laneCount];
+    }
+
+    // Stops the run: the frames are dropped and the stack goes back to where the run started
+    bool Stop(VM_Fault fault)
+    {
+        m_fault = fault;
+        Unwind();
+        return false;
+    }
+
+    void Unwind()
+    {
+        if (!m_callStack.empty())
+        {
+            m_sp = m_callStack.front().framePointer;
+            m_callStack.clear();
+        }
+    }
+
+    // Checked before an instruction touches the stack, so the slot accessors can trust it
+    bool CheckStack(uint32_t pops, uint32_t pushes)
+    {
+        if (pops > m_sp)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        if (pushes > MaxStack - m_sp)
+        {
+            return Stop(VM_Fault::StackOverflow);
+        }
+        return true;
+    }
+
+    TLane* PushSlot()
+    {
+        assert(m_sp < MaxStack);
+        return &m_stack[size_t(m_sp++) * m_laneCount];
+    }
+
+    TLane* PopSlot()
+    {
+        assert(m_sp > 0);
+        return &m_stack[size_t(--m_sp) * m_laneCount];
+    }
+
+    // Pops the argument count; counts which aren't on the stack are an underflow
+    bool PopCount(uint32_t& count)
+    {
+        if (!CheckStack(1, 0))
+        {
+            return false;
+        }
+        auto pCount = PopSlot();
+        int value;
+        if constexpr (std::is_arithmetic_v<TLane>)
+        {
+            value = int(pCount[0]);
+        }
+        else
+        {
+            value = std::get<int>(pCount[0]);
+        }
+        if (value < 0)
+        {
+            return Stop(VM_Fault::StackUnderflow);
+        }
+        count = uint32_t(value);
+        return CheckStack(count, 0);
+    }
+
+    void Copy(TLane* pDest, const TLane* pSource)
+    {
+        if (pDest == pSource)
+        {
+            return;
+        }
+
+        if constexpr (std::is_trivially_copyable_v<TLane>)
+        {
+            memcpy(pDest, pSource, sizeof(TLane) * m_laneCount);
+        }
+        else
+        {
+            std::copy(pSource, pSource + m_laneCount, pDest);
+        }
+    }
+
+    void Add(TLane* pDest, const TLane* pSource)
+    {
+        if constexpr (std::is_arithmetic_v<TLane>)
+        {
+            for (uint32_t lane = 0; lane < m_laneCount; lane++)
+            {
+                pDest[lane] += pSource[lane];
+            }
+        }
+        else
+        {
+            for (uint32_t lane = 0; lane < m_laneCount; lane++)
+            {
+                pDest[lane] = Program::AddValues(pDest[lane], pSource[lane]);
+            }
+        }
+    }
+
+    // Counts pushed at run time can be more than the program uses; registers are whole blocks of lanes, so they just grow
+    void ReserveRegisters(uint32_t count)
+    {
+        if (count > m_registerCount)
+        {
+            m_registerCount = count;
+            m_registers.resize(size_t(m_registerCount) * m_laneCount);
+        }
+    }
+
+    // Arguments land in registers 0..count-1
+    void PopCallArgs(uint32_t count)
+    {
+        ReserveRegisters(count);
+        for (uint32_t reg = count; reg-- > 0;)
+        {
+            Copy(Lanes(reg), PopSlot());
+        }
+    }
+
+    bool EnterFunction(const VCode& code, uint32_t count)
+    {
+        // Unresolved calls are left as InvalidTarget by Link
+        if (code.operand >= m_program.m_functions.size())
+        {
+            return Stop(VM_Fault::BadCall);
+        }
+        if (m_callStack.size() == MaxCallDepth)
+        {
+            return Stop(VM_Fault::CallDepth);
+        }
+        PopCallArgs(count);
+
+        m_callStack.push_back(VFrame{ m_program.m_functions[code.operand].get(), m_pc + 1, m_sp });
+        m_pc = 0;
+        return true;
+    }
+
+    bool CallNative(const VCode& code, uint32_t count)
+    {
+        // Natives the batch wasn't given with SetNative can't be called
+        if (!m_natives[code.operand])
+        {
+            return Stop(VM_Fault::BadCall);
+        }
+        PopCallArgs(count);
+        m_natives[code.operand](*this, count);
+        return true;
+    }
+
+private:
+    struct VFrame
+    {
+        const VFunction* pFn;
+        uint32_t returnPc;
+        uint32_t framePointer;
+    };
+
+    const Program& m_program;
+    uint32_t m_laneCount;
+    uint32_t m_registerCount;
+
+    uint32_t m_pc = 0;
+    uint32_t m_sp = 0;
+    VM_Fault m_fault = VM_Fault::None;
+    std::vector<TLane> m_registers;
+    std::vector<TLane> m_stack;
+    std::vector<TLane> m_constants;
+    std::vector<VFrame> m_callStack;
+    std::vector<NativeFn> m_natives;
+};
+
+} // namespace MUtils
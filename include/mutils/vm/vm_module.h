@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+
+#include <mutils/file/file_map.h>
+#include <mutils/vm/vm.h>
+
+namespace MUtils
+{
+
+// Binary modules; a linked program's function table, constant pool and code, which can be mapped straight
+// back in.  Code is used in place, so a module starts without compiling, and the pages of a mapped
+// module are shared between processes.  Constants are decoded into the VM, since TValue is the user's.
+//
+// Modules are in the byte order of the machine that wrote them, so code can be used in place; the magic
+// reads backwards on a machine of the other order, and the load is refused.
+// Layout; all offsets are from the start of the module:
+//   VMModuleHeader
+//   VMModuleFunction[functionCount]
+//   VMModuleConstant[constantCount]
+//   VCode[codeCount]            (8 byte aligned)
+//   data[dataSize]              (function names and encoded constants)
+namespace VMModule
+{
+constexpr uint32_t Magic = 0x424D564D; // "MVMB"
+constexpr uint32_t SwappedMagic = 0x4D564D42;
+constexpr uint32_t Version = 1;
+}
+
+namespace VMModuleFunctionFlags
+{
+enum
+{
+    None = (0),
+    Native = (1 << 0) // Bound by name to a native the VM already has
+};
+}
+
+struct VMModuleHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t codeEntrySize;
+    uint32_t functionCount;
+    uint32_t functionsOffset;
+    uint32_t constantCount;
+    uint32_t constantsOffset;
+    uint32_t codeCount;
+    uint32_t codeOffset;
+    uint32_t dataSize;
+    uint32_t dataOffset;
+};
+
+struct VMModuleFunction
+{
+    uint32_t nameOffset;
+    uint32_t nameSize;
+    uint32_t codeStart;
+    uint32_t codeCount;
+    int32_t arity;
+    uint32_t flags;
+};
+
+struct VMModuleConstant
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+// Append a value's bytes to the string; return false if it can't be stored
+template <class TValue>
+using VMEncodeFn = std::function<bool(std::string& data, const TValue& value)>;
+
+template <class TValue>
+using VMDecodeFn = std::function<bool(const uint8_t* pData, size_t size, TValue& value)>;
+
+// Links the VM if needed, and writes all of its functions.  Returns a message for each problem
+template <class TValue>
+std::vector<std::string> vm_module_write(VMProgram<TValue>& vm, const VMEncodeFn<TValue>& encode, std::string& module)
+{
+    std::vector<std::string> errors;
+    if (vm.NeedsLink())
+    {
+        errors = vm.Link();
+        if (!errors.empty())
+        {
+            return errors;
+        }
+    }
+
+    std::vector<VMModuleFunction> functions;
+    std::vector<VMModuleConstant> constants;
+    std::vector<VCode> code;
+    std::string data;
+
+    for (auto& spFn : vm.m_functions)
+    {
+        VMModuleFunction fn;
+        fn.nameOffset = uint32_t(data.size());
+        fn.nameSize = uint32_t(spFn->name.size());
+        fn.codeStart = uint32_t(code.size());
+        fn.codeCount = spFn->pFnNative ? 0 : spFn->codeCount;
+        fn.arity = spFn->arity;
+        fn.flags = spFn->pFnNative ? VMModuleFunctionFlags::Native : VMModuleFunctionFlags::None;
+        data += spFn->name;
+        if (!spFn->pFnNative)
+        {
+            code.insert(code.end(), spFn->pCode, spFn->pCode + spFn->codeCount);
+        }
+        functions.push_back(fn);
+    }
+
+    for (auto& value : vm.m_constants)
+    {
+        VMModuleConstant constant;
+        constant.offset = uint32_t(data.size());
+        if (!encode(data, value))
+        {
+            errors.push_back("Can't encode constant " + std::to_string(constants.size()));
+        }
+        constant.size = uint32_t(data.size() - constant.offset);
+        constants.push_back(constant);
+    }
+
+    if (!errors.empty())
+    {
+        return errors;
+    }
+
+    auto align = [](size_t offset) { return (offset + 7) & ~size_t(7); };
+
+    VMModuleHeader header;
+    header.magic = VMModule::Magic;
+    header.version = VMModule::Version;
+    header.codeEntrySize = uint32_t(sizeof(VCode));
+    header.functionCount = uint32_t(functions.size());
+    header.functionsOffset = uint32_t(sizeof(VMModuleHeader));
+    header.constantCount = uint32_t(constants.size());
+    header.constantsOffset = uint32_t(header.functionsOffset + functions.size() * sizeof(VMModuleFunction));
+    header.codeCount = uint32_t(code.size());
+    header.codeOffset = uint32_t(align(header.constantsOffset + constants.size() * sizeof(VMModuleConstant)));
+    header.dataSize = uint32_t(data.size());
+    header.dataOffset = uint32_t(header.codeOffset + code.size() * sizeof(VCode));
+    header.size = header.dataOffset + header.dataSize;
+
+    module.assign(header.size, '\0');
+    auto pOut = &module[0];
+    memcpy(pOut, &header, sizeof(header));
+    memcpy(pOut + header.functionsOffset, functions.data(), functions.size() * sizeof(VMModuleFunction));
+    memcpy(pOut + header.constantsOffset, constants.data(), constants.size() * sizeof(VMModuleConstant));
+    memcpy(pOut + header.codeOffset, code.data(), code.size() * sizeof(VCode));
+    memcpy(pOut + header.dataOffset, data.data(), data.size());
+    return errors;
+}
+
+template <class TValue>
+std::vector<std::string> vm_module_save(VMProgram<TValue>& vm, const fs::path& path, const VMEncodeFn<TValue>& encode)
+{
+    std::string module;
+    auto errors = vm_module_write(vm, encode, module);
+    if (errors.empty() && !file_write(path, module))
+    {
+        errors.push_back("Can't write " + path.string());
+    }
+    return errors;
+}
+
+// Load a module into a program which has no functions yet, other than natives the module calls.
+// The module is checked before anything changes, and its code is run in place; spOwner keeps the
+// memory alive for as long as the VM uses it.  Returns a message for each problem
+template <class TValue>
+std::vector<std::string> vm_module_load(VMProgram<TValue>& vm, const uint8_t* pData, size_t size, std::shared_ptr<const void> spOwner, const VMDecodeFn<TValue>& decode)
+{
+    using TFunction = typename VMProgram<TValue>::VFunction;
+
+    std::vector<std::string> errors;
+    auto fail = [&](const std::string& error) {
+        errors.push_back(error);
+        return errors;
+    };
+
+    auto inRange = [&](uint64_t offset, uint64_t count, uint64_t entrySize) {
+        return offset + count * entrySize <= size;
+    };
+
+    VMModuleHeader header;
+    if (size < sizeof(header))
+    {
+        return fail("Not a VM module");
+    }
+    memcpy(&header, pData, sizeof(header));
+    if (header.magic == VMModule::SwappedMagic)
+    {
+        return fail("VM module has the wrong byte order");
+    }
+    if (header.magic != VMModule::Magic)
+    {
+        return fail("Not a VM module");
+    }
+    if (header.version != VMModule::Version || header.codeEntrySize != sizeof(VCode))
+    {
+        return fail("Unsupported VM module version " + std::to_string(header.version));
+    }
+    if (header.size != size || !inRange(header.functionsOffset, header.functionCount, sizeof(VMModuleFunction)) || !inRange(header.constantsOffset, header.constantCount, sizeof(VMModuleConstant)) || !inRange(header.codeOffset, header.codeCount, sizeof(VCode)) || !inRange(header.dataOffset, header.dataSize, 1))
+    {
+        return fail("Truncated VM module");
+    }
+    if (((uintptr_t)pData + header.functionsOffset) % alignof(VMModuleFunction) != 0 || ((uintptr_t)pData + header.constantsOffset) % alignof(VMModuleConstant) != 0 || ((uintptr_t)pData + header.codeOffset) % alignof(VCode) != 0)
+    {
+        return fail("Misaligned VM module");
+    }
+
+    for (auto& spFn : vm.m_functions)
+    {
+        if (!spFn->pFnNative)
+        {
+            return fail("Modules can only be loaded into a VM without functions: " + spFn->name);
+        }
+    }
+
+    auto pModuleFunctions = (const VMModuleFunction*)(pData + header.functionsOffset);
+    auto pModuleConstants = (const VMModuleConstant*)(pData + header.constantsOffset);
+    auto pCode = (const VCode*)(pData + header.codeOffset);
+    auto pStrings = pData + header.dataOffset;
+
+    // Functions, in module order, so the code's call operands stay valid
+    std::vector<std::shared_ptr<TFunction>> functions;
+    for (uint32_t index = 0; index < header.functionCount; index++)
+    {
+        auto& fn = pModuleFunctions[index];
+        if (uint64_t(fn.nameOffset) + fn.nameSize > header.dataSize)
+        {
+            return fail("Bad function name " + std::to_string(index));
+        }
+
+        auto name = std::string((const char*)pStrings + fn.nameOffset, fn.nameSize);
+        if (fn.flags & VMModuleFunctionFlags::Native)
+        {
+            auto pNative = vm.FindFunction(name);
+            if (!pNative)
+            {
+                return fail("Missing native function '" + name + "'");
+            }
+            functions.push_back(vm.m_functions[vm.m_functionMap[name]]);
+            continue;
+        }
+
+        // Every function must end in End, so nothing can run off the end of the module
+        if (fn.codeCount == 0 || uint64_t(fn.codeStart) + fn.codeCount > header.codeCount || pCode[fn.codeStart + fn.codeCount - 1].op != VM_Op::End)
+        {
+            return fail("Bad code for '" + name + "'");
+        }
+
+        auto spFn = std::make_shared<TFunction>();
+        spFn->name = name;
+        spFn->arity = fn.arity;
+        spFn->pCode = pCode + fn.codeStart;
+        spFn->codeCount = fn.codeCount;
+        spFn->external = true;
+        functions.push_back(spFn);
+    }
+
+    // Check operands once here.  Stack and call depth depend on the data, so they are checked as
+    // the code runs; see VM_Fault
+    const auto registerCount = VMProgram<TValue>::MaxRegisters;
+    for (uint32_t index = 0; index < header.codeCount; index++)
+    {
+        auto& code = pCode[index];
+        bool valid = code.reg < registerCount;
+        switch (code.op)
+        {
+        case VM_Op::PushReg:
+        case VM_Op::MovReg:
+        case VM_Op::AddReg:
+            valid &= code.operand < registerCount;
+            break;
+        case VM_Op::PushConst:
+        case VM_Op::MovConst:
+        case VM_Op::AddConst:
+            valid &= code.operand < header.constantCount;
+            break;
+        case VM_Op::Call:
+        case VM_Op::CallArgs:
+        case VM_Op::CallNative:
+        case VM_Op::CallNativeArgs:
+        {
+            bool native = code.op == VM_Op::CallNative || code.op == VM_Op::CallNativeArgs;
+            valid &= code.operand < header.functionCount && bool(functions[code.operand]->pFnNative) == native;
+        }
+        break;
+        case VM_Op::Pop:
+        case VM_Op::PopArgs:
+        case VM_Op::Ret:
+        case VM_Op::End:
+            break;
+        default:
+            valid = false;
+            break;
+        }
+
+        if (!valid)
+        {
+            return fail("Bad instruction " + std::to_string(index));
+        }
+    }
+
+    std::vector<TValue> constants(header.constantCount);
+    for (uint32_t index = 0; index < header.constantCount; index++)
+    {
+        auto& constant = pModuleConstants[index];
+        if (uint64_t(constant.offset) + constant.size > header.dataSize || !decode(pStrings + constant.offset, constant.size, constants[index]))
+        {
+            return fail("Can't decode constant " + std::to_string(index));
+        }
+    }
+
+    // Natives the module doesn't use go on the end
+    for (auto& spFn : vm.m_functions)
+    {
+        if (std::find(functions.begin(), functions.end(), spFn) == functions.end())
+        {
+            functions.push_back(spFn);
+        }
+    }
+
+    vm.m_functions = functions;
+    vm.m_functionMap.clear();
+    for (uint32_t index = 0; index < uint32_t(functions.size()); index++)
+    {
+        vm.m_functionMap[functions[index]->name] = index;
+    }
+    vm.m_constants = std::move(constants);
+    vm.m_moduleConstantCount = header.constantCount;
+    vm.m_registerCount = 1;
+    for (uint32_t index = 0; index < header.codeCount; index++)
+    {
+        vm.CountRegisters(pCode[index]);
+    }
+    vm.m_moduleRegisterCount = vm.m_registerCount;
+    vm.m_spModule = spOwner;
+    vm.m_linkDirty = false;
+    return errors;
+}
+
+// Map a module file and load it
+template <class TValue>
+std::vector<std::string> vm_module_load(VMProgram<TValue>& vm, const fs::path& path, const VMDecodeFn<TValue>& decode)
+{
+    auto spMapping = file_map(path);
+    if (!spMapping)
+    {
+        return { "Can't open " + path.string() };
+    }
+    return vm_module_load(vm, spMapping->Data(), spMapping->Size(), spMapping, decode);
+}
+
+} // namespace MUtils
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <map>
+
+#include <mutils/vm/vm.h>
+
+namespace MUtils
+{
+
+namespace VMOptimizeFlags
+{
+enum
+{
+    None = (0),
+    Peephole = (1 << 0),         // PUSH x; POP Rn -> MOV Rn, x, self moves, unreachable code after RET
+    ConstantFold = (1 << 1),     // Registers with known values are folded into ADD/MOV, using the VM's Add
+    DeadMoves = (1 << 2),        // Moves overwritten before they are read
+    SuperInstructions = (1 << 3), // PUSH n; CALL f -> CALL f, n
+    All = (Peephole | ConstantFold | DeadMoves | SuperInstructions)
+};
+}
+
+struct VMOptimizeStats
+{
+    uint32_t instructionsBefore = 0;
+    uint32_t instructionsAfter = 0;
+    uint32_t peepholes = 0;
+    uint32_t folded = 0;
+    uint32_t deadMoves = 0;
+    uint32_t superInstructions = 0;
+};
+
+namespace VMOptimizeDetail
+{
+
+template <class TValue>
+using TInstruction = typename VMProgram<TValue>::VInstruction;
+
+template <class TValue>
+bool IsReg(const TValue& value, int reg)
+{
+    return std::holds_alternative<VM_Reg>(value) && int(std::get<VM_Reg>(value)) == reg;
+}
+
+// Does the instruction read register reg?
+template <class TValue>
+bool ReadsReg(const TInstruction<TValue>& i, int reg)
+{
+    switch (i.type)
+    {
+    case VM_IType::Push:
+        return IsReg(i.arg1, reg);
+    case VM_IType::Mov:
+        return IsReg(i.arg2, reg);
+    case VM_IType::Add:
+        return IsReg(i.arg1, reg) || IsReg(i.arg2, reg);
+    default:
+        return false;
+    }
+}
+
+// Calls, PopArgs and returns can read or write any register
+inline bool IsBarrier(VM_IType type)
+{
+    return type == VM_IType::Call || type == VM_IType::CallArgs || type == VM_IType::PopArgs || type == VM_IType::Ret;
+}
+
+template <class TValue>
+bool Peephole(std::vector<TInstruction<TValue>>& code, VMOptimizeStats& stats)
+{
+    bool changed = false;
+
+    // Nothing jumps, so everything after a RET is unreachable; a RET at the end is the same as running off it
+    for (size_t index = 0; index < code.size(); index++)
+    {
+        if (code[index].type == VM_IType::Ret)
+        {
+            stats.peepholes += uint32_t(code.size() - index);
+            code.erase(code.begin() + index, code.end());
+            changed = true;
+            break;
+        }
+    }
+
+    for (size_t index = 0; index < code.size(); index++)
+    {
+        auto& i = code[index];
+        if (i.type == VM_IType::Mov && i.arg1 == i.arg2)
+        {
+            code.erase(code.begin() + index--);
+            stats.peepholes++;
+            changed = true;
+        }
+        else if (i.type == VM_IType::Push && index + 1 < code.size() && code[index + 1].type == VM_IType::Pop)
+        {
+            auto& next = code[index + 1];
+            if (i.arg1 == next.arg1)
+            {
+                code.erase(code.begin() + index, code.begin() + index + 2);
+                index--;
+            }
+            else
+            {
+                i = TInstruction<TValue>{ VM_IType::Mov, next.arg1, i.arg1 };
+                code.erase(code.begin() + index + 1);
+            }
+            stats.peepholes++;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+template <class TValue>
+bool ConstantFold(std::vector<TInstruction<TValue>>& code, VMOptimizeStats& stats)
+{
+    bool changed = false;
+    std::map<int, TValue> known;
+
+    auto valueOf = [&](const TValue& value) -> const TValue* {
+        if (!std::holds_alternative<VM_Reg>(value))
+        {
+            return &value;
+        }
+        auto itr = known.find(int(std::get<VM_Reg>(value)));
+        return itr == known.end() ? nullptr : &itr->second;
+    };
+
+    for (auto& i : code)
+    {
+        if (IsBarrier(i.type))
+        {
+            known.clear();
+            continue;
+        }
+
+        switch (i.type)
+        {
+        case VM_IType::Pop:
+            known.erase(int(std::get<VM_Reg>(i.arg1)));
+            break;
+        case VM_IType::Mov:
+        {
+            auto target = int(std::get<VM_Reg>(i.arg1));
+            auto pValue = valueOf(i.arg2);
+            if (!pValue)
+            {
+                known.erase(target);
+                break;
+            }
+            if (std::holds_alternative<VM_Reg>(i.arg2))
+            {
+                i.arg2 = *pValue;
+                stats.folded++;
+                changed = true;
+            }
+            known[target] = i.arg2;
+        }
+        break;
+        case VM_IType::Add:
+        {
+            auto target = int(std::get<VM_Reg>(i.arg1));
+            auto pValue = valueOf(i.arg2);
+            auto itrTarget = known.find(target);
+            if (!pValue)
+            {
+                known.erase(target);
+                break;
+            }
+
+            if (itrTarget == known.end())
+            {
+                // At least the operand is known
+                if (std::holds_alternative<VM_Reg>(i.arg2))
+                {
+                    i.arg2 = *pValue;
+                    stats.folded++;
+                    changed = true;
+                }
+                break;
+            }
+
+            try
+            {
+                auto result = VMProgram<TValue>::AddValues(itrTarget->second, *pValue);
+                i = TInstruction<TValue>{ VM_IType::Mov, i.arg1, result };
+                itrTarget->second = result;
+                stats.folded++;
+                changed = true;
+            }
+            catch (...)
+            {
+                // Leave it for the run to report
+                known.erase(itrTarget);
+            }
+        }
+        break;
+        default:
+            break;
+        }
+    }
+    return changed;
+}
+
+template <class TValue>
+bool DeadMoves(std::vector<TInstruction<TValue>>& code, VMOptimizeStats& stats)
+{
+    bool changed = false;
+    for (size_t index = 0; index < code.size(); index++)
+    {
+        if (code[index].type != VM_IType::Mov)
+        {
+            continue;
+        }
+
+        // Registers are visible after the run, so a move is only dead if it is overwritten
+        auto reg = int(std::get<VM_Reg>(code[index].arg1));
+        for (size_t next = index + 1; next < code.size(); next++)
+        {
+            auto& i = code[next];
+            if (IsBarrier(i.type) || ReadsReg<TValue>(i, reg))
+            {
+                break;
+            }
+            if ((i.type == VM_IType::Mov || i.type == VM_IType::Pop) && IsReg(i.arg1, reg))
+            {
+                code.erase(code.begin() + index--);
+                stats.deadMoves++;
+                changed = true;
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+template <class TValue>
+bool SuperInstructions(std::vector<TInstruction<TValue>>& code, VMOptimizeStats& stats)
+{
+    bool changed = false;
+    for (size_t index = 0; index + 1 < code.size(); index++)
+    {
+        auto& i = code[index];
+        auto& next = code[index + 1];
+        if (i.type == VM_IType::Push && next.type == VM_IType::Call && std::holds_alternative<int>(i.arg1) && std::get<int>(i.arg1) >= 0 && std::get<int>(i.arg1) <= 0xFFFF)
+        {
+            i = TInstruction<TValue>{ VM_IType::CallArgs, next.arg1, i.arg1 };
+            code.erase(code.begin() + index + 1);
+            stats.superInstructions++;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+} // namespace VMOptimizeDetail
+
+// Rewrite a function's instructions to do the same work in fewer steps.
+// The program needs linking again; a VM relinks on the next Run
+template <class TValue>
+VMOptimizeStats vm_optimize(VMProgram<TValue>& vm, typename VMProgram<TValue>::VFunction& fn, uint32_t flags = VMOptimizeFlags::All)
+{
+    using namespace VMOptimizeDetail;
+
+    VMOptimizeStats stats;
+    auto& code = fn.instructions;
+    stats.instructionsBefore = uint32_t(code.size());
+
+    // Each pass can expose work for the others
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        if (flags & VMOptimizeFlags::Peephole)
+        {
+            changed |= Peephole<TValue>(code, stats);
+        }
+        if (flags & VMOptimizeFlags::ConstantFold)
+        {
+            changed |= ConstantFold<TValue>(code, stats);
+        }
+        if (flags & VMOptimizeFlags::DeadMoves)
+        {
+            changed |= DeadMoves<TValue>(code, stats);
+        }
+    }
+
+    // Last, since the others don't look inside them
+    if (flags & VMOptimizeFlags::SuperInstructions)
+    {
+        SuperInstructions<TValue>(code, stats);
+    }
+
+    stats.instructionsAfter = uint32_t(code.size());
+    vm.m_linkDirty = true;
+    return stats;
+}
+
+// All functions in the VM
+template <class TValue>
+VMOptimizeStats vm_optimize(VMProgram<TValue>& vm, uint32_t flags = VMOptimizeFlags::All)
+{
+    VMOptimizeStats total;
+    for (auto& spFn : vm.m_functions)
+    {
+        if (spFn->pFnNative)
+        {
+            continue;
+        }
+        auto stats = vm_optimize(vm, *spFn, flags);
+        total.instructionsBefore += stats.instructionsBefore;
+        total.instructionsAfter += stats.instructionsAfter;
+        total.peepholes += stats.peepholes;
+        total.folded += stats.folded;
+        total.deadMoves += stats.deadMoves;
+        total.superInstructions += stats.superInstructions;
+    }
+    return total;
+}
+
+} // namespace MUtils
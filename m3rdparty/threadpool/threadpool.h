@@ -47,10 +47,12 @@ Original here: https://github.com/progschj/ThreadPool
 
 #include "mutils/time/profiler.h"
 #include <concurrentqueue/concurrentqueue.h>
+#include <mutils/thread/future.h>
+#include <mutils/thread/thread_config.h>
 #include <mutils/thread/thread_utils.h>
 
 // std::thread pool for resources recycling
-class TPool
+class TPool : public MUtils::IExecutor
 {
 public:
     // the constructor just launches some amount of workers
@@ -64,6 +66,7 @@ public:
             for (; threads_n; --threads_n)
                 this->workers.emplace_back(
                     [this] {
+                        MUtils::thread_configure(MUtils::ThreadConfig::Worker());
                         while (true)
                         {
                             std::function<void()> task;
@@ -78,7 +81,6 @@ public:
                                 this->tasks.pop();
                             }
 
-                            PROFILE_NAME_THREAD(worker);
                             task();
                         }
                     });
@@ -113,6 +115,27 @@ public:
         return res;
     }
 
+    // Like enqueue, but returns a MUtils::Future, which can take continuations instead of being polled
+    template <class F, class... Args>
+    MUtils::Future<std::invoke_result_t<F, Args...>> async(F&& f, Args&&... args)
+    {
+        using R = std::invoke_result_t<F, Args...>;
+        auto spPromise = std::make_shared<MUtils::Promise<R>>();
+        auto res = spPromise->get_future();
+        run([spPromise, fn = std::bind(std::forward<F>(f), std::forward<Args>(args)...)]() mutable {
+            spPromise->set_with(fn);
+        });
+        return res;
+    }
+
+    // IExecutor, so continuations can be sent to the pool
+    void Execute(MUtils::small_function<void()>&& fn) override
+    {
+        // The queue holds std::functions, which must be copyable
+        auto spFn = std::make_shared<MUtils::small_function<void()>>(std::move(fn));
+        run([spFn]() { (*spFn)(); });
+    }
+
     void StopAll()
     {
         this->stop = true;
@@ -128,6 +151,21 @@ public:
     }
 
 private:
+    template <class F>
+    void run(F&& f)
+    {
+        if (workers.empty())
+        {
+            f();
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            this->tasks.emplace(std::forward<F>(f));
+        }
+        this->condition.notify_one();
+    }
+
     // need to keep track of threads so we can join them
     std::vector<std::thread> workers;
     // the task queue
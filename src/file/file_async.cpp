@@ -0,0 +1,32 @@
+#include "mutils/file/file_async.h"
+#include "mutils/file/runtree.h"
+#include "mutils/time/profiler.h"
+
+namespace MUtils
+{
+
+Future<std::string> file_read_async(const fs::path& fileName, IExecutor& executor)
+{
+    return run_async(executor, [fileName]() {
+        PROFILE_SCOPE(file_read_async);
+        return file_read(fileName);
+    });
+}
+
+Future<std::string> runtree_load_asset_async(const fs::path& p, IExecutor& executor)
+{
+    return run_async(executor, [p]() {
+        PROFILE_SCOPE(runtree_load_asset_async);
+        return runtree_load_asset(p);
+    });
+}
+
+Future<toml::value> toml_read_async(const fs::path& path, IExecutor& executor)
+{
+    return run_async(executor, [path]() {
+        PROFILE_SCOPE(toml_read_async);
+        return toml_read(path);
+    });
+}
+
+} // namespace MUtils
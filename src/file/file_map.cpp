@@ -0,0 +1,115 @@
+#include "mutils/file/file_map.h"
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MUtils
+{
+
+#ifdef WIN32
+
+FileMapping::~FileMapping()
+{
+    if (m_pData)
+    {
+        UnmapViewOfFile(m_pData);
+    }
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+    }
+    if (m_hFile)
+    {
+        CloseHandle(m_hFile);
+    }
+}
+
+std::shared_ptr<const FileMapping> file_map(const fs::path& path)
+{
+    auto hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<FileMapping> spMapping(new FileMapping());
+    spMapping->m_hFile = hFile;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size))
+    {
+        return nullptr;
+    }
+    if (size.QuadPart == 0)
+    {
+        return spMapping;
+    }
+
+    spMapping->m_hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!spMapping->m_hMapping)
+    {
+        return nullptr;
+    }
+
+    spMapping->m_pData = (const uint8_t*)MapViewOfFile(spMapping->m_hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!spMapping->m_pData)
+    {
+        return nullptr;
+    }
+    spMapping->m_size = size_t(size.QuadPart);
+    return spMapping;
+}
+
+#else
+
+FileMapping::~FileMapping()
+{
+    if (m_pData)
+    {
+        munmap((void*)m_pData, m_size);
+    }
+}
+
+std::shared_ptr<const FileMapping> file_map(const fs::path& path)
+{
+    auto fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<FileMapping> spMapping(new FileMapping());
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    if (info.st_size > 0)
+    {
+        // The mapping keeps the file open
+        auto pData = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (pData == MAP_FAILED)
+        {
+            close(fd);
+            return nullptr;
+        }
+        spMapping->m_pData = (const uint8_t*)pData;
+        spMapping->m_size = size_t(info.st_size);
+    }
+    close(fd);
+    return spMapping;
+}
+
+#endif
+
+} // namespace MUtils
@@ -8,28 +8,41 @@ using namespace std;
 namespace MUtils
 {
 
-GLuint gl_load_texture(const fs::path& path)
+GLTextureImage gl_decode_texture(const fs::path& path)
+{
+    // stb keeps the flip in a global, and decodes run on pool threads; set it once, before the first decode
+    static const bool flipped = []() {
+        stbi_set_flip_vertically_on_load(true);
+        return true;
+    }();
+    (void)flipped;
+
+    GLTextureImage image;
+    auto pPixels = stbi_load(path.string().c_str(), &image.width, &image.height, &image.components, STBI_default);
+    if (pPixels != nullptr)
+    {
+        image.spPixels = std::shared_ptr<unsigned char>(pPixels, [](unsigned char* p) { stbi_image_free(p); });
+    }
+    return image;
+}
+
+GLuint gl_upload_texture(const GLTextureImage& image)
 {
     GLuint textureName = 0;
-    int w;
-    int h;
-    int comp;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* image = stbi_load(path.string().c_str(), &w, &h, &comp, STBI_default);
-
-    assert(image != nullptr);
-    if (image != nullptr)
+
+    assert(image.spPixels != nullptr);
+    if (image.spPixels != nullptr)
     {
         glGenTextures(1, &textureName);
         glBindTexture(GL_TEXTURE_2D, textureName);
 
-        if (comp == 3)
+        if (image.components == 3)
         {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.spPixels.get());
         }
-        else if (comp == 4)
+        else if (image.components == 4)
         {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.spPixels.get());
         }
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -39,10 +52,22 @@ GLuint gl_load_texture(const fs::path& path)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
         glBindTexture(GL_TEXTURE_2D, 0);
-
-        stbi_image_free(image);
     }
     return textureName;
 }
 
+GLuint gl_load_texture(const fs::path& path)
+{
+    return gl_upload_texture(gl_decode_texture(path));
+}
+
+Future<GLuint> gl_load_texture_async(const fs::path& path, IExecutor& io, IExecutor& gl)
+{
+    return run_async(io, [path]() {
+        return gl_decode_texture(path);
+    }).then(gl, [](GLTextureImage image) {
+        return gl_upload_texture(image);
+    });
+}
+
 } // namespace MUtils
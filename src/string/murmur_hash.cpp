@@ -1,5 +1,6 @@
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 
 #include <mutils/string/murmur_hash.h>
 
@@ -23,7 +24,8 @@ uint32_t murmur_hash(const void * key, int len, uint32_t seed)
 #ifdef PLATFORM_BIG_ENDIAN
         unsigned int k = (data[0]) + (data[1] << 8) + (data[2] << 16) + (data[3] << 24);
 #else
-        unsigned int k = *(unsigned int *)data;
+        unsigned int k;
+        memcpy(&k, data, sizeof(k));
 #endif
 
         k *= m;
@@ -119,7 +121,8 @@ uint64_t murmur_hash_64(const void * key, uint32_t len, uint64_t seed)
         c = p[2]; p[2] = p[5]; p[5] = c;
         c = p[3]; p[3] = p[4]; p[4] = c;
 #else
-        uint64_t k = *data++;
+        uint64_t k;
+        memcpy(&k, data++, sizeof(k));
 #endif
 
         k *= m;
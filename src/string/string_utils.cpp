@@ -1,19 +1,35 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <codecvt>
 #include <cstring>
 #include <iomanip>
 #include <locale>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
 #include <string>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MUTILS_STRING_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "mutils/string/string_utils.h"
 
 using namespace std;
 
 // StringUtils.
 // Note, simple, effective string utilities which concentrate on useful functinality and correctness and not on speed!
+// The exception is delimiter scanning, which is used to split large files; see StringDelims
 namespace MUtils
 {
 
@@ -105,7 +121,8 @@ uint32_t murmur_hash(const void* key, int len, uint32_t seed)
 #ifdef PLATFORM_BIG_ENDIAN
         unsigned int k = (data[0]) + (data[1] << 8) + (data[2] << 16) + (data[3] << 24);
 #else
-        unsigned int k = *(unsigned int*)data;
+        unsigned int k;
+        memcpy(&k, data, sizeof(k));
 #endif
 
         k *= m;
@@ -212,7 +229,8 @@ uint64_t murmur_hash_64(const void* key, uint32_t len, uint64_t seed)
         p[3] = p[4];
         p[4] = c;
 #else
-        uint64_t k = *data++;
+        uint64_t k;
+        memcpy(&k, data++, sizeof(k));
 #endif
 
         k *= m;
@@ -272,30 +290,41 @@ std::vector<std::string> string_split(const std::string& text, const char* delim
 }
 
 // String split with multiple delims
-// https://stackoverflow.com/a/7408245/18942
 void string_split(const std::string& text, const char* delims, std::vector<std::string>& tokens)
 {
     tokens.clear();
-    std::size_t start = text.find_first_not_of(delims), end = 0;
+    for (auto token : string_split_range(text, delims))
+    {
+        tokens.emplace_back(token);
+    }
+}
 
-    while ((end = text.find_first_of(delims, start)) != std::string::npos)
+void string_split(std::string_view text, const StringDelims& delims, std::vector<std::string_view>& tokens)
+{
+    tokens.clear();
+    for (auto token : string_split_range(text, delims))
     {
-        tokens.push_back(text.substr(start, end - start));
-        start = text.find_first_not_of(delims, end);
+        tokens.push_back(token);
     }
-    if (start != std::string::npos)
-        tokens.push_back(text.substr(start));
+}
+
+std::vector<std::string_view> string_split_view(std::string_view text, const StringDelims& delims)
+{
+    std::vector<std::string_view> tokens;
+    string_split(text, delims, tokens);
+    return tokens;
 }
 
 void string_split_each(const std::string& text, const char* delims, std::function<bool(size_t, size_t)> fn)
 {
-    std::size_t start = text.find_first_not_of(delims), end = 0;
+    StringDelims delimSet(delims);
+    std::size_t start = string_first_not_of(text, 0, delimSet), end = 0;
 
-    while ((end = text.find_first_of(delims, start)) != std::string::npos)
+    while (start != std::string::npos && (end = string_first_of(text, start, delimSet)) != std::string::npos)
     {
         if (!fn(start, end - start))
             return;
-        start = text.find_first_not_of(delims, end);
+        start = string_first_not_of(text, end, delimSet);
     }
     if (start != std::string::npos)
         fn(start, text.length() - start);
@@ -316,50 +345,145 @@ std::vector<std::string> string_split_delim_string(const std::string& str, const
     return ret;
 }
 
-size_t string_first_not_of(const char* text, size_t start, size_t end, const char* delims)
+StringDelims::StringDelims(const char* delims)
 {
-    for (auto index = start; index < end; index++)
+    for (auto pDelim = delims; *pDelim != 0; pDelim++)
     {
-        bool found = false;
-        auto pDelim = delims;
-        while (*pDelim != 0)
+        if (Contains(*pDelim))
         {
-            if (text[index] == *pDelim++)
-            {
-                found = true;
-                break;
-            }
+            continue;
         }
-        if (!found)
-            return index;
+        auto index = uint8_t(*pDelim);
+        bits[index >> 6] |= uint64_t(1) << (index & 63);
+        if (charCount < MaxVectorChars)
+        {
+            chars[charCount] = *pDelim;
+        }
+        charCount++;
     }
-    return std::string::npos;
 }
 
-size_t string_first_of(const char* text, size_t start, size_t end, const char* delims)
+namespace
+{
+
+inline uint32_t count_trailing_zeros(uint32_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return uint32_t(index);
+#else
+    return uint32_t(__builtin_ctz(value));
+#endif
+}
+
+// Finds the first character in [start, end) which is (or with Match false, isn't) a delimiter.
+// Blocks of characters are compared against each delimiter at once; the tail uses the bitmap
+template <bool Match>
+size_t string_scan(const char* text, size_t start, size_t end, const StringDelims& delims)
 {
-    for (auto index = start; index < end; index++)
+    if (start >= end)
     {
-        auto pDelim = delims;
-        while (*pDelim != 0)
+        return std::string::npos;
+    }
+
+    auto index = start;
+    if (delims.charCount <= StringDelims::MaxVectorChars)
+    {
+#ifdef __AVX2__
+        __m256i delims32[StringDelims::MaxVectorChars];
+        for (uint32_t d = 0; d < delims.charCount; d++)
         {
-            if (text[index] == *pDelim++)
+            delims32[d] = _mm256_set1_epi8(delims.chars[d]);
+        }
+        for (; end - index >= 32; index += 32)
+        {
+            auto block = _mm256_loadu_si256((const __m256i*)(text + index));
+            auto found = _mm256_setzero_si256();
+            for (uint32_t d = 0; d < delims.charCount; d++)
             {
-                return index;
+                found = _mm256_or_si256(found, _mm256_cmpeq_epi8(block, delims32[d]));
             }
+            auto mask = uint32_t(_mm256_movemask_epi8(found));
+            if (!Match)
+            {
+                mask = ~mask;
+            }
+            if (mask)
+            {
+                return index + count_trailing_zeros(mask);
+            }
+        }
+#endif
+#ifdef MUTILS_STRING_SSE2
+        __m128i delims16[StringDelims::MaxVectorChars];
+        for (uint32_t d = 0; d < delims.charCount; d++)
+        {
+            delims16[d] = _mm_set1_epi8(delims.chars[d]);
+        }
+        for (; end - index >= 16; index += 16)
+        {
+            auto block = _mm_loadu_si128((const __m128i*)(text + index));
+            auto found = _mm_setzero_si128();
+            for (uint32_t d = 0; d < delims.charCount; d++)
+            {
+                found = _mm_or_si128(found, _mm_cmpeq_epi8(block, delims16[d]));
+            }
+            auto mask = uint32_t(_mm_movemask_epi8(found));
+            if (!Match)
+            {
+                mask = ~mask & 0xFFFF;
+            }
+            if (mask)
+            {
+                return index + count_trailing_zeros(mask);
+            }
+        }
+#endif
+    }
+
+    for (; index < end; index++)
+    {
+        if (delims.Contains(text[index]) == Match)
+        {
+            return index;
         }
     }
     return std::string::npos;
 }
 
+} // namespace
+
+size_t string_first_of(std::string_view text, size_t start, const StringDelims& delims)
+{
+    return string_scan<true>(text.data(), start, text.size(), delims);
+}
+
+size_t string_first_not_of(std::string_view text, size_t start, const StringDelims& delims)
+{
+    return string_scan<false>(text.data(), start, text.size(), delims);
+}
+
+size_t string_first_not_of(const char* text, size_t start, size_t end, const char* delims)
+{
+    return string_scan<false>(text, start, end, StringDelims(delims));
+}
+
+size_t string_first_of(const char* text, size_t start, size_t end, const char* delims)
+{
+    return string_scan<true>(text, start, end, StringDelims(delims));
+}
+
 void string_split_each(char* text, size_t startIndex, size_t endIndex, const char* delims, std::function<bool(size_t, size_t)> fn)
 {
+    StringDelims delimSet(delims);
+
     // Skip delims (start now at first thing that is not a delim)
-    std::size_t start = string_first_not_of(text, startIndex, endIndex, delims);
+    std::size_t start = string_scan<false>(text, startIndex, endIndex, delimSet);
     std::size_t end;
 
     // Find first delim (end now at first delim)
-    while ((end = string_first_of(text, start, endIndex, delims)) != std::string::npos)
+    while ((end = string_scan<true>(text, start, endIndex, delimSet)) != std::string::npos)
     {
         // Callback with string between delims
         if (!fn(start, end))
@@ -369,7 +493,7 @@ void string_split_each(char* text, size_t startIndex, size_t endIndex, const cha
             end++;
 
         // Find the first non-delim
-        start = string_first_not_of(text, end, endIndex, delims);
+        start = string_scan<false>(text, end, endIndex, delimSet);
     }
     // Return the last one
     if (start != std::string::npos)
@@ -440,29 +564,281 @@ std::vector<std::string> string_split_lines(const std::string& text)
     return split;
 }
 
+namespace
+{
+
+// Entries and their strings are allocated together from the arena, and never move or go away
+struct StringIdEntry
+{
+    uint32_t id;
+    uint32_t size;
+    const char* pData;
+};
+
+// Open addressed; ids are already well mixed hashes, so they index slots directly
+struct StringIdSlots
+{
+    explicit StringIdSlots(uint32_t capacity)
+        : capacity(capacity),
+        slots(new std::atomic<const StringIdEntry*>[capacity])
+    {
+        for (uint32_t index = 0; index < capacity; index++)
+        {
+            slots[index].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    const uint32_t capacity;
+    std::unique_ptr<std::atomic<const StringIdEntry*>[]> slots;
+};
+
+class StringIdTable
+{
+public:
+    static constexpr uint32_t InitialCapacity = 4096;
+    static constexpr size_t ArenaBlockSize = 64 * 1024;
+
+    StringIdTable()
+    {
+        m_tables.push_back(std::make_unique<StringIdSlots>(InitialCapacity));
+        m_pSlots.store(m_tables.back().get(), std::memory_order_release);
+    }
+
+    // Lock free; the writer only ever fills empty slots, and publishes bigger tables whole
+    const StringIdEntry* Find(uint32_t id) const
+    {
+        return Find(*m_pSlots.load(std::memory_order_acquire), id);
+    }
+
+    bool Intern(uint32_t id, std::string_view str)
+    {
+        auto pEntry = Find(id);
+        if (!pEntry)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // Another thread may have got here first
+            pEntry = Find(id);
+            if (!pEntry)
+            {
+                Insert(id, str);
+                return true;
+            }
+        }
+
+        if (std::string_view(pEntry->pData, pEntry->size) == str)
+        {
+            return true;
+        }
+
+        m_collisions.fetch_add(1, std::memory_order_relaxed);
+        StringIdCollisionFn fn;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            fn = m_collisionFn;
+        }
+        if (fn)
+        {
+            fn(id, std::string_view(pEntry->pData, pEntry->size), str);
+        }
+        else
+        {
+            assert(!"StringId hash collision");
+        }
+        return false;
+    }
+
+    void SetCollisionHandler(StringIdCollisionFn fn)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_collisionFn = fn;
+    }
+
+    uint32_t CollisionCount() const
+    {
+        return m_collisions.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const StringIdEntry* Find(const StringIdSlots& table, uint32_t id)
+    {
+        auto mask = table.capacity - 1;
+        for (auto slot = id & mask;; slot = (slot + 1) & mask)
+        {
+            auto pEntry = table.slots[slot].load(std::memory_order_acquire);
+            if (!pEntry || pEntry->id == id)
+            {
+                return pEntry;
+            }
+        }
+    }
+
+    static void Place(StringIdSlots& table, const StringIdEntry* pEntry)
+    {
+        auto mask = table.capacity - 1;
+        auto slot = pEntry->id & mask;
+        while (table.slots[slot].load(std::memory_order_relaxed))
+        {
+            slot = (slot + 1) & mask;
+        }
+        table.slots[slot].store(pEntry, std::memory_order_release);
+    }
+
+    // Under the mutex
+    void Insert(uint32_t id, std::string_view str)
+    {
+        auto pEntry = Allocate(id, str);
+
+        // Keep the load under a half, so probes stay short; old tables are kept since readers may still be in them
+        auto pSlots = m_pSlots.load(std::memory_order_relaxed);
+        if ((m_count + 1) * 2 > pSlots->capacity)
+        {
+            auto spBigger = std::make_unique<StringIdSlots>(pSlots->capacity * 2);
+            for (uint32_t index = 0; index < pSlots->capacity; index++)
+            {
+                if (auto pOld = pSlots->slots[index].load(std::memory_order_relaxed))
+                {
+                    Place(*spBigger, pOld);
+                }
+            }
+            pSlots = spBigger.get();
+            m_tables.push_back(std::move(spBigger));
+            m_pSlots.store(pSlots, std::memory_order_release);
+        }
+
+        Place(*pSlots, pEntry);
+        m_count++;
+    }
+
+    const StringIdEntry* Allocate(uint32_t id, std::string_view str)
+    {
+        auto size = (sizeof(StringIdEntry) + str.size() + 1 + alignof(StringIdEntry) - 1) & ~(alignof(StringIdEntry) - 1);
+        if (m_arenaUsed + size > m_arenaSize)
+        {
+            m_arenaSize = std::max(ArenaBlockSize, size);
+            m_arena.push_back(std::make_unique<char[]>(m_arenaSize));
+            m_arenaUsed = 0;
+        }
+
+        auto pMemory = m_arena.back().get() + m_arenaUsed;
+        m_arenaUsed += size;
+
+        auto pData = pMemory + sizeof(StringIdEntry);
+        memcpy(pData, str.data(), str.size());
+        pData[str.size()] = 0;
+        return new (pMemory) StringIdEntry{ id, uint32_t(str.size()), pData };
+    }
+
+    std::atomic<StringIdSlots*> m_pSlots;
+    std::atomic<uint32_t> m_collisions{ 0 };
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<StringIdSlots>> m_tables;
+    std::vector<std::unique_ptr<char[]>> m_arena;
+    size_t m_arenaUsed = 0;
+    size_t m_arenaSize = 0;
+    uint32_t m_count = 0;
+    StringIdCollisionFn m_collisionFn;
+};
+
+// Built on first use, so StringIds made during static init (theme colours) are safe
+StringIdTable& string_id_table()
+{
+    static StringIdTable table;
+    return table;
+}
+
+} // namespace
+
+bool string_id_intern(uint32_t id, std::string_view str)
+{
+    return string_id_table().Intern(id, str);
+}
+
+std::string_view string_id_lookup(uint32_t id)
+{
+    auto pEntry = string_id_table().Find(id);
+    return pEntry ? std::string_view(pEntry->pData, pEntry->size) : std::string_view();
+}
+
+void string_id_set_collision_handler(StringIdCollisionFn fn)
+{
+    string_id_table().SetCollisionHandler(fn);
+}
+
+uint32_t string_id_collision_count()
+{
+    return string_id_table().CollisionCount();
+}
+
+namespace
+{
+// Constant initialised, so names can be deferred during static init
+std::atomic<const StringIdDeferredName*> g_deferredNames{ nullptr };
+std::mutex g_deferredMutex;
+} // namespace
+
+StringIdDeferredName::StringIdDeferredName(const char* pszName)
+    : pszName(pszName)
+{
+    auto pHead = g_deferredNames.load(std::memory_order_relaxed);
+    do
+    {
+        pNext = pHead;
+    } while (!g_deferredNames.compare_exchange_weak(pHead, this, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool string_id_resolve_deferred()
+{
+    if (!g_deferredNames.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    // The names stay on the list until they are all interned, so another thread that misses waits here for them
+    std::lock_guard<std::mutex> lock(g_deferredMutex);
+    auto pHead = g_deferredNames.load(std::memory_order_acquire);
+    while (pHead)
+    {
+        for (auto pName = pHead; pName; pName = pName->pNext)
+        {
+            string_id_intern(string_id_hash(pName->pszName), pName->pszName);
+        }
+
+        // Names deferred meanwhile are in front of the old head; go round again (interning again is cheap)
+        if (g_deferredNames.compare_exchange_strong(pHead, nullptr, std::memory_order_acq_rel))
+        {
+            break;
+        }
+    }
+    return true;
+}
+
 StringId::StringId(const char* pszString)
 {
-    id = murmur_hash(pszString, (int)strlen(pszString), 0);
-    LookupInstance()[id] = pszString;
+    auto size = strlen(pszString);
+    id = murmur_hash(pszString, (int)size, 0);
+    string_id_intern(id, std::string_view(pszString, size));
 }
 
 StringId::StringId(const std::string& str)
 {
     id = murmur_hash(str.c_str(), (int)str.length(), 0);
-    LookupInstance()[id] = str;
+    string_id_intern(id, str);
 }
 
 const StringId& StringId::operator=(const char* pszString)
 {
-    id = murmur_hash(pszString, (int)strlen(pszString), 0);
-    LookupInstance()[id] = pszString;
+    auto size = strlen(pszString);
+    id = murmur_hash(pszString, (int)size, 0);
+    string_id_intern(id, std::string_view(pszString, size));
     return *this;
 }
 
 const StringId& StringId::operator=(const std::string& str)
 {
     id = murmur_hash(str.c_str(), (int)str.length(), 0);
-    LookupInstance()[id] = str;
+    string_id_intern(id, str);
     return *this;
 }
 
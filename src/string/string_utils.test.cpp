@@ -0,0 +1,243 @@
+#include <catch.hpp>
+
+#include <random>
+#include <thread>
+
+#include "mutils/string/string_utils.h"
+
+using namespace MUtils;
+
+namespace MUtils
+{
+unsigned int murmur_hash_inverse(unsigned int h, unsigned int seed);
+}
+
+namespace
+{
+
+// The straightforward versions, to check the vectorised scans against
+std::vector<std::string> reference_split(const std::string& text, const char* delims)
+{
+    std::vector<std::string> tokens;
+    std::size_t start = text.find_first_not_of(delims), end = 0;
+    while ((end = text.find_first_of(delims, start)) != std::string::npos)
+    {
+        tokens.push_back(text.substr(start, end - start));
+        start = text.find_first_not_of(delims, end);
+    }
+    if (start != std::string::npos)
+        tokens.push_back(text.substr(start));
+    return tokens;
+}
+
+std::string random_text(std::mt19937& rand, size_t length)
+{
+    const char chars[] = "abc ,;\t\n\r-_xyz019";
+    std::string text;
+    for (size_t index = 0; index < length; index++)
+    {
+        text += chars[rand() % (sizeof(chars) - 1)];
+    }
+    return text;
+}
+
+} // namespace
+
+TEST_CASE("StringSplit", "StringUtils")
+{
+    REQUIRE(string_split("a, b,,c ", ", ") == std::vector<std::string>{ "a", "b", "c" });
+    REQUIRE(string_split("", ", ").empty());
+    REQUIRE(string_split(",,,", ",").empty());
+    REQUIRE(string_split("abc", "") == std::vector<std::string>{ "abc" });
+    REQUIRE(string_split_lines("one\r\ntwo\n\nthree") == std::vector<std::string>{ "one", "two", "three" });
+
+    std::string text = "  the quick  brown fox ";
+    auto views = string_split_view(text, " ");
+    REQUIRE(views == std::vector<std::string_view>{ "the", "quick", "brown", "fox" });
+    REQUIRE(views[0].data() == text.data() + 2);
+
+    std::vector<std::string_view> lazy;
+    for (auto token : string_split_range(text, " "))
+    {
+        lazy.push_back(token);
+    }
+    REQUIRE(lazy == views);
+
+    // Stops early without scanning the rest
+    auto range = string_split_range(text, " ");
+    REQUIRE(*range.begin() == "the");
+    REQUIRE(*++range.begin() == "quick");
+}
+
+TEST_CASE("StringSplitMatchesReference", "StringUtils")
+{
+    std::mt19937 rand(42);
+
+    // Small sets take the vector path, large ones the bitmap
+    const char* delimSets[] = { ",", " \t", "\r\n", " ,;\t\n\r-_", " ,;\t\n\r-_xyz" };
+    for (auto delims : delimSets)
+    {
+        for (size_t length = 0; length < 200; length += 7)
+        {
+            auto text = random_text(rand, length);
+            INFO("Text: '" << text << "' Delims: '" << delims << "'");
+            REQUIRE(string_split(text, delims) == reference_split(text, delims));
+
+            // Every start, to cover unaligned blocks and the tails
+            for (size_t start = 0; start <= length; start++)
+            {
+                REQUIRE(string_first_of(text, start, delims) == text.find_first_of(delims, start));
+                REQUIRE(string_first_not_of(text, start, delims) == text.find_first_not_of(delims, start));
+                REQUIRE(string_first_of(text.c_str(), start, length, delims) == text.find_first_of(delims, start));
+            }
+
+            std::vector<std::pair<size_t, size_t>> each;
+            string_split_each(text, delims, [&](size_t start, size_t count) {
+                each.emplace_back(start, count);
+                return true;
+            });
+            auto tokens = reference_split(text, delims);
+            REQUIRE(each.size() == tokens.size());
+            for (size_t index = 0; index < each.size(); index++)
+            {
+                REQUIRE(text.substr(each[index].first, each[index].second) == tokens[index]);
+            }
+        }
+    }
+}
+
+TEST_CASE("StringId", "StringUtils")
+{
+    StringId id("theme_background");
+    REQUIRE(id.ToString() == "theme_background");
+    REQUIRE(StringId(std::string("theme_background")) == id);
+    REQUIRE(StringId(uint32_t(12345)).ToString() == "murmur:12345");
+
+    // Any number of threads can make ids and look them up; each name is stored once
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; thread++)
+    {
+        threads.emplace_back([thread]() {
+            for (int index = 0; index < 5000; index++)
+            {
+                auto name = "name_" + std::to_string(index % 1000) + (index % 2 ? "_" + std::to_string(thread) : std::string());
+                StringId id(name);
+                if (id.ToString() != name)
+                {
+                    throw std::runtime_error("Bad lookup");
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    REQUIRE(StringId("name_999_3").ToString() == "name_999_3");
+}
+
+TEST_CASE("StringIdCollision", "StringUtils")
+{
+    // murmur_hash_inverse finds the 4 byte key with a given hash
+    StringId id("collides");
+    auto key = murmur_hash_inverse(id.id, 0);
+    auto other = std::string((const char*)&key, 4);
+
+    std::string reported;
+    string_id_set_collision_handler([&](uint32_t, std::string_view existing, std::string_view incoming) {
+        reported = std::string(existing) + "/" + std::string(incoming);
+    });
+
+    auto before = string_id_collision_count();
+    StringId clash(other);
+    string_id_set_collision_handler(nullptr);
+
+    REQUIRE(clash == id);
+    REQUIRE(string_id_collision_count() == before + 1);
+    REQUIRE(reported == "collides/" + other);
+
+    // The first string keeps the id
+    REQUIRE(clash.ToString() == "collides");
+}
+
+TEST_CASE("StringIdConstexpr", "StringUtils")
+{
+    // The compile time hash must match the run time one, for every tail length
+    std::string text = "abcdefghijklmnopqrstuvwxyz\x80\xff";
+    for (size_t length = 0; length <= text.size(); length++)
+    {
+        REQUIRE(string_id_hash(std::string_view(text.data(), length)) == murmur_hash(text.data(), int(length), 0));
+    }
+
+    constexpr auto id = "Background"_sid;
+    static_assert(id == StringId(string_id_hash("Background")), "Compile time ids");
+    REQUIRE(id == StringId("Background"));
+
+    // Not interned until a ToString asks for it
+    auto deferred = MUTILS_SID("only_ever_deferred");
+    REQUIRE(deferred == StringId(string_id_hash("only_ever_deferred")));
+    REQUIRE(string_id_lookup(deferred.id).data() == nullptr);
+    REQUIRE(deferred.ToString() == "only_ever_deferred");
+    REQUIRE(string_id_lookup(deferred.id) == "only_ever_deferred");
+}
+
+TEST_CASE("StringSplit.Benchmark", "[StringUtils][!benchmark]")
+{
+    // A few MB of log like text
+    std::mt19937 rand(42);
+    std::string text;
+    while (text.size() < 4 * 1024 * 1024)
+    {
+        text += "[info] " + std::string(rand() % 40 + 20, 'a' + char(rand() % 26)) + ", value " + std::to_string(rand()) + "\n";
+    }
+
+    BENCHMARK("Reference strings")
+    {
+        return reference_split(text, "\r\n").size();
+    };
+
+    BENCHMARK("Strings")
+    {
+        return string_split(text, "\r\n").size();
+    };
+
+    BENCHMARK("Views")
+    {
+        return string_split_view(text, "\r\n").size();
+    };
+
+    BENCHMARK("Lazy")
+    {
+        size_t count = 0;
+        for (auto token : string_split_range(text, "\r\n"))
+        {
+            count += token.size();
+        }
+        return count;
+    };
+
+    BENCHMARK("Many delimiters")
+    {
+        return string_split_view(text, " \t\r\n,;:[]()").size();
+    };
+}
+
+TEST_CASE("StringId.Benchmark", "[StringUtils][!benchmark]")
+{
+    StringId id("color_background");
+
+    BENCHMARK("Existing id")
+    {
+        return StringId("color_background").id;
+    };
+
+    BENCHMARK("Lookup")
+    {
+        return string_id_lookup(id.id).size();
+    };
+
+    BENCHMARK("Literal")
+    {
+        return MUTILS_SID("color_background").id;
+    };
+}
@@ -0,0 +1,202 @@
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#include <mutils/string/wyhash.h>
+
+// wyhash, by Wang Yi; public domain (The Unlicense).  https://github.com/wangyi-fudan/wyhash
+namespace
+{
+
+const uint64_t Secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+// 64x64 -> 128 bit multiply; low half in a, high in b
+inline void wymum(uint64_t* a, uint64_t* b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = uint64_t(r);
+    *b = uint64_t(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = uint32_t(*a), lb = uint32_t(*b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+// Little endian reads, which the compiler turns into plain loads
+inline uint64_t wyr8(const uint8_t* p)
+{
+#ifdef PLATFORM_BIG_ENDIAN
+    return uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) | (uint64_t(p[3]) << 24) | (uint64_t(p[4]) << 32) | (uint64_t(p[5]) << 40) | (uint64_t(p[6]) << 48) | (uint64_t(p[7]) << 56);
+#else
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+#endif
+}
+
+inline uint64_t wyr4(const uint8_t* p)
+{
+#ifdef PLATFORM_BIG_ENDIAN
+    return uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) | (uint64_t(p[3]) << 24);
+#else
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+#endif
+}
+
+inline uint64_t wyr3(const uint8_t* p, size_t k)
+{
+    return (uint64_t(p[0]) << 16) | (uint64_t(p[k >> 1]) << 8) | p[k - 1];
+}
+
+inline uint64_t wyseed(uint64_t seed)
+{
+    return seed ^ wymix(seed ^ Secret[0], Secret[1]);
+}
+
+// The last 1..48 bytes at p; for inputs over 16 bytes, p - 16 must be readable
+inline uint64_t wyfinish(const uint8_t* p, size_t i, size_t len, uint64_t seed)
+{
+    uint64_t a, b;
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = wyr3(p, len);
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        while (i > 16)
+        {
+            seed = wymix(wyr8(p) ^ Secret[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= Secret[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ Secret[0] ^ len, b ^ Secret[1]);
+}
+
+} // namespace
+
+uint64_t wyhash(const void* key, size_t len, uint64_t seed)
+{
+    auto p = (const uint8_t*)key;
+    seed = wyseed(seed);
+
+    // Three independent chains, so the multiplies overlap
+    size_t i = len;
+    if (i > 48)
+    {
+        uint64_t see1 = seed, see2 = seed;
+        do
+        {
+            seed = wymix(wyr8(p) ^ Secret[1], wyr8(p + 8) ^ seed);
+            see1 = wymix(wyr8(p + 16) ^ Secret[2], wyr8(p + 24) ^ see1);
+            see2 = wymix(wyr8(p + 32) ^ Secret[3], wyr8(p + 40) ^ see2);
+            p += 48;
+            i -= 48;
+        } while (i > 48);
+        seed ^= see1 ^ see2;
+    }
+    return wyfinish(p, i, len, seed);
+}
+
+WyHashStream::WyHashStream(uint64_t seed)
+    : m_originalSeed(seed)
+{
+    m_seed = m_see1 = m_see2 = wyseed(seed);
+}
+
+void WyHashStream::Block(const uint8_t* p)
+{
+    m_seed = wymix(wyr8(p) ^ Secret[1], wyr8(p + 8) ^ m_seed);
+    m_see1 = wymix(wyr8(p + 16) ^ Secret[2], wyr8(p + 24) ^ m_see1);
+    m_see2 = wymix(wyr8(p + 32) ^ Secret[3], wyr8(p + 40) ^ m_see2);
+}
+
+void WyHashStream::Update(const void* data, size_t len)
+{
+    auto p = (const uint8_t*)data;
+    m_length += len;
+
+    // wyhash only takes a block when more bytes follow it, so up to a whole block stays buffered
+    if (m_bufferSize + len <= BlockSize)
+    {
+        memcpy(m_buffer + TailSize + m_bufferSize, p, len);
+        m_bufferSize += len;
+        return;
+    }
+
+    const uint8_t* pLast = nullptr;
+    if (m_bufferSize > 0)
+    {
+        auto fill = BlockSize - m_bufferSize;
+        memcpy(m_buffer + TailSize + m_bufferSize, p, fill);
+        p += fill;
+        len -= fill;
+        Block(m_buffer + TailSize);
+        memcpy(m_buffer, m_buffer + TailSize + BlockSize - TailSize, TailSize);
+        m_bufferSize = 0;
+    }
+
+    // Straight from the caller's memory
+    while (len > BlockSize)
+    {
+        Block(p);
+        pLast = p;
+        p += BlockSize;
+        len -= BlockSize;
+    }
+    if (pLast)
+    {
+        memcpy(m_buffer, pLast + BlockSize - TailSize, TailSize);
+    }
+
+    memcpy(m_buffer + TailSize, p, len);
+    m_bufferSize = len;
+}
+
+uint64_t WyHashStream::Final() const
+{
+    auto len = size_t(m_length);
+    if (len <= BlockSize)
+    {
+        return wyhash(m_buffer + TailSize, len, m_originalSeed);
+    }
+    return wyfinish(m_buffer + TailSize, m_bufferSize, len, m_seed ^ m_see1 ^ m_see2);
+}
@@ -0,0 +1,107 @@
+#include <catch.hpp>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mutils/string/murmur_hash.h"
+#include "mutils/string/wyhash.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define MUTILS_HAVE_RDTSC
+#endif
+
+TEST_CASE("WyHash", "StringUtils")
+{
+    // The reference implementation's test vectors
+    REQUIRE(wyhash("", 0, 0) == 0x93228a4de0eec5a2ull);
+    REQUIRE(wyhash("a", 1, 1) == 0xc5bac3db178713c4ull);
+    REQUIRE(wyhash("abc", 3, 2) == 0xa97f2f7b1d9b3314ull);
+    REQUIRE(wyhash("message digest", 14, 3) == 0x786d1f1df3801df4ull);
+    REQUIRE(wyhash("abcdefghijklmnopqrstuvwxyz", 26, 4) == 0xdca5a8138ad37c87ull);
+    REQUIRE(wyhash("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 62, 5) == 0xb9e734f117cfaf70ull);
+    REQUIRE(wyhash("12345678901234567890123456789012345678901234567890123456789012345678901234567890", 80, 6) == 0x6cc5eab49a92d617ull);
+}
+
+TEST_CASE("WyHashStream", "StringUtils")
+{
+    std::mt19937 rand(42);
+    std::vector<uint8_t> data(1000);
+    for (auto& byte : data)
+    {
+        byte = uint8_t(rand());
+    }
+
+    // Every length around the block sizes, split at every point, and in small pieces
+    for (size_t len : { 0, 1, 3, 4, 15, 16, 17, 47, 48, 49, 63, 64, 65, 96, 97, 144, 145, 1000 })
+    {
+        auto expected = wyhash(data.data(), len, 7);
+        for (size_t split = 0; split <= len; split++)
+        {
+            WyHashStream stream(7);
+            stream.Update(data.data(), split);
+            stream.Update(data.data() + split, len - split);
+            REQUIRE(stream.Final() == expected);
+        }
+
+        WyHashStream pieces(7);
+        for (size_t index = 0; index < len;)
+        {
+            auto size = std::min(len - index, size_t(rand() % 20));
+            pieces.Update(data.data() + index, size);
+            index += size;
+        }
+        REQUIRE(pieces.Final() == expected);
+    }
+}
+
+TEST_CASE("Hash.Benchmark", "[StringUtils][!benchmark]")
+{
+    std::vector<uint8_t> data(1024 * 1024);
+    std::mt19937 rand(42);
+    for (auto& byte : data)
+    {
+        byte = uint8_t(rand());
+    }
+
+    // Bytes per cycle, for comparing the hashes across key sizes
+    auto measure = [&](const char* pszName, size_t size, auto&& fn) {
+        auto repeats = std::max(size_t(1), (64 * 1024 * 1024) / size);
+        uint64_t sink = 0;
+#ifdef MUTILS_HAVE_RDTSC
+        auto start = __rdtsc();
+        for (size_t repeat = 0; repeat < repeats; repeat++)
+        {
+            sink += fn(data.data() + (repeat & 63), size);
+        }
+        auto cycles = double(__rdtsc() - start);
+        WARN(pszName << " " << size << " bytes: " << (double(size) * repeats) / cycles << " bytes/cycle (" << (sink & 1) << ")");
+#else
+        auto start = std::chrono::steady_clock::now();
+        for (size_t repeat = 0; repeat < repeats; repeat++)
+        {
+            sink += fn(data.data() + (repeat & 63), size);
+        }
+        auto ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        WARN(pszName << " " << size << " bytes: " << (double(size) * repeats) / ns << " bytes/ns (" << (sink & 1) << ")");
+#endif
+    };
+
+    for (size_t size : { 8, 16, 64, 256, 4096, 1024 * 1024 - 64 })
+    {
+        measure("murmur_hash", size, [](const void* p, size_t len) { return uint64_t(murmur_hash(p, int(len), 0)); });
+        measure("murmur_hash_64", size, [](const void* p, size_t len) { return murmur_hash_64(p, uint32_t(len), 0); });
+        measure("wyhash", size, [](const void* p, size_t len) { return wyhash(p, len, 0); });
+        measure("WyHashStream", size, [](const void* p, size_t len) {
+            WyHashStream stream;
+            stream.Update(p, len);
+            return stream.Final();
+        });
+    }
+}
@@ -0,0 +1,85 @@
+#include <catch2/catch_all.hpp>
+
+#include <fstream>
+
+#include "mutils/file/file_async.h"
+#include "mutils/thread/coroutine.h"
+
+using namespace MUtils;
+
+TEST_CASE("Async.FileRead", "[Async]")
+{
+    WorkStealingPool pool(2);
+    QueueExecutor mainThread;
+
+    auto path = fs::temp_directory_path() / "mutils_async_test.txt";
+    {
+        std::ofstream out(path);
+        out << "Hello";
+    }
+
+    // Read on the pool, finish on the 'main' thread
+    std::string loaded;
+    auto done = file_read_async(path, pool).then(mainThread, [&](std::string text) {
+        loaded = text;
+    });
+
+    while (!done.is_ready())
+    {
+        mainThread.RunPending();
+    }
+    REQUIRE(loaded == "Hello");
+    fs::remove(path);
+}
+
+// Built as C++20 by the coroutinetests target; unittests is C++17 and skips these
+#ifdef MUTILS_COROUTINES
+
+namespace
+{
+task<int> add_on(IExecutor& executor, int a, int b)
+{
+    co_await resume_on(executor);
+    co_return a + b;
+}
+
+task<std::string> load_both(WorkStealingPool& pool, QueueExecutor& mainThread, std::thread::id& finishedOn)
+{
+    // Both start before either is awaited, so they run at the same time
+    auto first = add_on(pool, 1, 2);
+    auto second = pool.async([]() { return std::string("x"); });
+
+    auto a = co_await first;
+    auto b = co_await std::move(second);
+
+    co_await resume_on(mainThread);
+    finishedOn = std::this_thread::get_id();
+    co_return b + std::to_string(a);
+}
+
+task<> fail()
+{
+    throw std::runtime_error("Fail");
+    co_return;
+}
+} // namespace
+
+TEST_CASE("Coroutine.Task", "[Coroutine]")
+{
+    WorkStealingPool pool(2);
+    QueueExecutor mainThread;
+
+    std::thread::id finishedOn;
+    auto result = load_both(pool, mainThread, finishedOn).future();
+    while (!result.is_ready())
+    {
+        mainThread.RunPending();
+    }
+
+    REQUIRE(result.get() == "x3");
+    REQUIRE(finishedOn == std::this_thread::get_id());
+
+    REQUIRE_THROWS_AS(fail().get(), std::runtime_error);
+}
+
+#endif
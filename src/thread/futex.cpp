@@ -0,0 +1,204 @@
+#include <cassert>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+
+#include <mutils/thread/futex.h>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace MUtils
+{
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex words must be plain 32 bit values");
+
+#ifdef WIN32
+
+bool futex_wait(std::atomic<uint32_t>& word, uint32_t expected, int64_t timeoutNs)
+{
+    DWORD ms = timeoutNs < 0 ? INFINITE : DWORD((timeoutNs + 999999) / 1000000);
+    if (!WaitOnAddress(&word, &expected, sizeof(uint32_t), ms))
+    {
+        return GetLastError() != ERROR_TIMEOUT;
+    }
+    return true;
+}
+
+void futex_wake_one(std::atomic<uint32_t>& word)
+{
+    WakeByAddressSingle(&word);
+}
+
+void futex_wake_all(std::atomic<uint32_t>& word)
+{
+    WakeByAddressAll(&word);
+}
+
+uint32_t futex_thread_id()
+{
+    return uint32_t(GetCurrentThreadId());
+}
+
+#elif defined(__linux__)
+
+bool futex_wait(std::atomic<uint32_t>& word, uint32_t expected, int64_t timeoutNs)
+{
+    timespec ts;
+    timespec* pTimeout = nullptr;
+    if (timeoutNs >= 0)
+    {
+        ts.tv_sec = time_t(timeoutNs / 1000000000);
+        ts.tv_nsec = long(timeoutNs % 1000000000);
+        pTimeout = &ts;
+    }
+
+    // EAGAIN (value changed) and EINTR are just early returns
+    auto ret = syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT_PRIVATE, expected, pTimeout, nullptr, 0);
+    return !(ret == -1 && errno == ETIMEDOUT);
+}
+
+void futex_wake_one(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void futex_wake_all(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+bool futex_has_pi()
+{
+    // Kernels can be built without PI futexes; unlocking a word we don't own fails with EPERM if they are there
+    static const bool supported = []() {
+        uint32_t word = 0;
+        return syscall(SYS_futex, &word, FUTEX_UNLOCK_PI_PRIVATE, 0, nullptr, nullptr, 0) == 0 || errno != ENOSYS;
+    }();
+    return supported;
+}
+
+uint32_t futex_thread_id()
+{
+    thread_local uint32_t id = uint32_t(syscall(SYS_gettid));
+    return id;
+}
+
+bool futex_lock_pi(std::atomic<uint32_t>& word)
+{
+    // The kernel takes the lock for us, or queues us and boosts the owner
+    for (;;)
+    {
+        if (syscall(SYS_futex, (uint32_t*)&word, FUTEX_LOCK_PI_PRIVATE, 0, nullptr, nullptr, 0) == 0)
+        {
+            // The kernel handed the lock over; pair with the release in futex_unlock_pi, so the
+            // ordering is visible to the compiler (and to thread sanitizers)
+            word.load(std::memory_order_acquire);
+            return true;
+        }
+
+        // EAGAIN: the owner is exiting, and the kernel hasn't tidied up yet
+        if (errno != EINTR && errno != EAGAIN)
+        {
+            assert(errno != EDEADLK && "Recursive lock");
+            return false;
+        }
+    }
+}
+
+void futex_unlock_pi(std::atomic<uint32_t>& word)
+{
+    // An atomic no-op, as the release for the next owner; the kernel may be changing the word too
+    word.fetch_or(0, std::memory_order_release);
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_UNLOCK_PI_PRIVATE, 0, nullptr, nullptr, 0);
+}
+
+#else
+
+uint32_t futex_thread_id()
+{
+    static std::atomic<uint32_t> nextId = 1;
+    thread_local uint32_t id = nextId++;
+    return id;
+}
+
+namespace
+{
+// Addresses hash into a fixed set of buckets; a bucket is shared, so wakes are always broadcast
+struct ParkBucket
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+ParkBucket& GetBucket(const void* pAddress)
+{
+    static ParkBucket buckets[64];
+    return buckets[(uintptr_t(pAddress) >> 4) % 64];
+}
+} // namespace
+
+bool futex_wait(std::atomic<uint32_t>& word, uint32_t expected, int64_t timeoutNs)
+{
+    auto& bucket = GetBucket(&word);
+    std::unique_lock<std::mutex> lock(bucket.mutex);
+    if (word.load() != expected)
+    {
+        return true;
+    }
+
+    if (timeoutNs < 0)
+    {
+        bucket.cv.wait(lock);
+        return true;
+    }
+    return bucket.cv.wait_for(lock, std::chrono::nanoseconds(timeoutNs)) == std::cv_status::no_timeout;
+}
+
+void futex_wake_one(std::atomic<uint32_t>& word)
+{
+    futex_wake_all(word);
+}
+
+void futex_wake_all(std::atomic<uint32_t>& word)
+{
+    // Taking the lock orders this wake after any waiter's check of the word
+    auto& bucket = GetBucket(&word);
+    {
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+    }
+    bucket.cv.notify_all();
+}
+
+#endif
+
+#ifndef __linux__
+
+bool futex_has_pi()
+{
+    return false;
+}
+
+bool futex_lock_pi(std::atomic<uint32_t>&)
+{
+    assert(!"No priority inheriting futex on this platform");
+    return false;
+}
+
+void futex_unlock_pi(std::atomic<uint32_t>&)
+{
+    assert(!"No priority inheriting futex on this platform");
+}
+
+#endif
+
+} // namespace MUtils
@@ -0,0 +1,162 @@
+#include <catch2/catch_all.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#include <threadpool/threadpool.h>
+
+#include "mutils/thread/future.h"
+#include "mutils/thread/work_pool.h"
+
+using namespace MUtils;
+
+TEST_CASE("Future.PromiseValue", "[Future]")
+{
+    Promise<int> promise;
+    auto future = promise.get_future();
+    REQUIRE(!future.is_ready());
+
+    promise.set_value(42);
+    REQUIRE(future.is_ready());
+    REQUIRE(future.get() == 42);
+    REQUIRE(!future.valid());
+}
+
+TEST_CASE("Future.ThenChain", "[Future]")
+{
+    Promise<int> promise;
+    auto future = promise.get_future()
+                      .then([](int v) { return v * 2; })
+                      .then([](int v) { return std::to_string(v); });
+
+    // Continuations attached before the value arrives run when it does
+    promise.set_value(21);
+    REQUIRE(future.get() == "42");
+
+    // ...and ones attached after run straight away
+    auto ready = Future<int>::MakeReady(1).then([](int v) { return v + 1; });
+    REQUIRE(ready.is_ready());
+    REQUIRE(ready.get() == 2);
+}
+
+TEST_CASE("Future.Exceptions", "[Future]")
+{
+    bool called = false;
+    auto future = Future<int>::MakeReady(1)
+                      .then([](int) -> int { throw std::runtime_error("Fail"); })
+                      .then([&](int v) {
+                          called = true;
+                          return v;
+                      });
+    REQUIRE(future.has_exception());
+    REQUIRE_THROWS_AS(future.get(), std::runtime_error);
+    REQUIRE(!called);
+
+    Future<void> broken;
+    {
+        Promise<void> promise;
+        broken = promise.get_future();
+    }
+    REQUIRE_THROWS_AS(broken.get(), std::future_error);
+}
+
+TEST_CASE("Future.QueueExecutor", "[Future]")
+{
+    QueueExecutor ui;
+    Promise<int> promise;
+
+    int seen = 0;
+    auto done = promise.get_future().then(ui, [&](int v) { seen = v; });
+    promise.set_value(5);
+
+    // Nothing happens until the owning thread drains the queue
+    REQUIRE(seen == 0);
+    REQUIRE(ui.RunPending() == 1);
+    REQUIRE(seen == 5);
+    REQUIRE(done.is_ready());
+}
+
+TEST_CASE("Future.RunAsync", "[Future]")
+{
+    QueueExecutor queue;
+    auto value = run_async(queue, []() { return 7; });
+    auto thrown = run_async(queue, []() -> int { throw std::runtime_error("failed"); });
+    REQUIRE(!value.is_ready());
+
+    REQUIRE(queue.RunPending() == 2);
+    REQUIRE(value.get() == 7);
+    REQUIRE_THROWS_AS(thrown.get(), std::runtime_error);
+}
+
+TEST_CASE("Future.Pools", "[Future]")
+{
+    WorkStealingPool pool(4);
+    auto a = pool.async([](int v) { return v * 10; }, 4);
+    auto b = a.then(pool, [](int v) { return v + 2; });
+    REQUIRE(b.get() == 42);
+
+    TPool tpool(2);
+    auto c = tpool.async([](int v) { return v + 1; }, 1).then(tpool, [](int v) { return v * 3; });
+    REQUIRE(c.get() == 6);
+}
+
+TEST_CASE("Future.WhenAll", "[Future]")
+{
+    WorkStealingPool pool(4);
+
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 20; i++)
+    {
+        futures.push_back(pool.async([i]() { return i * i; }));
+    }
+
+    auto all = when_all(std::move(futures)).get();
+    REQUIRE(all.size() == 20);
+    for (int i = 0; i < 20; i++)
+    {
+        REQUIRE(all[i] == i * i);
+    }
+
+    std::vector<Future<void>> voids;
+    std::atomic<int> count = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        voids.push_back(pool.async([&]() { count++; }));
+    }
+    when_all(std::move(voids)).get();
+    REQUIRE(count == 10);
+}
+
+TEST_CASE("Future.WhenAny", "[Future]")
+{
+    Promise<std::string> slow;
+    Promise<std::string> fast;
+
+    std::vector<Future<std::string>> futures;
+    futures.push_back(slow.get_future());
+    futures.push_back(fast.get_future());
+
+    auto any = when_any(std::move(futures));
+    REQUIRE(!any.is_ready());
+
+    fast.set_value("fast");
+    slow.set_value("slow");
+
+    auto result = any.get();
+    REQUIRE(result.first == 1);
+    REQUIRE(result.second == "fast");
+}
+
+TEST_CASE("Future.Wait", "[Future]")
+{
+    Promise<int> promise;
+    auto future = promise.get_future();
+
+    std::thread setter([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        promise.set_value(7);
+    });
+
+    REQUIRE(future.get() == 7);
+    setter.join();
+}
@@ -1,8 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+
+#include <fmt/format.h>
+
 #include <mutils/thread/mempool.h>
+#include <mutils/time/profiler.h>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace MUtils
 {
 
+namespace
+{
+std::mutex& PoolRegistryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<IMemoryPool*>& PoolRegistry()
+{
+    static std::vector<IMemoryPool*> pools;
+    return pools;
+}
+
+// Don't recompute rates more often than this, or the per-frame numbers are just noise
+const int64_t MinSampleIntervalNs = 250000000;
+} // namespace
+
+bool MemoryPoolSlab::Reserve(size_t bytes, uint32_t flags, MemoryPoolStats& stats)
+{
+    assert(m_pMemory == nullptr);
+    if (bytes == 0)
+    {
+        return false;
+    }
+
+    m_flags = flags;
+    m_pStats = &stats;
+
+#ifdef WIN32
+    // Large pages need a privilege most processes don't have, so they are not attempted here
+    if (flags & MemoryPoolFlags::HugePages)
+    {
+        stats.reserveFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    m_pMemory = (uint8_t*)VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!m_pMemory)
+    {
+        stats.reserveFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_size = bytes;
+    const size_t pageSize = 4096;
+#else
+    const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+
+    // Huge pages only help if the slab covers whole 2MB pages
+    const size_t hugePageSize = 2 * 1024 * 1024;
+    size_t alignment = (flags & MemoryPoolFlags::HugePages) ? hugePageSize : pageSize;
+    m_size = ((bytes + alignment - 1) / alignment) * alignment;
+
+    void* pMem = nullptr;
+    if (posix_memalign(&pMem, alignment, m_size) != 0)
+    {
+        stats.reserveFailures.fetch_add(1, std::memory_order_relaxed);
+        m_size = 0;
+        return false;
+    }
+    m_pMemory = (uint8_t*)pMem;
+
+    if (flags & MemoryPoolFlags::HugePages)
+    {
+#ifdef MADV_HUGEPAGE
+        if (madvise(m_pMemory, m_size, MADV_HUGEPAGE) != 0)
+        {
+            stats.reserveFailures.fetch_add(1, std::memory_order_relaxed);
+        }
+#else
+        stats.reserveFailures.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+#endif
+
+    // Write to every page, so the OS has to back it now, not on the audio thread
+    if (flags & MemoryPoolFlags::Prefault)
+    {
+        for (size_t offset = 0; offset < m_size; offset += pageSize)
+        {
+            ((volatile uint8_t*)m_pMemory)[offset] = 0;
+        }
+    }
+
+    if (flags & MemoryPoolFlags::Lock)
+    {
+#ifdef WIN32
+        bool locked = VirtualLock(m_pMemory, m_size) != 0;
+#else
+        // Usually fails without CAP_IPC_LOCK or a big enough RLIMIT_MEMLOCK
+        bool locked = mlock(m_pMemory, m_size) == 0;
+#endif
+        if (!locked)
+        {
+            stats.reserveFailures.fetch_add(1, std::memory_order_relaxed);
+            m_flags &= ~MemoryPoolFlags::Lock;
+        }
+    }
+    return true;
+}
+
+void MemoryPoolSlab::Release()
+{
+    if (!m_pMemory)
+    {
+        return;
+    }
+
+#ifdef WIN32
+    if (m_flags & MemoryPoolFlags::Lock)
+    {
+        VirtualUnlock(m_pMemory, m_size);
+    }
+    VirtualFree(m_pMemory, 0, MEM_RELEASE);
+#else
+    if (m_flags & MemoryPoolFlags::Lock)
+    {
+        munlock(m_pMemory, m_size);
+    }
+    free(m_pMemory);
+#endif
+    m_pMemory = nullptr;
+    m_size = 0;
+}
+
+IMemoryPool::IMemoryPool()
+{
+    std::lock_guard<std::mutex> lock(PoolRegistryMutex());
+    PoolRegistry().push_back(this);
+}
+
+IMemoryPool::~IMemoryPool()
+{
+    std::lock_guard<std::mutex> lock(PoolRegistryMutex());
+    auto& pools = PoolRegistry();
+    pools.erase(std::remove(pools.begin(), pools.end(), this), pools.end());
+}
+
+MemoryPoolSnapshot mempool_sample(IMemoryPool& pool)
+{
+    auto& stats = pool.m_stats;
+
+    MemoryPoolSnapshot snap;
+    snap.name = pool.m_pszName;
+    snap.allocs = stats.allocs.load(std::memory_order_relaxed);
+    snap.frees = stats.frees.load(std::memory_order_relaxed);
+    snap.heapAllocs = stats.heapAllocs.load(std::memory_order_relaxed);
+    snap.liveCount = stats.liveCount.load(std::memory_order_relaxed);
+    snap.freeCount = stats.freeCount.load(std::memory_order_relaxed);
+    snap.highWater = stats.highWater.load(std::memory_order_relaxed);
+    snap.exhausted = stats.exhausted.load(std::memory_order_relaxed);
+    snap.reserveFailures = stats.reserveFailures.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(pool.m_sampleMutex);
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto delta = now - pool.m_lastSampleTime;
+    if (pool.m_lastSampleTime == 0)
+    {
+        pool.m_lastSampleTime = now;
+        pool.m_lastSampleAllocs = snap.allocs;
+        pool.m_lastSampleFrees = snap.frees;
+    }
+    else if (delta >= MinSampleIntervalNs)
+    {
+        auto seconds = double(delta) / 1000000000.0;
+        pool.m_lastAllocRate = double(snap.allocs - pool.m_lastSampleAllocs) / seconds;
+        pool.m_lastFreeRate = double(snap.frees - pool.m_lastSampleFrees) / seconds;
+        pool.m_lastSampleTime = now;
+        pool.m_lastSampleAllocs = snap.allocs;
+        pool.m_lastSampleFrees = snap.frees;
+    }
+
+    snap.allocsPerSecond = pool.m_lastAllocRate;
+    snap.freesPerSecond = pool.m_lastFreeRate;
+    return snap;
+}
+
+std::vector<MemoryPoolSnapshot> mempool_sample_all()
+{
+    std::lock_guard<std::mutex> lock(PoolRegistryMutex());
+
+    std::vector<MemoryPoolSnapshot> snaps;
+    for (auto& pPool : PoolRegistry())
+    {
+        snaps.push_back(mempool_sample(*pPool));
+    }
+    return snaps;
+}
+
+void mempool_profile_counters()
+{
+    for (auto& snap : mempool_sample_all())
+    {
+        Profiler::SetCounter(fmt::format("{}/Live", snap.name).c_str(), double(snap.liveCount));
+        Profiler::SetCounter(fmt::format("{}/Free", snap.name).c_str(), double(snap.freeCount));
+        Profiler::SetCounter(fmt::format("{}/HighWater", snap.name).c_str(), double(snap.highWater));
+        Profiler::SetCounter(fmt::format("{}/HeapAllocs", snap.name).c_str(), double(snap.heapAllocs));
+        Profiler::SetCounter(fmt::format("{}/Exhausted", snap.name).c_str(), double(snap.exhausted));
+        Profiler::SetCounter(fmt::format("{}/ReserveFailures", snap.name).c_str(), double(snap.reserveFailures));
+        Profiler::SetCounter(fmt::format("{}/Allocs/s", snap.name).c_str(), snap.allocsPerSecond);
+        Profiler::SetCounter(fmt::format("{}/Frees/s", snap.name).c_str(), snap.freesPerSecond);
+    }
+}
+
 IListItem* list_root(gsl::not_null<IListItem*> pEvent)
 {
     auto pCheck = pEvent;
@@ -215,41 +434,22 @@ IListItem* list_disconnect_range(IListItem* pBegin, IListItem* pEnd)
     }
 
     auto pPool = pBegin->m_pPool;
-    assert(pPool = pEnd->m_pPool);
+    assert(pPool == pEnd->m_pPool);
 
-    // Fix up root
-    if (pBegin == pPool->m_pRoot)
+    // Fix up root; the new root is whatever follows the range
+    if (pPool && pBegin == pPool->m_pRoot)
     {
-        if (pBegin->m_pNext)
-        {
-            pPool->m_pRoot = pBegin->m_pNext;
-        }
-        else
-        {
-            pPool->m_pRoot = nullptr;
-        }
-        assert(pPool->m_pRoot == nullptr || pPool->m_pRoot->m_pPrevious == nullptr);
+        pPool->m_pRoot = pEnd->m_pNext;
     }
 
-    if (pEnd == pPool->m_pLast)
+    // And the last is whatever precedes it
+    if (pPool && pEnd == pPool->m_pLast)
     {
-        if (pEnd->m_pPrevious)
-        {
-            pPool->m_pLast = pEnd->m_pPrevious;
-        }
-        else
-        {
-            pPool->m_pLast = nullptr;
-        }
-        assert(pPool->m_pLast == nullptr || pPool->m_pLast->m_pNext == nullptr);
+        pPool->m_pLast = pBegin->m_pPrevious;
     }
 
-    if (pBegin == nullptr || pEnd == nullptr)
-        return nullptr;
-
     // Disconnect from the chain
     auto pNext = pEnd->m_pNext;
-    assert(pBegin != pEnd);
 
     if (pBegin->m_pPrevious)
     {
@@ -273,6 +473,29 @@ IListItem* list_disconnect_range(IListItem* pBegin, IListItem* pEnd)
     return pNext;
 }
 
+IListItem* list_free_range(IListItem* pBegin, IListItem* pEnd)
+{
+    if (pBegin == nullptr)
+    {
+        return nullptr;
+    }
+
+    // One walk finds the end and counts the range, so the pool can take the strand back without another
+    uint32_t count = 1;
+    auto pLast = pBegin;
+    while (pLast != pEnd && pLast->m_pNext)
+    {
+        pLast = pLast->m_pNext;
+        count++;
+    }
+    assert(pEnd == nullptr || pLast == pEnd);
+
+    auto pPool = pBegin->m_pPool;
+    auto pNext = list_disconnect_range(pBegin, pLast);
+    pPool->FreeChain(pBegin, pLast, count);
+    return pNext;
+}
+
 IListItem* list_end(gsl::not_null<IListItem*> pEvent)
 {
     while (pEvent->m_pNext)
@@ -282,4 +505,19 @@ IListItem* list_end(gsl::not_null<IListItem*> pEvent)
     return pEvent;
 }
 
+uint32_t list_count(IListItem* pBegin, IListItem* pEnd)
+{
+    uint32_t count = 0;
+    while (pBegin)
+    {
+        count++;
+        if (pBegin == pEnd)
+        {
+            break;
+        }
+        pBegin = pBegin->m_pNext;
+    }
+    return count;
+}
+
 } // namespace MUtils
@@ -0,0 +1,228 @@
+#include <catch.hpp>
+
+#include <thread>
+
+#include "mutils/thread/mempool.h"
+
+using namespace MUtils;
+
+namespace
+{
+class TestItem : public PoolItem
+{
+public:
+    DECLARE_POOL_ITEM(TestItem);
+
+    TestItem(IMemoryPool* pPool, uint64_t id)
+        : PoolItem(pPool, id)
+    {
+    }
+
+    virtual void Init() override
+    {
+        value = 0;
+    }
+
+    int value = 0;
+};
+} // namespace
+
+TEST_CASE("MemPool.Stats", "[MemPool]")
+{
+    TSMemoryPool<TestItem> pool(2);
+    pool.SetName("Test");
+
+    REQUIRE(pool.GetStats().freeCount == 2);
+
+    auto p1 = pool.Alloc();
+    auto p2 = pool.Alloc();
+    auto p3 = pool.Alloc();
+
+    auto& stats = pool.GetStats();
+    REQUIRE(stats.allocs == 3);
+    REQUIRE(stats.heapAllocs == 1);
+    REQUIRE(stats.liveCount == 3);
+    REQUIRE(stats.freeCount == 0);
+    REQUIRE(stats.highWater == 3);
+
+    p1->Free();
+    p2->Free();
+
+    REQUIRE(stats.frees == 2);
+    REQUIRE(stats.liveCount == 1);
+    REQUIRE(stats.freeCount == 2);
+    REQUIRE(stats.highWater == 3);
+
+    auto snap = mempool_sample(pool);
+    REQUIRE(snap.name == "Test");
+    REQUIRE(snap.liveCount == 1);
+
+    // Any thread can sample, alongside the UI's sample_all
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; thread++)
+    {
+        threads.emplace_back([&pool]() {
+            for (int sample = 0; sample < 1000; sample++)
+            {
+                mempool_sample(pool);
+                mempool_sample_all();
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    p3->Free();
+}
+
+TEST_CASE("MemPool.Fixed", "[MemPool]")
+{
+    MemoryPoolOptions options;
+    options.capacity = 4;
+    options.flags = MemoryPoolFlags::RealTime;
+
+    SECTION("ThreadSafe")
+    {
+        TSMemoryPool<TestItem> pool(options);
+
+        std::vector<TestItem*> items;
+        for (int i = 0; i < 4; i++)
+        {
+            items.push_back(pool.Alloc());
+            REQUIRE(items.back() != nullptr);
+        }
+
+        // Doesn't grow
+        REQUIRE(pool.Alloc() == nullptr);
+        REQUIRE(pool.GetStats().exhausted == 1);
+        REQUIRE(pool.GetStats().heapAllocs == 0);
+
+        items[0]->Free();
+        REQUIRE(pool.Alloc() == items[0]);
+
+        // Everything goes back before the slab does
+        for (auto pItem : items)
+        {
+            pItem->Free();
+        }
+    }
+
+    SECTION("Callback")
+    {
+        TestItem* pFallback = nullptr;
+        MemoryPool<TestItem> fallbackPool(1);
+        options.fnExhausted = [&](IMemoryPool&) {
+            pFallback = fallbackPool.Alloc();
+            pFallback->value = 7;
+            return pFallback;
+        };
+
+        MemoryPool<TestItem> pool(options);
+        std::vector<TestItem*> items;
+        for (int i = 0; i < 4; i++)
+        {
+            items.push_back(pool.Alloc());
+            REQUIRE(items.back() != nullptr);
+        }
+
+        // Initialised like the pool's own items
+        auto pItem = pool.Alloc();
+        REQUIRE(pItem == pFallback);
+        REQUIRE(pItem->value == 0);
+        REQUIRE(pItem->m_pPool == &fallbackPool);
+        REQUIRE(pool.GetStats().exhausted == 1);
+
+        pItem->Free();
+        for (auto pLive : items)
+        {
+            pLive->Free();
+        }
+    }
+}
+
+TEST_CASE("MemPool.FreeChain", "[MemPool]")
+{
+    TSMemoryPool<TestItem> pool(0);
+
+    std::vector<TestItem*> items;
+    IListItem* pLast = nullptr;
+    for (int i = 0; i < 5; i++)
+    {
+        items.push_back(pool.Alloc());
+        list_insert_after(pLast, gsl::not_null<IListItem*>(items.back()));
+        pLast = items.back();
+    }
+    REQUIRE(list_count(pool.m_pRoot) == 5);
+
+    // Free the middle 3
+    auto pNext = list_free_range(items[1], items[3]);
+    REQUIRE(pNext == items[4]);
+    REQUIRE(pool.m_pRoot == items[0]);
+    REQUIRE(items[0]->m_pNext == items[4]);
+    REQUIRE(items[4]->m_pPrevious == items[0]);
+    REQUIRE(pool.GetStats().frees == 3);
+    REQUIRE(pool.GetStats().liveCount == 2);
+    REQUIRE(pool.GetStats().freeCount == 3);
+
+    // Free the rest
+    list_free_range(pool.m_pRoot, nullptr);
+    REQUIRE(pool.m_pRoot == nullptr);
+    REQUIRE(pool.m_pLast == nullptr);
+    REQUIRE(pool.GetStats().liveCount == 0);
+
+    // Reused items come back unlinked
+    auto pItem = pool.Alloc();
+    REQUIRE(pItem->m_pNext == nullptr);
+    REQUIRE(pItem->m_pPrevious == nullptr);
+    pItem->Free();
+}
+
+TEST_CASE("MemPool.FreeChainSplice", "[MemPool]")
+{
+    MemoryPool<TestItem> pool(0);
+
+    auto p1 = pool.Alloc();
+    auto p2 = pool.Alloc();
+    list_insert_after(nullptr, gsl::not_null<IListItem*>(p1));
+    list_insert_after(p1, gsl::not_null<IListItem*>(p2));
+
+    list_disconnect_range(p1, p2);
+    pool.FreeChain(p1, p2, 2);
+    REQUIRE(pool.GetStats().freeCount == 2);
+
+    // Comes back off the front of the spliced strand, with no links left over
+    REQUIRE(pool.Alloc() == p1);
+    REQUIRE(pool.Alloc() == p2);
+    REQUIRE(p2->m_pNext == nullptr);
+    REQUIRE(p2->m_pPrevious == nullptr);
+    REQUIRE(pool.GetStats().heapAllocs == 2);
+    p1->Free();
+    p2->Free();
+    REQUIRE(pool.GetStats().liveCount == 0);
+
+    // list_free_range counts as it slices, so the pool never walks the strand
+    struct CountingPool : MemoryPool<TestItem>
+    {
+        using MemoryPool<TestItem>::MemoryPool;
+        void FreeChain(IListItem* pBegin, IListItem* pEnd, uint32_t count) override
+        {
+            counts.push_back(count);
+            MemoryPool<TestItem>::FreeChain(pBegin, pEnd, count);
+        }
+        std::vector<uint32_t> counts;
+    };
+    CountingPool counting(0);
+    std::vector<TestItem*> items;
+    for (int index = 0; index < 5; index++)
+    {
+        items.push_back(counting.Alloc());
+        list_insert_after(index ? items[index - 1] : nullptr, gsl::not_null<IListItem*>(items[index]));
+    }
+    REQUIRE(list_free_range(items[1], items[2]) == items[3]);
+    REQUIRE(list_free_range(items[3], nullptr) == nullptr);
+    REQUIRE(counting.counts == std::vector<uint32_t>{ 2, 2 });
+    REQUIRE(counting.GetStats().freeCount == 4);
+    items[0]->Free();
+}
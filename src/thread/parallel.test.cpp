@@ -0,0 +1,102 @@
+#include <catch.hpp>
+
+#include <numeric>
+#include <random>
+
+#include "mutils/thread/parallel.h"
+
+using namespace MUtils;
+
+TEST_CASE("Parallel.For", "[Parallel]")
+{
+    WorkStealingPool pool(4);
+
+    std::vector<int> values(100000, 0);
+    parallel_for(pool, size_t(0), values.size(), size_t(100), [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++)
+        {
+            values[i]++;
+        }
+    });
+
+    // Every index visited exactly once
+    REQUIRE(std::all_of(values.begin(), values.end(), [](int v) { return v == 1; }));
+}
+
+TEST_CASE("Parallel.ForNoWorkers", "[Parallel]")
+{
+    WorkStealingPool pool(1);
+
+    auto thread = std::this_thread::get_id();
+    int calls = 0;
+    parallel_for(pool, 0, 1000, 10, [&](int begin, int end) {
+        REQUIRE(std::this_thread::get_id() == thread);
+        REQUIRE(begin == 0);
+        REQUIRE(end == 1000);
+        calls++;
+    });
+    REQUIRE(calls == 1);
+}
+
+TEST_CASE("Parallel.Reduce", "[Parallel]")
+{
+    WorkStealingPool pool(4);
+
+    std::vector<int64_t> values(100000);
+    std::iota(values.begin(), values.end(), 0);
+
+    auto sum = parallel_reduce(
+        pool, size_t(0), values.size(), size_t(256), int64_t(0),
+        [&](size_t begin, size_t end, int64_t acc) {
+            for (auto i = begin; i < end; i++)
+            {
+                acc += values[i];
+            }
+            return acc;
+        },
+        std::plus<int64_t>());
+
+    REQUIRE(sum == std::accumulate(values.begin(), values.end(), int64_t(0)));
+
+    // Each participant's bool is its own, not a bit in a shared word
+    auto found = parallel_reduce(
+        pool, size_t(0), values.size(), size_t(256), false,
+        [&](size_t begin, size_t end, bool acc) {
+            for (auto i = begin; i < end; i++)
+            {
+                acc = acc || values[i] == 99999;
+            }
+            return acc;
+        },
+        std::logical_or<bool>());
+    REQUIRE(found);
+}
+
+TEST_CASE("Parallel.Sort", "[Parallel]")
+{
+    WorkStealingPool pool(4);
+
+    std::mt19937 rand(42);
+    std::vector<uint32_t> values(50000);
+    for (auto& v : values)
+    {
+        v = rand();
+    }
+
+    auto expected = values;
+    std::sort(expected.begin(), expected.end());
+
+    parallel_sort(pool, values.begin(), values.end(), std::less<>(), 1000);
+    REQUIRE(values == expected);
+}
+
+TEST_CASE("Parallel.Exception", "[Parallel]")
+{
+    WorkStealingPool pool(4);
+    REQUIRE_THROWS(parallel_for(pool, 0, 1000, 1, [](int begin, int) {
+        if (begin > 500)
+        {
+            throw std::runtime_error("Fail");
+        }
+    }));
+}
@@ -0,0 +1,230 @@
+#include <cassert>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#include <mutils/logger/logger.h>
+#include <mutils/thread/task_graph.h>
+#include <mutils/time/profiler.h>
+
+namespace MUtils
+{
+
+namespace
+{
+
+// The profiler keeps hold of section name pointers long after a graph may have gone, so node names
+// are interned here for the life of the process.  There are only ever a handful of them
+const char* InternName(const std::string& name)
+{
+    static std::mutex nameMutex;
+    static std::set<std::string> names;
+    std::lock_guard<std::mutex> lock(nameMutex);
+    return names.insert(name).first->c_str();
+}
+
+} // namespace
+
+TaskNode::TaskNode(TaskGraph& owner, const std::string& name)
+    : m_owner(owner)
+    , m_pszName(InternName(name))
+{
+    m_color = ToPackedARGB(Theme::ThemeManager::ColorFromName(name.c_str(), uint32_t(name.size())));
+}
+
+TaskNode& TaskNode::Precede(TaskNode& other)
+{
+    assert(&other.m_owner == &m_owner);
+    assert(&other != this);
+
+    m_successors.push_back(&other);
+    other.m_predecessorCount++;
+    m_owner.m_dirty = true;
+    return *this;
+}
+
+TaskNode& TaskNode::Succeed(TaskNode& other)
+{
+    other.Precede(*this);
+    return *this;
+}
+
+TaskGraph::TaskGraph(const std::string& name)
+    : m_pszName(InternName(name))
+{
+}
+
+TaskNode& TaskGraph::AddNode(const std::string& name)
+{
+    m_nodes.push_back(std::unique_ptr<TaskNode>(new TaskNode(*this, name)));
+    m_dirty = true;
+    return *m_nodes.back();
+}
+
+TaskNode& TaskGraph::Compose(const std::string& name, TaskGraph& subGraph)
+{
+    assert(&subGraph != this);
+    auto& node = AddNode(name);
+    node.m_pSubGraph = &subGraph;
+    return node;
+}
+
+void TaskGraph::Clear()
+{
+    m_nodes.clear();
+    m_roots.clear();
+    m_dirty = true;
+}
+
+bool TaskGraph::Validate() const
+{
+    // Kahn's algorithm; if we can't visit every node, there is a cycle
+    std::vector<TaskNode*> ready;
+    std::unordered_map<const TaskNode*, uint32_t> counts;
+    for (auto& spNode : m_nodes)
+    {
+        counts[spNode.get()] = spNode->m_predecessorCount;
+        if (spNode->m_predecessorCount == 0)
+        {
+            ready.push_back(spNode.get());
+        }
+    }
+
+    size_t visited = 0;
+    while (!ready.empty())
+    {
+        auto pNode = ready.back();
+        ready.pop_back();
+        visited++;
+        for (auto& pSuccessor : pNode->m_successors)
+        {
+            if (--counts[pSuccessor] == 0)
+            {
+                ready.push_back(pSuccessor);
+            }
+        }
+    }
+    return visited == m_nodes.size();
+}
+
+bool TaskGraph::Run()
+{
+    return Run(WorkStealingPool::Instance());
+}
+
+bool TaskGraph::Run(WorkStealingPool& pool)
+{
+    PROFILE_SCOPE_STR(m_pszName, 0xFF8080FF);
+
+    if (m_dirty)
+    {
+        m_valid = Validate();
+        if (!m_valid)
+        {
+            LOG(ERROR, "Task graph has a cycle: " << m_pszName);
+        }
+
+        m_roots.clear();
+        for (auto& spNode : m_nodes)
+        {
+            if (spNode->m_predecessorCount == 0)
+            {
+                m_roots.push_back(spNode.get());
+            }
+        }
+        m_dirty = false;
+    }
+
+    if (!m_valid || m_nodes.empty())
+    {
+        return m_valid;
+    }
+
+    for (auto& spNode : m_nodes)
+    {
+        spNode->m_pending.store(spNode->m_predecessorCount, std::memory_order_relaxed);
+    }
+    m_spException = nullptr;
+    m_remaining.store(uint32_t(m_nodes.size()), std::memory_order_release);
+
+    // Keep the first root for this thread
+    for (size_t i = 1; i < m_roots.size(); i++)
+    {
+        Schedule(pool, m_roots[i]);
+    }
+    Execute(pool, m_roots[0]);
+
+    while (m_remaining.load(std::memory_order_acquire) != 0)
+    {
+        if (!pool.TryRunOne())
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    if (m_spException)
+    {
+        std::rethrow_exception(m_spException);
+    }
+    return true;
+}
+
+void TaskGraph::Schedule(WorkStealingPool& pool, TaskNode* pNode)
+{
+    pool.run([this, &pool, pNode]() {
+        Execute(pool, pNode);
+    });
+}
+
+void TaskGraph::Execute(WorkStealingPool& pool, TaskNode* pNode)
+{
+    // Run a chain of nodes on this thread; a node that makes exactly one successor ready
+    // continues straight into it instead of going through the pool
+    while (pNode)
+    {
+        {
+            PROFILE_SCOPE_STR(pNode->m_pszName, pNode->m_color);
+            try
+            {
+                if (pNode->m_pSubGraph)
+                {
+                    pNode->m_pSubGraph->Run(pool);
+                }
+                else if (pNode->m_fn)
+                {
+                    pNode->m_fn();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_exceptionMutex);
+                if (!m_spException)
+                {
+                    m_spException = std::current_exception();
+                }
+            }
+        }
+
+        TaskNode* pNext = nullptr;
+        for (auto& pSuccessor : pNode->m_successors)
+        {
+            if (pSuccessor->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                if (!pNext)
+                {
+                    pNext = pSuccessor;
+                }
+                else
+                {
+                    Schedule(pool, pSuccessor);
+                }
+            }
+        }
+
+        // The graph can be finished (and gone) the moment this hits zero, so touch nothing after it
+        m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+        pNode = pNext;
+    }
+}
+
+} // namespace MUtils
@@ -0,0 +1,106 @@
+#include <catch.hpp>
+
+#include "mutils/thread/task_graph.h"
+
+using namespace MUtils;
+
+TEST_CASE("TaskGraph.Order", "[TaskGraph]")
+{
+    WorkStealingPool pool(4);
+
+    std::mutex orderMutex;
+    std::vector<std::string> order;
+    auto record = [&](const char* pszName) {
+        return [&, pszName]() {
+            std::lock_guard<std::mutex> lock(orderMutex);
+            order.push_back(pszName);
+        };
+    };
+
+    // Diamond: Load -> (Geometry, Audio) -> Upload
+    TaskGraph graph("Frame");
+    auto& load = graph.Emplace("Load", record("Load"));
+    auto& geometry = graph.Emplace("Geometry", record("Geometry"));
+    auto& audio = graph.Emplace("Audio", record("Audio"));
+    auto& upload = graph.Emplace("Upload", record("Upload"));
+    load.Precede(geometry).Precede(audio);
+    upload.Succeed(geometry).Succeed(audio);
+
+    // Graphs are reusable
+    for (int run = 0; run < 50; run++)
+    {
+        order.clear();
+        REQUIRE(graph.Run(pool));
+        REQUIRE(order.size() == 4);
+        REQUIRE(order.front() == "Load");
+        REQUIRE(order.back() == "Upload");
+    }
+}
+
+TEST_CASE("TaskGraph.Wide", "[TaskGraph]")
+{
+    WorkStealingPool pool(4);
+
+    std::atomic<int> count = 0;
+    std::atomic<int> afterCount = -1;
+
+    TaskGraph graph;
+    auto& last = graph.Emplace("Last", [&]() { afterCount = count.load(); });
+    for (int i = 0; i < 100; i++)
+    {
+        graph.Emplace("Work", [&]() { count++; }).Precede(last);
+    }
+
+    REQUIRE(graph.Run(pool));
+    REQUIRE(count == 100);
+    REQUIRE(afterCount == 100);
+}
+
+TEST_CASE("TaskGraph.SubGraph", "[TaskGraph]")
+{
+    WorkStealingPool pool(2);
+
+    int value = 0;
+    TaskGraph inner("Inner");
+    auto& a = inner.Emplace("Double", [&]() { value *= 2; });
+    inner.Emplace("AddOne", [&]() { value += 1; }).Succeed(a);
+
+    TaskGraph outer("Outer");
+    auto& start = outer.Emplace("Start", [&]() { value = 5; });
+    auto& sub = outer.Compose("Inner", inner);
+    auto& end = outer.Emplace("End", [&]() { value *= 10; });
+    start.Precede(sub);
+    sub.Precede(end);
+
+    REQUIRE(outer.Run(pool));
+    REQUIRE(value == 110);
+}
+
+TEST_CASE("TaskGraph.Cycle", "[TaskGraph]")
+{
+    WorkStealingPool pool(1);
+
+    bool ran = false;
+    TaskGraph graph;
+    auto& a = graph.Emplace("A", [&]() { ran = true; });
+    auto& b = graph.Emplace("B", [&]() { ran = true; });
+    a.Precede(b);
+    b.Precede(a);
+
+    REQUIRE(!graph.Validate());
+    REQUIRE(!graph.Run(pool));
+    REQUIRE(!ran);
+}
+
+TEST_CASE("TaskGraph.Exception", "[TaskGraph]")
+{
+    WorkStealingPool pool(2);
+
+    bool ranAfter = false;
+    TaskGraph graph;
+    auto& a = graph.Emplace("Throw", []() { throw std::runtime_error("Fail"); });
+    graph.Emplace("After", [&]() { ranAfter = true; }).Succeed(a);
+
+    REQUIRE_THROWS(graph.Run(pool));
+    REQUIRE(ranAfter);
+}
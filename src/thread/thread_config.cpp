@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <mutils/logger/logger.h>
+#include <mutils/string/string_utils.h>
+#include <mutils/thread/thread_config.h>
+#include <mutils/time/profiler.h>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+#endif
+
+#undef ERROR
+
+namespace MUtils
+{
+
+namespace
+{
+
+const int NoIsolatedCore = -1;
+const int IsolatedCoreUnset = -2;
+std::atomic<int> gIsolatedCore = IsolatedCoreUnset;
+
+// Missing privileges are the normal case for a desktop app; say so once, not for every thread
+void WarnOnce(std::atomic_bool& warned, const std::string& message)
+{
+    if (!warned.exchange(true))
+    {
+        LOG(WARNING, message);
+    }
+}
+
+#ifdef __linux__
+// Parse the kernel's isolated cpu list, e.g. "3" or "2-3,6"
+int FirstKernelIsolatedCore()
+{
+    std::ifstream in("/sys/devices/system/cpu/isolated");
+    std::string list;
+    if (!in || !std::getline(in, list))
+    {
+        return NoIsolatedCore;
+    }
+
+    auto ranges = string_split(list, ",-");
+    if (ranges.empty() || ranges[0].empty())
+    {
+        return NoIsolatedCore;
+    }
+
+    try
+    {
+        return std::stoi(ranges[0]);
+    }
+    catch (...)
+    {
+        return NoIsolatedCore;
+    }
+}
+#endif
+
+// Read once; the kernel's list doesn't change while we run
+int KernelIsolatedCore()
+{
+#ifdef __linux__
+    static const int core = FirstKernelIsolatedCore();
+    return core;
+#else
+    return NoIsolatedCore;
+#endif
+}
+
+// The first thread configured with Isolate keeps a core for itself, if the kernel hasn't already set one aside
+int ClaimIsolatedCore()
+{
+    auto core = gIsolatedCore.load();
+    if (core != IsolatedCoreUnset)
+    {
+        return core;
+    }
+
+    auto claim = KernelIsolatedCore();
+
+    // Need something left for everyone else
+    auto count = thread_cpu_count();
+    if (claim == NoIsolatedCore && count >= 3)
+    {
+        claim = int(count - 1);
+    }
+
+    // Another thread may have got there first
+    gIsolatedCore.compare_exchange_strong(core, claim);
+    return gIsolatedCore.load();
+}
+
+// The cpus the calling thread may run on now; inherited from its creator, taskset, cgroups etc.
+std::vector<uint32_t> AllowedCpus()
+{
+    std::vector<uint32_t> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+#endif
+    for (uint32_t cpu = 0; cpu < thread_cpu_count(); cpu++)
+    {
+        cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+} // namespace
+
+uint32_t thread_cpu_count()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+int thread_isolated_core()
+{
+    auto core = gIsolatedCore.load();
+    return core == IsolatedCoreUnset ? KernelIsolatedCore() : core;
+}
+
+void thread_set_isolated_core(int core)
+{
+    gIsolatedCore.store(core < 0 ? NoIsolatedCore : core);
+}
+
+bool thread_set_name(const std::string& name)
+{
+    Profiler::NameThread(name.c_str());
+
+#ifdef WIN32
+    std::wstring wide(name.begin(), name.end());
+    return SUCCEEDED(SetThreadDescription(GetCurrentThread(), wide.c_str()));
+#elif defined(__APPLE__)
+    return pthread_setname_np(name.c_str()) == 0;
+#else
+    // 16 bytes, including the terminator
+    return pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()) == 0;
+#endif
+}
+
+bool thread_set_affinity(const std::vector<uint32_t>& cpus)
+{
+    auto count = thread_cpu_count();
+
+#ifdef WIN32
+    DWORD_PTR mask = 0;
+    for (auto& cpu : cpus)
+    {
+        if (cpu < count && cpu < sizeof(DWORD_PTR) * 8)
+        {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+    if (cpus.empty())
+    {
+        mask = DWORD_PTR(-1);
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__APPLE__)
+    // No hard affinity on macOS; an affinity tag only hints which threads should share a cache.
+    // Give each pinned core its own tag so the scheduler at least keeps them apart
+    if (cpus.empty())
+    {
+        return true;
+    }
+    thread_affinity_policy_data_t policy = { integer_t(cpus[0] + 1) };
+    return thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT) == KERN_SUCCESS;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto& cpu : cpus)
+    {
+        if (cpu < count && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (cpus.empty())
+    {
+        for (uint32_t cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return CPU_COUNT(&set) != 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+bool thread_set_priority(ThreadPriority priority, int realTimePriority)
+{
+#ifdef WIN32
+    int level = THREAD_PRIORITY_NORMAL;
+    switch (priority)
+    {
+    case ThreadPriority::Normal:
+        break;
+    case ThreadPriority::High:
+        level = THREAD_PRIORITY_HIGHEST;
+        break;
+    case ThreadPriority::RealTimeFIFO:
+    case ThreadPriority::RealTimeRR:
+        level = THREAD_PRIORITY_TIME_CRITICAL;
+        break;
+    }
+    return SetThreadPriority(GetCurrentThread(), level) != 0;
+#else
+    int policy = SCHED_OTHER;
+    switch (priority)
+    {
+    case ThreadPriority::Normal:
+    case ThreadPriority::High:
+        break;
+    case ThreadPriority::RealTimeFIFO:
+        policy = SCHED_FIFO;
+        break;
+    case ThreadPriority::RealTimeRR:
+        policy = SCHED_RR;
+        break;
+    }
+
+    sched_param param{};
+    if (policy != SCHED_OTHER)
+    {
+        param.sched_priority = std::clamp(realTimePriority, sched_get_priority_min(policy), sched_get_priority_max(policy));
+    }
+
+    if (pthread_setschedparam(pthread_self(), policy, &param) != 0)
+    {
+        return false;
+    }
+
+#ifdef __linux__
+    // Within SCHED_OTHER, priority is the thread's nice value
+    if (policy == SCHED_OTHER)
+    {
+        auto nice = priority == ThreadPriority::High ? -10 : 0;
+        return setpriority(PRIO_PROCESS, 0, nice) == 0 || priority == ThreadPriority::Normal;
+    }
+#endif
+    return true;
+#endif
+}
+
+ThreadConfigResult thread_configure(const ThreadConfig& config)
+{
+    static std::atomic_bool warnedPriority = false;
+    static std::atomic_bool warnedAffinity = false;
+
+    ThreadConfigResult result;
+    if (!config.name.empty())
+    {
+        result.name = thread_set_name(config.name);
+    }
+
+    auto allowed = AllowedCpus();
+    auto cpus = config.cpus;
+    if (config.flags & ThreadConfigFlags::Isolate)
+    {
+        auto isolated = ClaimIsolatedCore();
+        if (isolated >= 0)
+        {
+            cpus = { uint32_t(isolated) };
+        }
+    }
+    else if (config.flags & ThreadConfigFlags::AvoidIsolated)
+    {
+        auto isolated = thread_isolated_core();
+        if (isolated >= 0)
+        {
+            if (cpus.empty())
+            {
+                cpus = allowed;
+            }
+            cpus.erase(std::remove(cpus.begin(), cpus.end(), uint32_t(isolated)), cpus.end());
+        }
+    }
+
+    // Never widen what the thread was given (by its creator, taskset, cgroups...)
+    if (!cpus.empty())
+    {
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](uint32_t cpu) {
+            return !std::binary_search(allowed.begin(), allowed.end(), cpu);
+        }),
+            cpus.end());
+
+        // Already where it should be, so leave the mask alone
+        result.affinity = !cpus.empty() && (cpus == allowed || thread_set_affinity(cpus));
+        if (!result.affinity)
+        {
+            WarnOnce(warnedAffinity, "Could not set thread affinity for: " + config.name);
+        }
+    }
+
+    // Normal leaves the scheduling and nice value the thread inherited alone
+    if (config.priority == ThreadPriority::Normal)
+    {
+        result.priority = true;
+        return result;
+    }
+
+    result.priority = thread_set_priority(config.priority, config.realTimePriority);
+    if (!result.priority)
+    {
+        // Usually missing CAP_SYS_NICE/rtprio limits; get as close as we can
+        if (config.priority == ThreadPriority::High)
+        {
+            WarnOnce(warnedPriority, "High priority not permitted, keeping the inherited priority for: " + config.name);
+        }
+        else
+        {
+            WarnOnce(warnedPriority, "Real time scheduling not permitted, falling back to High priority for: " + config.name);
+            result.priority = thread_set_priority(ThreadPriority::High);
+        }
+    }
+    return result;
+}
+
+} // namespace MUtils
@@ -0,0 +1,106 @@
+#include <catch.hpp>
+
+#include <thread>
+
+#include "mutils/thread/thread_config.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+using namespace MUtils;
+
+TEST_CASE("ThreadConfig.Name", "[ThreadConfig]")
+{
+    std::thread([]() {
+        REQUIRE(thread_set_name("A_Long_Thread_Name_For_Testing"));
+#ifdef __linux__
+        char name[16];
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        REQUIRE(std::string(name) == "A_Long_Thread_N");
+#endif
+    }).join();
+}
+
+TEST_CASE("ThreadConfig.Affinity", "[ThreadConfig]")
+{
+    std::thread([]() {
+        REQUIRE(thread_set_affinity({ 0 }));
+#ifdef __linux__
+        REQUIRE(sched_getcpu() == 0);
+#endif
+        // Back to anywhere
+        REQUIRE(thread_set_affinity({}));
+    }).join();
+}
+
+TEST_CASE("ThreadConfig.RealTimeFallback", "[ThreadConfig]")
+{
+    // Usually not allowed in a test run; must not fail either way
+    std::thread([]() {
+        auto result = thread_configure(ThreadConfig::RealTime("RT_Test"));
+        REQUIRE(result.name);
+#ifdef __linux__
+        int policy;
+        sched_param param;
+        pthread_getschedparam(pthread_self(), &policy, &param);
+        REQUIRE((policy == SCHED_FIFO) == result.priority);
+#endif
+    }).join();
+}
+
+TEST_CASE("ThreadConfig.Isolation", "[ThreadConfig]")
+{
+    thread_set_isolated_core(0);
+    REQUIRE(thread_isolated_core() == 0);
+
+    std::thread([]() {
+        auto config = ThreadConfig::Worker();
+        auto result = thread_configure(config);
+#ifdef __linux__
+        if (thread_cpu_count() > 1)
+        {
+            REQUIRE(result.affinity);
+            REQUIRE(sched_getcpu() != 0);
+        }
+#endif
+    }).join();
+
+#ifdef __linux__
+    // Workers stay inside the cpus they were given
+    if (thread_cpu_count() > 2)
+    {
+        thread_set_isolated_core(1);
+        std::thread([]() {
+            REQUIRE(thread_set_affinity({ 0, 1 }));
+            REQUIRE(thread_configure(ThreadConfig::Worker()).affinity);
+
+            cpu_set_t set;
+            REQUIRE(sched_getaffinity(0, sizeof(set), &set) == 0);
+            REQUIRE(CPU_COUNT(&set) == 1);
+            REQUIRE(CPU_ISSET(0, &set));
+        }).join();
+    }
+#endif
+
+    thread_set_isolated_core(-1);
+    REQUIRE(thread_isolated_core() == -1);
+}
+
+TEST_CASE("ThreadConfig.NormalPriority", "[ThreadConfig]")
+{
+    std::thread([]() {
+#ifdef __linux__
+        // Raising the nice value is always allowed
+        REQUIRE(setpriority(PRIO_PROCESS, 0, 5) == 0);
+#endif
+        auto result = thread_configure(ThreadConfig::Worker());
+        REQUIRE(result.priority);
+#ifdef __linux__
+        // Left as it was
+        REQUIRE(getpriority(PRIO_PROCESS, 0) == 5);
+#endif
+    }).join();
+}
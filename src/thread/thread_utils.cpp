@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <mutils/thread/futex.h>
+#include <mutils/thread/thread_utils.h>
+#include <mutils/time/profiler.h>
+
+namespace MUtils
+{
+
+namespace
+{
+// Upper bound on the adaptive spin; a few microseconds of _mm_pause
+const uint32_t MaxSpin = 1000;
+const uint32_t StartSpin = 100;
+
+std::mutex& MutexRegistryLock()
+{
+    static std::mutex registryMutex;
+    return registryMutex;
+}
+
+std::vector<hybrid_mutex*>& MutexRegistry()
+{
+    static std::vector<hybrid_mutex*> mutexes;
+    return mutexes;
+}
+} // namespace
+
+hybrid_mutex::hybrid_mutex(uint32_t flags, const char* pszName)
+    : m_spinEstimate(StartSpin)
+    , m_flags(flags)
+    , m_pszName(pszName)
+{
+    if (!futex_has_pi())
+    {
+        m_flags &= ~HybridMutexFlags::PriorityInherit;
+    }
+
+    if ((m_flags & HybridMutexFlags::Stats) && m_pszName)
+    {
+        std::lock_guard<std::mutex> lock(MutexRegistryLock());
+        MutexRegistry().push_back(this);
+    }
+}
+
+hybrid_mutex::~hybrid_mutex()
+{
+    if ((m_flags & HybridMutexFlags::Stats) && m_pszName)
+    {
+        std::lock_guard<std::mutex> lock(MutexRegistryLock());
+        auto& mutexes = MutexRegistry();
+        mutexes.erase(std::remove(mutexes.begin(), mutexes.end(), this), mutexes.end());
+    }
+}
+
+uint32_t hybrid_mutex::lock_value() const noexcept
+{
+    return (m_flags & HybridMutexFlags::PriorityInherit) ? futex_thread_id() : Locked;
+}
+
+void hybrid_mutex::lock_slow() noexcept
+{
+    const bool stats = (m_flags & HybridMutexFlags::Stats) != 0;
+    std::chrono::steady_clock::time_point start;
+    if (stats)
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    // Spin for about as long as the lock has recently taken to come free; plus a bit, so the estimate can grow
+    auto spinLimit = std::min(MaxSpin, m_spinEstimate.load(std::memory_order_relaxed) * 2 + 10);
+    uint32_t spins = 0;
+    bool acquired = false;
+    for (; spins < spinLimit; spins++)
+    {
+        // Only try the CAS when it looks free, to keep the cache line shared while spinning
+        if (m_word.load(std::memory_order_relaxed) == 0 && try_acquire())
+        {
+            acquired = true;
+            break;
+        }
+        _mm_pause();
+    }
+
+    // Move the estimate 1/8th of the way towards what this lock needed
+    auto estimate = m_spinEstimate.load(std::memory_order_relaxed);
+    auto needed = acquired ? spins : MaxSpin;
+    m_spinEstimate.store(uint32_t(int32_t(estimate) + (int32_t(needed) - int32_t(estimate)) / 8), std::memory_order_relaxed);
+
+    bool parked = false;
+    if (!acquired)
+    {
+        parked = true;
+        if (m_flags & HybridMutexFlags::PriorityInherit)
+        {
+            // One more try, then let the kernel queue us behind the owner.  If it can't, poll without the boost;
+            // the word is in the PI format, so the plain park protocol can't be used on it
+            while (!try_acquire() && !futex_lock_pi(m_word))
+            {
+                std::this_thread::yield();
+            }
+        }
+        else
+        {
+            // Mark the lock as having sleepers, so unlock knows to wake one of us
+            auto state = m_word.exchange(Parked, std::memory_order_acquire);
+            while (state != 0)
+            {
+                futex_wait(m_word, Parked);
+                state = m_word.exchange(Parked, std::memory_order_acquire);
+            }
+        }
+    }
+
+    if (stats)
+    {
+        m_stats.locks.fetch_add(1, std::memory_order_relaxed);
+        m_stats.contended.fetch_add(1, std::memory_order_relaxed);
+        m_stats.spins.fetch_add(spins, std::memory_order_relaxed);
+        m_stats.parks.fetch_add(parked ? 1 : 0, std::memory_order_relaxed);
+        m_stats.waitNs.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+    }
+}
+
+void hybrid_mutex::unlock_slow() noexcept
+{
+    if (m_flags & HybridMutexFlags::PriorityInherit)
+    {
+        futex_unlock_pi(m_word);
+    }
+    else
+    {
+        futex_wake_one(m_word);
+    }
+}
+
+void hybrid_mutex_profile_counters()
+{
+    std::lock_guard<std::mutex> lock(MutexRegistryLock());
+    for (auto& pMutex : MutexRegistry())
+    {
+        auto& stats = pMutex->GetStats();
+        auto contended = stats.contended.load(std::memory_order_relaxed);
+        auto name = pMutex->GetName();
+        Profiler::SetCounter(fmt::format("{}/Locks", name).c_str(), double(stats.locks.load(std::memory_order_relaxed)));
+        Profiler::SetCounter(fmt::format("{}/Contended", name).c_str(), double(contended));
+        Profiler::SetCounter(fmt::format("{}/Parks", name).c_str(), double(stats.parks.load(std::memory_order_relaxed)));
+        Profiler::SetCounter(fmt::format("{}/AvgSpins", name).c_str(), contended ? double(stats.spins.load(std::memory_order_relaxed)) / contended : 0.0);
+        Profiler::SetCounter(fmt::format("{}/AvgWaitUs", name).c_str(), contended ? double(stats.waitNs.load(std::memory_order_relaxed)) / (contended * 1000.0) : 0.0);
+    }
+}
+
+} // namespace MUtils
@@ -0,0 +1,467 @@
+#include <catch2/catch_all.hpp>
+
+#include <concurrentqueue/concurrentqueue.h>
+
+#include "mutils/thread/thread_utils.h"
+#include "mutils/time/profiler.h"
+
+using namespace MUtils;
+
+namespace
+{
+// A note/parameter event; the usual thing we send to the audio thread
+struct SmallMessage
+{
+    uint32_t type;
+    uint32_t id;
+    double value;
+};
+
+// A block of parameter values
+struct LargeMessage
+{
+    uint64_t time;
+    float values[14];
+};
+} // namespace
+
+TEST_CASE("Ring.SPSC", "[Ring]")
+{
+    spsc_ring<int> ring(5);
+    REQUIRE(ring.capacity() == 8);
+
+    int value = 0;
+    REQUIRE(!ring.try_pop(value));
+
+    for (int i = 0; i < 8; i++)
+    {
+        REQUIRE(ring.try_push(i));
+    }
+    REQUIRE(!ring.try_push(8));
+    REQUIRE(ring.size_approx() == 8);
+
+    REQUIRE(ring.try_pop(value));
+    REQUIRE(value == 0);
+
+    // Bulk pushes wrap around the end
+    int values[4] = { 8, 9, 10, 11 };
+    REQUIRE(ring.try_push_bulk(values, 4) == 1);
+
+    int out[16];
+    REQUIRE(ring.try_pop_bulk(out, 16) == 8);
+    for (int i = 0; i < 8; i++)
+    {
+        REQUIRE(out[i] == i + 1);
+    }
+}
+
+TEST_CASE("Ring.SPSCThreads", "[Ring]")
+{
+    spsc_ring<uint64_t> ring(64);
+    const uint64_t Count = 200000;
+
+    std::thread producer([&]() {
+        uint64_t next = 0;
+        uint64_t batch[7];
+        while (next < Count)
+        {
+            auto n = std::min(uint64_t(7), Count - next);
+            for (uint64_t i = 0; i < n; i++)
+            {
+                batch[i] = next + i;
+            }
+            next += ring.try_push_bulk(batch, size_t(n));
+        }
+    });
+
+    uint64_t expected = 0;
+    bool ordered = true;
+    uint64_t batch[5];
+    while (expected < Count)
+    {
+        auto n = ring.try_pop_bulk(batch, 5);
+        for (size_t i = 0; i < n; i++)
+        {
+            ordered &= batch[i] == expected++;
+        }
+    }
+    producer.join();
+    REQUIRE(ordered);
+}
+
+TEST_CASE("Ring.MPSC", "[Ring]")
+{
+    mpsc_ring<uint64_t> ring(128);
+    const uint64_t PerProducer = 50000;
+    const uint64_t Producers = 4;
+
+    std::vector<std::thread> producers;
+    for (uint64_t p = 0; p < Producers; p++)
+    {
+        producers.emplace_back([&, p]() {
+            uint64_t batch[3];
+            uint64_t next = 0;
+            while (next < PerProducer)
+            {
+                auto n = std::min(uint64_t(3), PerProducer - next);
+                for (uint64_t i = 0; i < n; i++)
+                {
+                    batch[i] = (p << 32) | (next + i);
+                }
+                next += ring.try_push_bulk(batch, size_t(n));
+            }
+        });
+    }
+
+    // Each producer's values must arrive in order
+    std::vector<uint64_t> nextExpected(Producers, 0);
+    bool ordered = true;
+    uint64_t received = 0;
+    uint64_t batch[16];
+    while (received < PerProducer * Producers)
+    {
+        auto n = ring.try_pop_bulk(batch, 16);
+        for (size_t i = 0; i < n; i++)
+        {
+            auto producer = batch[i] >> 32;
+            ordered &= (batch[i] & 0xFFFFFFFF) == nextExpected[producer]++;
+        }
+        received += n;
+    }
+
+    for (auto& t : producers)
+    {
+        t.join();
+    }
+    REQUIRE(ordered);
+    REQUIRE(ring.size_approx() == 0);
+}
+
+TEST_CASE("Seqlock.Consistent", "[Seqlock]")
+{
+    struct State
+    {
+        double a;
+        double b;
+        uint64_t c;
+        uint8_t tail[3];
+    };
+
+    seqlock<State> lock(State{ 1.0, 2.0, 3, { 0, 0, 0 } });
+    REQUIRE(lock.load().c == 3);
+
+    std::atomic_bool done = false;
+    std::thread writer([&]() {
+        for (uint64_t i = 0; i < 100000; i++)
+        {
+            lock.store(State{ double(i), double(i) * 2.0, i * 3, { uint8_t(i), uint8_t(i), uint8_t(i) } });
+        }
+        done = true;
+    });
+
+    bool consistent = true;
+    uint64_t reads = 0;
+    while (!done || reads == 0)
+    {
+        auto state = lock.load();
+        consistent &= (state.b == state.a * 2.0) && (state.c == uint64_t(state.a) * 3) && (state.tail[0] == state.tail[2]);
+        reads++;
+    }
+    writer.join();
+
+    REQUIRE(consistent);
+    REQUIRE(lock.load().c == 99999 * 3);
+    REQUIRE(lock.sequence() == 200000);
+}
+
+TEST_CASE("TripleBuffer.Basic", "[TripleBuffer]")
+{
+    triple_buffer<int> buffer(-1);
+
+    int value = 0;
+    REQUIRE(!buffer.read(value));
+    REQUIRE(value == -1);
+
+    // Reader only sees the latest
+    buffer.write(1);
+    buffer.write(2);
+    REQUIRE(buffer.read(value));
+    REQUIRE(value == 2);
+    REQUIRE(!buffer.read(value));
+    REQUIRE(value == 2);
+
+    // Index swapping version
+    buffer.write_buffer() = 3;
+    REQUIRE(!buffer.update());
+    buffer.publish();
+    REQUIRE(buffer.update());
+    REQUIRE(buffer.read_buffer() == 3);
+}
+
+TEST_CASE("TripleBuffer.Threads", "[TripleBuffer]")
+{
+    // A meter block; big enough that copying would tear if the buffers were shared
+    struct Meters
+    {
+        uint64_t frame;
+        float levels[256];
+    };
+
+    auto spBuffer = std::make_unique<triple_buffer<Meters>>(Meters{});
+    auto& buffer = *spBuffer;
+    const uint64_t Frames = 20000;
+
+    std::thread writer([&]() {
+        for (uint64_t frame = 1; frame <= Frames; frame++)
+        {
+            auto& meters = buffer.write_buffer();
+            meters.frame = frame;
+            std::fill(std::begin(meters.levels), std::end(meters.levels), float(frame));
+            buffer.publish();
+        }
+    });
+
+    bool consistent = true;
+    uint64_t lastFrame = 0;
+    while (lastFrame != Frames)
+    {
+        if (!buffer.update())
+        {
+            continue;
+        }
+
+        auto& meters = buffer.read_buffer();
+        consistent &= meters.frame > lastFrame;
+        consistent &= std::all_of(std::begin(meters.levels), std::end(meters.levels), [&](float v) { return v == float(meters.frame); });
+        lastFrame = meters.frame;
+    }
+    writer.join();
+
+    REQUIRE(consistent);
+}
+
+namespace
+{
+template <typename TMutex>
+uint64_t hammer_mutex(TMutex& mutex, int threads, int iterations)
+{
+    uint64_t counter = 0;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]() {
+            for (int i = 0; i < iterations; i++)
+            {
+                std::lock_guard<TMutex> lock(mutex);
+                counter++;
+            }
+        });
+    }
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+    return counter;
+}
+} // namespace
+
+TEST_CASE("HybridMutex.Basic", "[HybridMutex]")
+{
+    hybrid_mutex mutex(HybridMutexFlags::Stats);
+    REQUIRE(mutex.try_lock());
+    REQUIRE(!mutex.try_lock());
+    mutex.unlock();
+
+    {
+        LOCK_GUARD(mutex, Guarded);
+        REQUIRE(!mutex.try_lock());
+    }
+    REQUIRE(mutex.try_lock());
+    mutex.unlock();
+
+    REQUIRE(mutex.GetStats().locks == 3);
+    REQUIRE(mutex.GetStats().contended == 0);
+}
+
+TEST_CASE("HybridMutex.Contended", "[HybridMutex]")
+{
+    auto flags = GENERATE(uint32_t(HybridMutexFlags::Stats), uint32_t(HybridMutexFlags::Stats | HybridMutexFlags::PriorityInherit));
+
+    hybrid_mutex mutex(flags, "Test");
+    REQUIRE(hammer_mutex(mutex, 4, 20000) == 80000);
+
+    auto& stats = mutex.GetStats();
+    REQUIRE(stats.locks == 80000);
+    REQUIRE(stats.contended <= stats.locks);
+    REQUIRE(stats.parks <= stats.contended);
+}
+
+TEST_CASE("HybridMutex.Parks", "[HybridMutex]")
+{
+    hybrid_mutex mutex(HybridMutexFlags::Stats);
+    mutex.lock();
+
+    // Held for much longer than the spin, so the waiter has to sleep
+    std::thread waiter([&]() {
+        mutex.lock();
+        mutex.unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    mutex.unlock();
+    waiter.join();
+
+    REQUIRE(mutex.GetStats().contended == 1);
+    REQUIRE(mutex.GetStats().parks == 1);
+    REQUIRE(mutex.GetStats().waitNs > 0);
+}
+
+TEST_CASE("HybridMutex.Benchmark", "[HybridMutex][!benchmark]")
+{
+    const int Threads = 4;
+    const int Iterations = 10000;
+
+    BENCHMARK("std::mutex")
+    {
+        std::mutex mutex;
+        return hammer_mutex(mutex, Threads, Iterations);
+    };
+
+    BENCHMARK("audio_spin_mutex")
+    {
+        audio_spin_mutex mutex;
+        return hammer_mutex(mutex, Threads, Iterations);
+    };
+
+    BENCHMARK("hybrid_mutex")
+    {
+        hybrid_mutex mutex;
+        return hammer_mutex(mutex, Threads, Iterations);
+    };
+
+    BENCHMARK("hybrid_mutex priority inherit")
+    {
+        hybrid_mutex mutex(HybridMutexFlags::PriorityInherit);
+        return hammer_mutex(mutex, Threads, Iterations);
+    };
+}
+
+namespace
+{
+template <typename TMessage, typename TPush, typename TPop>
+uint64_t ping_messages(uint64_t count, TPush&& push, TPop&& pop)
+{
+    std::thread producer([&]() {
+        TMessage msg{};
+        for (uint64_t i = 0; i < count; i++)
+        {
+            while (!push(msg))
+            {
+                _mm_pause();
+            }
+        }
+    });
+
+    TMessage msg;
+    uint64_t received = 0;
+    while (received < count)
+    {
+        if (pop(msg))
+        {
+            received++;
+        }
+    }
+    producer.join();
+    return received;
+}
+} // namespace
+
+TEST_CASE("Ring.Benchmark", "[Ring][!benchmark]")
+{
+    const uint64_t Count = 100000;
+
+    BENCHMARK("spsc_ring small")
+    {
+        spsc_ring<SmallMessage> ring(1024);
+        return ping_messages<SmallMessage>(
+            Count, [&](const SmallMessage& m) { return ring.try_push(m); }, [&](SmallMessage& m) { return ring.try_pop(m); });
+    };
+
+    BENCHMARK("mpsc_ring small")
+    {
+        mpsc_ring<SmallMessage> ring(1024);
+        return ping_messages<SmallMessage>(
+            Count, [&](const SmallMessage& m) { return ring.try_push(m); }, [&](SmallMessage& m) { return ring.try_pop(m); });
+    };
+
+    BENCHMARK("ConcurrentQueue small")
+    {
+        moodycamel::ConcurrentQueue<SmallMessage> queue(1024);
+        return ping_messages<SmallMessage>(
+            Count, [&](const SmallMessage& m) { return queue.enqueue(m); }, [&](SmallMessage& m) { return queue.try_dequeue(m); });
+    };
+
+    BENCHMARK("spsc_ring large")
+    {
+        spsc_ring<LargeMessage> ring(1024);
+        return ping_messages<LargeMessage>(
+            Count, [&](const LargeMessage& m) { return ring.try_push(m); }, [&](LargeMessage& m) { return ring.try_pop(m); });
+    };
+
+    BENCHMARK("mpsc_ring large")
+    {
+        mpsc_ring<LargeMessage> ring(1024);
+        return ping_messages<LargeMessage>(
+            Count, [&](const LargeMessage& m) { return ring.try_push(m); }, [&](LargeMessage& m) { return ring.try_pop(m); });
+    };
+
+    BENCHMARK("ConcurrentQueue large")
+    {
+        moodycamel::ConcurrentQueue<LargeMessage> queue(1024);
+        return ping_messages<LargeMessage>(
+            Count, [&](const LargeMessage& m) { return queue.enqueue(m); }, [&](LargeMessage& m) { return queue.try_dequeue(m); });
+    };
+
+    BENCHMARK("spsc_ring small bulk")
+    {
+        spsc_ring<SmallMessage> ring(1024);
+        std::thread producer([&]() {
+            SmallMessage batch[32] = {};
+            uint64_t sent = 0;
+            while (sent < Count)
+            {
+                sent += ring.try_push_bulk(batch, size_t(std::min(uint64_t(32), Count - sent)));
+            }
+        });
+        SmallMessage batch[32];
+        uint64_t received = 0;
+        while (received < Count)
+        {
+            received += ring.try_pop_bulk(batch, 32);
+        }
+        producer.join();
+        return received;
+    };
+
+    BENCHMARK("ConcurrentQueue small bulk")
+    {
+        moodycamel::ConcurrentQueue<SmallMessage> queue(1024);
+        std::thread producer([&]() {
+            SmallMessage batch[32] = {};
+            uint64_t sent = 0;
+            while (sent < Count)
+            {
+                auto n = size_t(std::min(uint64_t(32), Count - sent));
+                queue.enqueue_bulk(batch, n);
+                sent += n;
+            }
+        });
+        SmallMessage batch[32];
+        uint64_t received = 0;
+        while (received < Count)
+        {
+            received += queue.try_dequeue_bulk(batch, 32);
+        }
+        producer.join();
+        return received;
+    };
+}
@@ -0,0 +1,214 @@
+#include <emmintrin.h>
+
+#include <mutils/thread/futex.h>
+#include <mutils/thread/thread_config.h>
+#include <mutils/thread/work_pool.h>
+
+namespace MUtils
+{
+
+namespace
+{
+const uint32_t NotAWorker = 0xFFFFFFFF;
+
+// Spin this many times looking for work before parking
+const uint32_t IdleSpinCount = 64;
+
+thread_local WorkStealingPool* t_pPool = nullptr;
+thread_local uint32_t t_workerIndex = NotAWorker;
+thread_local uint32_t t_stealSeed = 0x9E3779B9;
+
+uint32_t NextRandom()
+{
+    // xorshift; just to spread the thieves over the victims
+    auto x = t_stealSeed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    t_stealSeed = x;
+    return x;
+}
+} // namespace
+
+WorkStealingPool::WorkStealingPool(size_t threads_n)
+    : m_itemPool(256)
+{
+    m_itemPool.SetName("WorkItems");
+
+    // If not enough threads, the pool will just execute all tasks immediately
+    if (threads_n > 1)
+    {
+        m_workers.reserve(threads_n);
+        for (size_t i = 0; i < threads_n; i++)
+        {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        // Start them after the vector is complete, since workers steal from each other
+        for (uint32_t i = 0; i < uint32_t(threads_n); i++)
+        {
+            m_workers[i]->thread = std::thread([this, i]() {
+                WorkerLoop(i);
+            });
+        }
+    }
+}
+
+WorkStealingPool& WorkStealingPool::Instance()
+{
+    static WorkStealingPool pool;
+    return pool;
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    StopAll();
+}
+
+void WorkStealingPool::StopAll()
+{
+    m_stop.store(true);
+    m_wakeEpoch.fetch_add(1);
+    futex_wake_all(m_wakeEpoch);
+
+    for (auto& spWorker : m_workers)
+    {
+        if (spWorker->thread.joinable())
+        {
+            spWorker->thread.join();
+        }
+    }
+}
+
+void WorkStealingPool::Submit(WorkItem* pItem)
+{
+    if (t_pPool == this)
+    {
+        if (!m_workers[t_workerIndex]->deque.Push(pItem))
+        {
+            m_injected.enqueue(pItem);
+        }
+    }
+    else
+    {
+        m_injected.enqueue(pItem);
+    }
+
+    // Pairs with the fence in the sleeper's increment of m_sleepers; either it sees the new item, or we see it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) > 0)
+    {
+        m_wakeEpoch.fetch_add(1, std::memory_order_release);
+        futex_wake_one(m_wakeEpoch);
+    }
+}
+
+WorkItem* WorkStealingPool::FindWork(uint32_t workerIndex)
+{
+    WorkItem* pItem = nullptr;
+    if (workerIndex != NotAWorker)
+    {
+        pItem = m_workers[workerIndex]->deque.Pop();
+        if (pItem)
+        {
+            return pItem;
+        }
+    }
+
+    if (m_injected.try_dequeue(pItem))
+    {
+        return pItem;
+    }
+
+    // Steal; keep going round while we lose races, since then there is work left somewhere
+    auto count = uint32_t(m_workers.size());
+    bool aborted = true;
+    while (aborted)
+    {
+        aborted = false;
+        auto start = NextRandom();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            auto victim = (start + i) % count;
+            if (victim == workerIndex)
+            {
+                continue;
+            }
+
+            pItem = m_workers[victim]->deque.Steal(&aborted);
+            if (pItem)
+            {
+                return pItem;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void WorkStealingPool::Execute(WorkItem* pItem)
+{
+    pItem->task();
+
+    // Release the captures now rather than when the item is reused
+    pItem->task = nullptr;
+    m_itemPool.Free(pItem);
+}
+
+bool WorkStealingPool::TryRunOne()
+{
+    auto pItem = FindWork(t_pPool == this ? t_workerIndex : NotAWorker);
+    if (!pItem)
+    {
+        return false;
+    }
+    Execute(pItem);
+    return true;
+}
+
+void WorkStealingPool::WorkerLoop(uint32_t workerIndex)
+{
+    thread_configure(ThreadConfig::Worker());
+
+    t_pPool = this;
+    t_workerIndex = workerIndex;
+    t_stealSeed += workerIndex * 0x6D2B79F5;
+
+    for (;;)
+    {
+        auto pItem = FindWork(workerIndex);
+        for (uint32_t spin = 0; !pItem && spin < IdleSpinCount; spin++)
+        {
+            _mm_pause();
+            pItem = FindWork(workerIndex);
+        }
+
+        if (!pItem)
+        {
+            // Announce we are going to sleep, then look once more before doing it.
+            // A submit after this point will see us and bump the epoch, so the wait can't miss it
+            auto epoch = m_wakeEpoch.load(std::memory_order_acquire);
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+
+            pItem = FindWork(workerIndex);
+            if (!pItem)
+            {
+                if (m_stop.load())
+                {
+                    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+                futex_wait(m_wakeEpoch, epoch);
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+
+            if (!pItem)
+            {
+                continue;
+            }
+        }
+
+        Execute(pItem);
+    }
+}
+
+} // namespace MUtils
@@ -0,0 +1,154 @@
+#include <catch2/catch_all.hpp>
+
+#include <atomic>
+#include <vector>
+
+#include <threadpool/threadpool.h>
+
+#include "mutils/thread/work_pool.h"
+
+using namespace MUtils;
+
+TEST_CASE("WorkPool.Enqueue", "[WorkPool]")
+{
+    WorkStealingPool pool(4);
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 1000; i++)
+    {
+        results.push_back(pool.enqueue([](int val) { return val * 2; }, i));
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        REQUIRE(results[i].get() == i * 2);
+    }
+}
+
+TEST_CASE("WorkPool.NestedRun", "[WorkPool]")
+{
+    WorkStealingPool pool(4);
+
+    // Tasks spawned from workers go on their own deques and get stolen
+    std::atomic<int> count = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        pool.run([&]() {
+            for (int child = 0; child < 100; child++)
+            {
+                pool.run([&]() { count++; });
+            }
+        });
+    }
+
+    while (count.load() != 100 * 100)
+    {
+        pool.TryRunOne();
+    }
+    REQUIRE(count.load() == 100 * 100);
+}
+
+TEST_CASE("WorkPool.SingleThread", "[WorkPool]")
+{
+    // Like TPool, no workers means the task runs immediately
+    WorkStealingPool pool(1);
+    REQUIRE(pool.WorkerCount() == 0);
+
+    auto thread = std::this_thread::get_id();
+    auto result = pool.enqueue([]() { return std::this_thread::get_id(); });
+    REQUIRE(is_future_ready(result));
+    REQUIRE(result.get() == thread);
+}
+
+TEST_CASE("WorkPool.Deque", "[WorkPool]")
+{
+    WorkStealingDeque<int> deque(4);
+    int values[5] = { 0, 1, 2, 3, 4 };
+    for (int i = 0; i < 4; i++)
+    {
+        REQUIRE(deque.Push(&values[i]));
+    }
+    REQUIRE_FALSE(deque.Push(&values[4]));
+
+    // Owner is LIFO, thieves are FIFO
+    REQUIRE(deque.Pop() == &values[3]);
+    REQUIRE(deque.Steal() == &values[0]);
+    REQUIRE(deque.Pop() == &values[2]);
+    REQUIRE(deque.Pop() == &values[1]);
+    REQUIRE(deque.Pop() == nullptr);
+    REQUIRE(deque.Empty());
+}
+
+TEST_CASE("WorkPool.Benchmark", "[WorkPool][!benchmark]")
+{
+    const int TaskCount = 10000;
+    auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+    TPool tpool(threads);
+    WorkStealingPool wspool(threads);
+
+    BENCHMARK("TPool enqueue")
+    {
+        std::vector<std::future<int>> results;
+        results.reserve(TaskCount);
+        for (int i = 0; i < TaskCount; i++)
+        {
+            results.push_back(tpool.enqueue([i]() { return i; }));
+        }
+        int total = 0;
+        for (auto& res : results)
+        {
+            total += res.get();
+        }
+        return total;
+    };
+
+    BENCHMARK("WorkStealingPool enqueue")
+    {
+        std::vector<std::future<int>> results;
+        results.reserve(TaskCount);
+        for (int i = 0; i < TaskCount; i++)
+        {
+            results.push_back(wspool.enqueue([i]() { return i; }));
+        }
+        int total = 0;
+        for (auto& res : results)
+        {
+            total += res.get();
+        }
+        return total;
+    };
+
+    BENCHMARK("WorkStealingPool run")
+    {
+        std::atomic<int> count = 0;
+        for (int i = 0; i < TaskCount; i++)
+        {
+            wspool.run([&count]() { count++; });
+        }
+        while (count.load() != TaskCount)
+        {
+            wspool.TryRunOne();
+        }
+        return count.load();
+    };
+
+    BENCHMARK("WorkStealingPool nested run")
+    {
+        std::atomic<int> count = 0;
+        for (int i = 0; i < 100; i++)
+        {
+            wspool.run([&]() {
+                for (int child = 0; child < TaskCount / 100; child++)
+                {
+                    wspool.run([&count]() { count++; });
+                }
+            });
+        }
+        while (count.load() != TaskCount)
+        {
+            wspool.TryRunOne();
+        }
+        return count.load();
+    };
+}
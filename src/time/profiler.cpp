@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <map>
 
 #include <mutils/math/imgui_glm.h>
 #include <mutils/math/math_utils.h>
@@ -62,12 +63,19 @@ std::mutex gMutex;
 std::atomic<uint64_t> gProfilerGeneration = 0;
 thread_local int gThreadIndexTLS = -1;
 thread_local uint64_t gGenerationTLS = -1;
+
+// Kept across pauses and restarts, so a thread only needs naming once
+thread_local std::string gThreadNameTLS;
 float gMaxThreadNameSize = 0;
 
 std::vector<ThreadData> gThreadData;
 std::vector<Frame> gFrameData;
 std::vector<Region> gRegionData;
 
+// Counters are independent of the paused state; they just show the latest values
+std::mutex gCounterMutex;
+std::map<std::string, double> gCounters;
+
 int64_t gMaxFrameTime = duration_cast<nanoseconds>(milliseconds(20)).count();
 uint32_t gCurrentFrame = 0;
 int32_t gSelectedThread = -1;
@@ -165,6 +173,10 @@ void InitThread()
             gGenerationTLS = gProfilerGeneration;
             threadData->currentEntry = 0;
             threadData->initialized = true;
+            if (!gThreadNameTLS.empty())
+            {
+                threadData->name = gThreadNameTLS;
+            }
 
             return;
         }
@@ -357,6 +369,29 @@ void PopSection()
     threadData->maxTime = std::max(profilerEntry->endTime, threadData->maxTime);
 }
 
+void SetCounter(const char* pszName, double value)
+{
+    std::unique_lock<std::mutex> lk(gCounterMutex);
+    gCounters[pszName] = value;
+}
+
+void ShowCounters()
+{
+    std::unique_lock<std::mutex> lk(gCounterMutex);
+    if (gCounters.empty())
+    {
+        return;
+    }
+
+    if (ImGui::CollapsingHeader("Counters"))
+    {
+        for (auto& [name, value] : gCounters)
+        {
+            ImGui::Text("%s: %s", name.c_str(), fmt::format("{:.2f}", value).c_str());
+        }
+    }
+}
+
 void SetRegionLimit(uint64_t maxTimeNs)
 {
     gRegionTimeLimit = maxTimeNs;
@@ -364,6 +399,7 @@ void SetRegionLimit(uint64_t maxTimeNs)
 
 void NameThread(const char* pszName)
 {
+    gThreadNameTLS = pszName;
     if (gPaused)
     {
         return;
@@ -849,6 +885,8 @@ void ShowProfile(bool* opened)
     ImGui::PushItemWidth(100 * dpi.scaleFactorXY.x);
     ImGui::SliderFloat("Scale", &scale, .5f, 1.0f, "%.2f");
 
+    ShowCounters();
+
     // Ignore the first frame, which is likely a long delay due to
     // the time that expires after this profiler is created and the first
     // frame is drawn
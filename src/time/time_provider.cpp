@@ -58,14 +58,16 @@ void TimeProvider::StartThread()
 
     // A thread which wakes up and ticks
     m_quitTimer = false;
-    m_tickThread = std::thread([&]() {
+    m_tickThread = std::thread([&, config = m_threadConfig]() {
+        thread_configure(config);
+
         for (;;)
         {
             PROFILE_NAME_THREAD(Time_Provider);
 
             // Beat at regular intervals, no matter how long our operation takes
             auto startTime = TimeProvider::Instance().Now();
-            auto nextTime = startTime + m_timePerBeat;
+            auto nextTime = startTime + m_tempoState.load().timePerBeat;
             auto beat = m_beat.load();
             auto frame = m_frame.load();
 
@@ -73,8 +75,10 @@ void TimeProvider::StartThread()
                 PROFILE_SCOPE(TP_Beat);
                 LOCK_GUARD(m_spin_mutex, TP_Lock);
 
-                m_lastTime = startTime;
-                m_lastBeat = beat;
+                m_tempoState.update([&](TempoState& state) {
+                    state.lastTime = startTime;
+                    state.lastBeat = beat;
+                });
 
                 for (auto& consumer : m_consumers)
                 {
@@ -95,6 +99,11 @@ void TimeProvider::StartThread()
     });
 }
 
+void TimeProvider::SetThreadConfig(const ThreadConfig& config)
+{
+    m_threadConfig = config;
+}
+
 void TimeProvider::EndThread()
 {
     m_quitTimer = true;
@@ -104,13 +113,13 @@ void TimeProvider::EndThread()
     }
 }
 
-double TimeProvider::GetBeatAtTime(TimePoint time)
+double TimeProvider::GetBeatAtTime(TimePoint time) const
 {
-    auto d = duration_cast<microseconds>(time - m_lastTime).count();
-    auto beat = m_lastBeat.load();
+    auto state = m_tempoState.load();
+    auto d = duration_cast<microseconds>(time - state.lastTime).count();
 
-    auto beatsPerTime = (double)d / (double)duration_cast<microseconds>(GetTimePerBeat()).count();
-    return beat + beatsPerTime;
+    auto beatsPerTime = (double)d / (double)state.timePerBeat.count();
+    return state.lastBeat + beatsPerTime;
 }
 
 // TODO:
@@ -124,20 +133,22 @@ double TimeProvider::GetBeat() const
 
 double TimeProvider::GetTempo() const
 {
-    return m_tempo;
+    return m_tempoState.load().tempo;
 }
 
 double TimeProvider::GetQuantum() const
 {
-    return m_quantum;
+    return m_tempoState.load().quantum;
 }
 
 void TimeProvider::SetTempo(double tempo, double quantum)
 {
     LOCK_GUARD(m_spin_mutex, TP_Lock);
-    m_quantum = quantum;
-    m_tempo = tempo;
-    m_timePerBeat = microseconds((uint64_t)(60000000.0 / tempo));
+    m_tempoState.update([&](TempoState& state) {
+        state.quantum = quantum;
+        state.tempo = tempo;
+        state.timePerBeat = microseconds((uint64_t)(60000000.0 / tempo));
+    });
 }
 
 void TimeProvider::SetBeat(double beat)
@@ -159,7 +170,7 @@ uint32_t TimeProvider::GetFrame() const
 
 std::chrono::microseconds TimeProvider::GetTimePerBeat() const
 {
-    return m_timePerBeat;
+    return m_tempoState.load().timePerBeat;
 }
 
 } // namespace MUtils
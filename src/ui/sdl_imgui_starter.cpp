@@ -7,6 +7,9 @@
 
 #include "mutils/file/runtree.h"
 #include "mutils/logger/logger.h"
+#include "mutils/thread/future.h"
+#include "mutils/thread/mempool.h"
+#include "mutils/thread/thread_utils.h"
 #include "mutils/time/profiler.h"
 #include "mutils/time/timer.h"
 #include "mutils/ui/dpi.h"
@@ -207,6 +210,11 @@ int sdl_imgui_start(int argCount, char** ppArgs, not_null<IAppStarterClient*> pC
         foundEvents = false;
 
         MUtils::Profiler::NewFrame();
+        MUtils::mempool_profile_counters();
+        MUtils::hybrid_mutex_profile_counters();
+
+        // Continuations sent to the main thread
+        MUtils::QueueExecutor::MainThread().RunPending();
 
         int w, h;
         SDL_GetWindowSize(window, &w, &h);
@@ -1,8 +1,14 @@
 #include <catch.hpp>
 
+#include <chrono>
+#include <fstream>
 #include <variant>
 
 #include "mutils/vm/vm.h"
+#include "mutils/vm/vm_batch.h"
+#include "mutils/vm/vm_module.h"
+#include "mutils/vm/vm_optimize.h"
+#include "mutils/thread/parallel.h"
 
 using namespace MUtils;
 
@@ -51,5 +57,918 @@ TEST_CASE("VM.Foo.Bar", "[VM]")
         pVM->Run(pEntry.get());
         REQUIRE(pVM->RegAs<int>(0) == 6);
     }
+
+    SECTION("MoveRegister")
+    {
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R1, 3 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R0, VM_Reg::R1 });
+        pVM->Run(pEntry.get());
+        REQUIRE(pVM->RegAs<int>(0) == 3);
+    }
+
+    SECTION("Add")
+    {
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R0, 6 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R1, 2 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R0, VM_Reg::R1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R0, 1 });
+        pVM->Run(pEntry.get());
+        REQUIRE(pVM->RegAs<int>(0) == 9);
+    }
+
+    SECTION("Call")
+    {
+        // sum(a, b) falls off the end, which is an implicit return
+        auto pSum = std::make_shared<TVM::VFunction>();
+        pSum->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R0, VM_Reg::R1 });
+        pVM->AddFunction("sum", pSum);
+
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 4 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 5 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 2 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("sum") });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R0, 1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Ret });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R0, 0 });
+
+        SECTION("Fast")
+        {
+            pVM->Run(pEntry.get());
+        }
+        SECTION("Traced")
+        {
+            pVM->TraceToLog();
+            pVM->Run(pEntry.get());
+            REQUIRE(str.str().find("CALL") != std::string::npos);
+        }
+        REQUIRE(pVM->RegAs<int>(0) == 10);
+        REQUIRE(pVM->m_context.m_sp == 0);
+        REQUIRE(pVM->m_context.m_callStack.empty());
+    }
+
+    SECTION("Nested")
+    {
+        // Each level calls the next, leaving junk on the stack which the return drops
+        const int depth = 20;
+        for (int level = 0; level < depth; level++)
+        {
+            auto pFn = std::make_shared<TVM::VFunction>();
+            pFn->instructions.push_back(TVM::VInstruction{ VM_IType::Push, std::string("junk") });
+            if (level < depth - 1)
+            {
+                pFn->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 0 });
+                pFn->instructions.push_back(TVM::VInstruction{ VM_IType::Call, "level" + std::to_string(level + 1) });
+            }
+            pFn->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R3, 1 });
+            pVM->AddFunction("level" + std::to_string(level), pFn);
+        }
+
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R3, 0 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 0 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("level0") });
+        pVM->Run(pEntry.get());
+        REQUIRE(pVM->RegAs<int>(3) == depth);
+        REQUIRE(pVM->m_context.m_sp == 0);
+
+        // Again, after editing the program
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R3, 1 });
+        pVM->Run(pEntry.get());
+        REQUIRE(pVM->RegAs<int>(3) == depth + 1);
+    }
+
+    SECTION("Native")
+    {
+        pVM->AddNativeFunction("double", [&](uint32_t argCount) {
+            REQUIRE(argCount == 1);
+            return TValue(pVM->RegAs<int>(0) * 2);
+        });
+
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 7 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("double") });
+        pVM->Run(pEntry.get());
+        REQUIRE(pVM->RegAs<int>(0) == 14);
+    }
+
+    SECTION("Link")
+    {
+        auto pSum = std::make_shared<TVM::VFunction>();
+        pSum->arity = 2;
+        pSum->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R0, VM_Reg::R1 });
+        pVM->AddFunction("sum", pSum);
+        pVM->AddNativeFunction("negate", [](uint32_t) { return TValue(0); }, 1);
+
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 2 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("sum") });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 3 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("negate") });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 0 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("missing") });
+
+        auto errors = pVM->Link();
+        REQUIRE(errors.size() == 2);
+        REQUIRE(errors[0] == "main:3: 'negate' takes 1 arguments, called with 3");
+        REQUIRE(errors[1] == "main:5: Unresolved function 'missing'");
+        REQUIRE(pEntry->instructions[1].target == 1);
+        REQUIRE(pEntry->instructions[3].target == TVM::InvalidTarget);
+
+        // One compiled instruction each, plus the End
+        REQUIRE(pEntry->code.size() == 7);
+        REQUIRE(pEntry->code[0].op == VM_Op::PushConst);
+        REQUIRE(pEntry->code[1].op == VM_Op::Call);
+        REQUIRE(pEntry->code[6].op == VM_Op::End);
+
+        // Looking up doesn't create
+        REQUIRE(pVM->FindFunction("missing") == nullptr);
+        REQUIRE(pVM->m_functions.size() == 3);
+        // Run anyway, a context stops at the unresolved call
+        auto pBad = std::make_shared<TVM::VFunction>();
+        pBad->instructions.push_back(TVM::VInstruction{ VM_IType::CallArgs, std::string("missing"), 0 });
+        pVM->AddFunction("bad", pBad);
+        REQUIRE(pVM->Link().size() == 3);
+
+        VMContext<TValue> context(*pVM);
+        REQUIRE(!context.Run(pBad.get()));
+        REQUIRE(context.m_fault == VM_Fault::BadCall);
+        REQUIRE(context.m_callStack.empty());
+
+        // The facade links first, and won't run a program with errors
+        pBad->instructions.push_back(TVM::VInstruction{ VM_IType::Ret });
+        REQUIRE(!pVM->Run(pBad.get()));
+        REQUIRE(str.str().find("Not running bad") != std::string::npos);
+        REQUIRE(!pVM->Run(pBad.get()));
+
+        // Fixed and linked by hand, it runs
+        pEntry->instructions.clear();
+        pBad->instructions = { TVM::VInstruction{ VM_IType::Ret } };
+        REQUIRE(pVM->Link().empty());
+        REQUIRE(pVM->Run(pBad.get()));
+    }
+
+    SECTION("LinkLimits")
+    {
+        // Operands the compiled code can't hold are link errors, not truncated
+        pVM->AddNativeFunction("any", [](uint32_t) { return TValue(0); });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg(TVM::MaxRegisters), 1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, VM_Reg(70000) });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Pop, 1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::CallArgs, std::string("any"), 0x10000 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::CallArgs, std::string("any"), std::string("two") });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg(TVM::MaxRegisters - 1), VM_Reg::R0 });
+
+        auto errors = pVM->Link();
+        REQUIRE(errors.size() == 5);
+        REQUIRE(errors[0] == "main:0: Register 1024 is out of range, registers go up to 1023");
+        REQUIRE(errors[1] == "main:1: Register 70000 is out of range, registers go up to 1023");
+        REQUIRE(errors[2] == "main:2: Operand is not a register");
+        REQUIRE(errors[3] == "main:3: Argument count is not an int from 0 to 65535");
+        REQUIRE(errors[4] == "main:4: Argument count is not an int from 0 to 65535");
+        REQUIRE(pEntry->instructions[3].target == TVM::InvalidTarget);
+        REQUIRE(pVM->RegisterCount() == TVM::MaxRegisters);
+
+        // Run directly, the bad instruction stops the run
+        VMContext<TValue> context(*pVM);
+        REQUIRE(!context.Run(pEntry.get()));
+        REQUIRE(context.m_fault == VM_Fault::BadCall);
+        REQUIRE(!pVM->Run(pEntry.get()));
+    }
 };
 
+namespace
+{
+using TCode = std::vector<TVM::VInstruction>;
+
+void DumpValue(std::ostringstream& str, const TValue& r)
+{
+    if (std::holds_alternative<int>(r))
+    {
+        str << std::get<int>(r);
+    }
+    else if (std::holds_alternative<VM_Reg>(r))
+    {
+        str << "R" << int(std::get<VM_Reg>(r));
+    }
+    else
+    {
+        str << std::get<std::string>(r);
+    }
+}
+
+// Code in the shape a front end tends to generate: values shuffled through the stack and temporaries,
+// argument counts pushed before each call
+void AddGeneratedProgram(TVM& vm)
+{
+    auto pSum = std::make_shared<TVM::VFunction>();
+    pSum->arity = 2;
+    pSum->instructions = TCode{
+        { VM_IType::Push, VM_Reg::R1 },
+        { VM_IType::Pop, VM_Reg::R2 },
+        { VM_IType::Add, VM_Reg::R0, VM_Reg::R2 },
+        { VM_IType::Ret },
+        { VM_IType::Mov, VM_Reg::R0, 0 }
+    };
+    vm.AddFunction("sum", pSum);
+
+    auto pMain = std::make_shared<TVM::VFunction>();
+    vm.AddFunction("main", pMain);
+    pMain->instructions.push_back({ VM_IType::Mov, VM_Reg::R5, 0 });
+    for (int i = 0; i < 20; i++)
+    {
+        auto code = TCode{
+            { VM_IType::Mov, VM_Reg::R3, 1 },
+            { VM_IType::Mov, VM_Reg::R3, 2 },
+            { VM_IType::Add, VM_Reg::R3, 3 },
+            { VM_IType::Mov, VM_Reg::R4, VM_Reg::R3 },
+            { VM_IType::Add, VM_Reg::R4, i },
+            { VM_IType::Push, VM_Reg::R4 },
+            { VM_IType::Pop, VM_Reg::R4 },
+            { VM_IType::Mov, VM_Reg::R4, VM_Reg::R4 },
+            { VM_IType::Push, VM_Reg::R4 },
+            { VM_IType::Push, VM_Reg::R5 },
+            { VM_IType::Push, 2 },
+            { VM_IType::Call, std::string("sum") },
+            { VM_IType::Mov, VM_Reg::R5, VM_Reg::R0 }
+        };
+        pMain->instructions.insert(pMain->instructions.end(), code.begin(), code.end());
+    }
+}
+
+uint32_t CountExecuted(TVM& vm)
+{
+    uint32_t count = 0;
+    vm.SetTraceHook([&](TVM&, const TVM::VInstruction&) { count++; });
+    vm.Run(vm.FindFunction("main"));
+    vm.SetTraceHook(nullptr);
+    return count;
+}
+} // namespace
+
+TEST_CASE("VM.Optimize", "[VM]")
+{
+    std::ostringstream str;
+    TVM vm(str, DumpValue);
+
+    auto pFn = std::make_shared<TVM::VFunction>();
+    vm.AddFunction("main", pFn);
+
+    SECTION("PushPop")
+    {
+        pFn->instructions = TCode{ { VM_IType::Push, VM_Reg::R0 }, { VM_IType::Pop, VM_Reg::R1 }, { VM_IType::Push, VM_Reg::R2 }, { VM_IType::Pop, VM_Reg::R2 } };
+        auto stats = vm_optimize(vm, *pFn, VMOptimizeFlags::Peephole);
+        REQUIRE(stats.instructionsAfter == 1);
+        REQUIRE(pFn->instructions[0].type == VM_IType::Mov);
+        REQUIRE(pFn->instructions[0].arg1 == TValue(VM_Reg::R1));
+        REQUIRE(pFn->instructions[0].arg2 == TValue(VM_Reg::R0));
+    }
+
+    SECTION("Unreachable")
+    {
+        pFn->instructions = TCode{ { VM_IType::Mov, VM_Reg::R0, 1 }, { VM_IType::Ret }, { VM_IType::Mov, VM_Reg::R0, 2 } };
+        vm_optimize(vm, *pFn);
+        REQUIRE(pFn->instructions.size() == 1);
+    }
+
+    SECTION("Fold")
+    {
+        pFn->instructions = TCode{
+            { VM_IType::Mov, VM_Reg::R0, 1 },
+            { VM_IType::Add, VM_Reg::R0, 2 },
+            { VM_IType::Mov, VM_Reg::R1, 3 },
+            { VM_IType::Add, VM_Reg::R0, VM_Reg::R1 }
+        };
+        auto stats = vm_optimize(vm, *pFn);
+        REQUIRE(stats.folded > 0);
+        REQUIRE(stats.deadMoves > 0);
+
+        // R1 is still visible after the run, so it has to be set
+        REQUIRE(pFn->instructions.size() == 2);
+        vm.Run(pFn.get());
+        REQUIRE(vm.RegAs<int>(0) == 6);
+        REQUIRE(vm.RegAs<int>(1) == 3);
+    }
+
+    SECTION("FoldStopsAtCalls")
+    {
+        vm.AddNativeFunction("set", [&](uint32_t) { return TValue(10); });
+        pFn->instructions = TCode{
+            { VM_IType::Mov, VM_Reg::R0, 1 },
+            { VM_IType::Push, 0 },
+            { VM_IType::Call, std::string("set") },
+            { VM_IType::Add, VM_Reg::R0, 1 }
+        };
+        auto stats = vm_optimize(vm, *pFn);
+        REQUIRE(stats.superInstructions == 1);
+        REQUIRE(pFn->instructions[1].type == VM_IType::CallArgs);
+        vm.Run(pFn.get());
+        REQUIRE(vm.RegAs<int>(0) == 11);
+    }
+
+    SECTION("FoldError")
+    {
+        // Add throws for strings; the fold is skipped rather than failing
+        pFn->instructions = TCode{ { VM_IType::Mov, VM_Reg::R0, std::string("a") }, { VM_IType::Add, VM_Reg::R0, 1 } };
+        vm_optimize(vm, *pFn);
+        REQUIRE(pFn->instructions.size() == 2);
+    }
+
+    SECTION("Program")
+    {
+        TVM generated(str, DumpValue);
+        TVM optimized(str, DumpValue);
+        AddGeneratedProgram(generated);
+        AddGeneratedProgram(optimized);
+
+        auto before = CountExecuted(generated);
+        auto stats = vm_optimize(optimized);
+        auto after = CountExecuted(optimized);
+
+        REQUIRE(stats.instructionsAfter < stats.instructionsBefore);
+        REQUIRE(after < before);
+        for (uint32_t reg = 0; reg < 6; reg++)
+        {
+            REQUIRE(generated.m_context.m_registers[reg] == optimized.m_context.m_registers[reg]);
+        }
+        REQUIRE(optimized.RegAs<int>(5) == 290);
+    }
+}
+
+namespace
+{
+// A type byte, then the value
+bool EncodeValue(std::string& data, const TValue& value)
+{
+    data += char(value.index());
+    if (std::holds_alternative<std::string>(value))
+    {
+        data += std::get<std::string>(value);
+    }
+    else if (std::holds_alternative<int>(value))
+    {
+        auto v = std::get<int>(value);
+        data.append((const char*)&v, sizeof(v));
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool DecodeValue(const uint8_t* pData, size_t size, TValue& value)
+{
+    if (size == 0)
+    {
+        return false;
+    }
+    if (pData[0] == 0)
+    {
+        value = std::string((const char*)pData + 1, size - 1);
+        return true;
+    }
+    if (pData[0] == 1 && size == 1 + sizeof(int))
+    {
+        int v;
+        memcpy(&v, pData + 1, sizeof(v));
+        value = v;
+        return true;
+    }
+    return false;
+}
+
+void AddNatives(TVM& vm)
+{
+    vm.AddNativeFunction("triple", [&vm](uint32_t) { return TValue(vm.RegAs<int>(0) * 3); }, 1);
+}
+} // namespace
+
+TEST_CASE("VM.Module", "[VM]")
+{
+    std::ostringstream str;
+    TVM vm(str, DumpValue);
+    AddNatives(vm);
+    AddGeneratedProgram(vm);
+    vm.FindFunction("main")->instructions.push_back({ VM_IType::Push, VM_Reg::R5 });
+    vm.FindFunction("main")->instructions.push_back({ VM_IType::Push, 1 });
+    vm.FindFunction("main")->instructions.push_back({ VM_IType::Call, std::string("triple") });
+    vm.FindFunction("main")->instructions.push_back({ VM_IType::Mov, VM_Reg::R6, std::string("done") });
+    vm.Run(vm.FindFunction("main"));
+    REQUIRE(vm.RegAs<int>(0) == 870);
+
+    std::string module;
+    REQUIRE(vm_module_write<TValue>(vm, EncodeValue, module).empty());
+
+    TVM loaded(str, DumpValue);
+    AddNatives(loaded);
+
+    SECTION("Memory")
+    {
+        // Copy into 8 byte aligned memory, as a mapping would be
+        auto spData = std::shared_ptr<uint64_t>(new uint64_t[(module.size() + 7) / 8], std::default_delete<uint64_t[]>());
+        memcpy(spData.get(), module.data(), module.size());
+        auto pData = (const uint8_t*)spData.get();
+
+        REQUIRE(vm_module_load<TValue>(loaded, pData, module.size(), spData, DecodeValue).empty());
+        auto pMain = loaded.FindFunction("main");
+        REQUIRE(pMain->external);
+        REQUIRE((const uint8_t*)pMain->pCode > pData);
+        REQUIRE((const uint8_t*)pMain->pCode < pData + module.size());
+
+        loaded.Run(pMain);
+        REQUIRE(loaded.RegAs<int>(0) == 870);
+        REQUIRE(loaded.RegAs<std::string>(6) == "done");
+
+        // Module code has no instructions, so the trace decompiles it; it should read the same as the script's
+        auto trace = [](TVM& traced) {
+            std::vector<std::string> lines;
+            traced.SetTraceHook([&](TVM& vm, const TVM::VInstruction& i) {
+                std::ostringstream line;
+                vm.DumpInstruction(line, i);
+
+                // And the next one, which reads the code past the instructions
+                if (!vm.m_context.m_callStack.empty())
+                {
+                    line << " / ";
+                    vm.DumpInstruction(line, vm.Instruction());
+                }
+                lines.push_back(line.str());
+            });
+            traced.Run(traced.FindFunction("main"));
+            traced.SetTraceHook(nullptr);
+            return lines;
+        };
+        auto lines = trace(loaded);
+        REQUIRE(lines.size() > 200);
+        REQUIRE(lines == trace(vm));
+
+        loaded.Dump();
+        REQUIRE(str.str().find("\nmain:\n0: MOV R5, 0\n") != std::string::npos);
+
+        // Script functions added later link against the module
+        auto pExtra = std::make_shared<TVM::VFunction>();
+        pExtra->instructions = TCode{ { VM_IType::Push, 0 }, { VM_IType::Call, std::string("main") }, { VM_IType::Add, VM_Reg::R0, 1 } };
+        loaded.AddFunction("extra", pExtra);
+        loaded.Run(pExtra.get());
+        REQUIRE(loaded.RegAs<int>(0) == 871);
+    }
+
+    SECTION("File")
+    {
+        auto path = fs::temp_directory_path() / "mutils_vm_module.bin";
+        {
+            std::ofstream out(path.string(), std::ios::binary);
+            out.write(module.data(), module.size());
+        }
+
+        REQUIRE(vm_module_load<TValue>(loaded, path, DecodeValue).empty());
+        loaded.Run(loaded.FindFunction("main"));
+        REQUIRE(loaded.RegAs<int>(0) == 870);
+        fs::remove(path);
+    }
+
+    SECTION("Errors")
+    {
+        auto load = [&](const std::string& data) {
+            auto spData = std::shared_ptr<uint64_t>(new uint64_t[(data.size() + 7) / 8], std::default_delete<uint64_t[]>());
+            memcpy(spData.get(), data.data(), data.size());
+            return vm_module_load<TValue>(loaded, (const uint8_t*)spData.get(), data.size(), spData, DecodeValue);
+        };
+
+        REQUIRE(load(module.substr(0, module.size() - 1)) == std::vector<std::string>{ "Truncated VM module" });
+        REQUIRE(load("nonsense, not a module, not at all") == std::vector<std::string>{ "Not a VM module" });
+
+        // Written on a machine with the other byte order
+        auto swapped = module;
+        std::reverse(swapped.begin(), swapped.begin() + 4);
+        REQUIRE(load(swapped) == std::vector<std::string>{ "VM module has the wrong byte order" });
+
+        // Point a call past the function table
+        VMModuleHeader header;
+        memcpy(&header, module.data(), sizeof(header));
+        auto bad = module;
+        auto pCode = (VCode*)&bad[header.codeOffset];
+        for (uint32_t index = 0; index < header.codeCount; index++)
+        {
+            if (pCode[index].op == VM_Op::CallArgs || pCode[index].op == VM_Op::Call)
+            {
+                pCode[index].operand = 100;
+                break;
+            }
+        }
+        REQUIRE(load(bad).size() == 1);
+
+        TVM noNatives(str, DumpValue);
+        auto spData = std::make_shared<std::string>(module);
+        REQUIRE(vm_module_load<TValue>(noNatives, (const uint8_t*)spData->data(), spData->size(), spData, DecodeValue) == std::vector<std::string>{ "Missing native function 'triple'" });
+
+        // Nothing changed
+        REQUIRE(loaded.m_functions.size() == 1);
+    }
+}
+
+TEST_CASE("VM.Contexts", "[VM]")
+{
+    // One program, run by a context per voice
+    using TProgram = VMProgram<TValue>;
+    using TContext = VMContext<TValue>;
+    TProgram program;
+
+    program.AddNativeFunction(
+        "gain", [](TContext& context, uint32_t) {
+            return TValue(context.RegAs<int>(0) * 2);
+        },
+        1);
+
+    auto pMain = std::make_shared<TProgram::VFunction>();
+    pMain->instructions = TCode{
+        { VM_IType::Push, VM_Reg::R1 },
+        { VM_IType::Push, 1 },
+        { VM_IType::Call, std::string("gain") },
+        { VM_IType::Add, VM_Reg::R0, VM_Reg::R2 }
+    };
+    program.AddFunction("main", pMain);
+    REQUIRE(program.Link().empty());
+
+    // Just the registers the code uses
+    REQUIRE(program.RegisterCount() == 3);
+
+    const int voices = 16;
+    std::vector<std::unique_ptr<TContext>> contexts;
+    for (int voice = 0; voice < voices; voice++)
+    {
+        contexts.push_back(std::make_unique<TContext>(program));
+        REQUIRE(contexts.back()->m_registers.size() == 3);
+    }
+
+    parallel_for(0, voices, 1, [&](int begin, int end) {
+        for (int voice = begin; voice < end; voice++)
+        {
+            auto& context = *contexts[voice];
+            context.m_registers[2] = 0;
+            for (int i = 0; i < 100; i++)
+            {
+                context.m_registers[1] = voice;
+                context.Run(pMain.get());
+                context.m_registers[2] = context.m_registers[0];
+            }
+        }
+    });
+
+    for (int voice = 0; voice < voices; voice++)
+    {
+        REQUIRE(contexts[voice]->RegAs<int>(0) == voice * 2 * 100);
+        REQUIRE(contexts[voice]->m_sp == 0);
+    }
+}
+
+namespace
+{
+// A per voice script: R1 is the voice's input, R0 the output
+std::shared_ptr<VMProgram<TValue>::VFunction> AddVoiceProgram(VMProgram<TValue>& program)
+{
+    program.AddNativeFunction(
+        "gain", [](VMContext<TValue>& context, uint32_t) {
+            return TValue(context.RegAs<int>(0) * 2);
+        },
+        1);
+
+    auto pOffset = std::make_shared<VMProgram<TValue>::VFunction>();
+    pOffset->instructions = TCode{
+        { VM_IType::Mov, VM_Reg::R3, VM_Reg::R0 },
+        { VM_IType::Add, VM_Reg::R3, VM_Reg::R1 },
+        { VM_IType::Mov, VM_Reg::R0, VM_Reg::R3 }
+    };
+    program.AddFunction("offset", pOffset);
+
+    auto pMain = std::make_shared<VMProgram<TValue>::VFunction>();
+    pMain->instructions = TCode{
+        { VM_IType::Mov, VM_Reg::R2, VM_Reg::R1 },
+        { VM_IType::Add, VM_Reg::R2, 10 },
+        { VM_IType::Push, VM_Reg::R2 },
+        { VM_IType::Push, 1 },
+        { VM_IType::Call, std::string("gain") },
+        { VM_IType::Push, VM_Reg::R0 },
+        { VM_IType::Push, 100 },
+        { VM_IType::Push, 2 },
+        { VM_IType::Call, std::string("offset") },
+        { VM_IType::Add, VM_Reg::R0, VM_Reg::R0 },
+        { VM_IType::Push, VM_Reg::R0 },
+        { VM_IType::Pop, VM_Reg::R4 }
+    };
+    program.AddFunction("main", pMain);
+    return pMain;
+}
+
+template <class TLane>
+void SetBatchGain(VMBatch<TValue, TLane>& batch)
+{
+    batch.SetNative("gain", [](VMBatch<TValue, TLane>& batch, uint32_t) {
+        auto pLanes = batch.Lanes(0);
+        for (uint32_t lane = 0; lane < batch.LaneCount(); lane++)
+        {
+            if constexpr (std::is_same_v<TLane, TValue>)
+            {
+                pLanes[lane] = std::get<int>(pLanes[lane]) * 2;
+            }
+            else
+            {
+                pLanes[lane] *= 2;
+            }
+        }
+    });
+}
+
+int VoiceResult(int voice)
+{
+    return ((voice + 10) * 2 + 100) * 2;
+}
+} // namespace
+
+TEST_CASE("VM.Faults", "[VM]")
+{
+    // Scripts which run off the stack or recurse forever stop the run, in release builds too
+    using TProgram = VMProgram<TValue>;
+    TProgram program;
+
+    auto addFunction = [&](const std::string& name, const TCode& code) {
+        auto spFn = std::make_shared<TProgram::VFunction>();
+        spFn->instructions = code;
+        program.AddFunction(name, spFn);
+        return spFn.get();
+    };
+    auto pRecurse = addFunction("recurse", TCode{ { VM_IType::CallArgs, std::string("recurse"), 0 } });
+    auto pOverflow = addFunction("overflow", TCode{ { VM_IType::Push, 1 }, { VM_IType::Push, 2 }, { VM_IType::Push, 3 }, { VM_IType::Push, 4 }, { VM_IType::Push, 5 }, { VM_IType::Push, 6 }, { VM_IType::Push, 7 }, { VM_IType::Push, 8 }, { VM_IType::CallArgs, std::string("overflow"), 0 } });
+    auto pUnderflow = addFunction("underflow", TCode{ { VM_IType::Pop, VM_Reg::R0 } });
+    auto pBadCount = addFunction("bad_count", TCode{ { VM_IType::Push, 1 }, { VM_IType::Push, 3 }, { VM_IType::Call, std::string("recurse") } });
+    auto pFine = addFunction("fine", TCode{ { VM_IType::Push, 4 }, { VM_IType::Pop, VM_Reg::R0 } });
+    program.AddNativeFunction("context_only", [](VMContext<TValue>&, uint32_t) { return TValue(0); });
+    auto pNative = addFunction("native", TCode{ { VM_IType::Push, 1 }, { VM_IType::CallArgs, std::string("context_only"), 1 } });
+    REQUIRE(program.Link().empty());
+
+    VMContext<TValue> context(program);
+    auto check = [&](const TProgram::VFunction* pFn, VM_Fault fault) {
+        REQUIRE(context.Run(pFn) == (fault == VM_Fault::None));
+        REQUIRE(context.m_fault == fault);
+        REQUIRE(context.m_sp == 0);
+        REQUIRE(context.m_callStack.empty());
+    };
+
+    SECTION("Fast")
+    {
+    }
+
+    SECTION("Traced")
+    {
+        context.SetTraceHook([](VMContext<TValue>&, const TProgram::VInstruction&) {});
+    }
+
+    check(pRecurse, VM_Fault::CallDepth);
+    check(pOverflow, VM_Fault::StackOverflow);
+    check(pUnderflow, VM_Fault::StackUnderflow);
+    check(pBadCount, VM_Fault::StackUnderflow);
+
+    // The context is fine to use again
+    check(pFine, VM_Fault::None);
+    REQUIRE(context.RegAs<int>(0) == 4);
+
+    // The same for batches
+    VMBatch<TValue, int> batch(program, 4, [](const TValue& value) { return std::get<int>(value); });
+    REQUIRE(!batch.Run(pRecurse));
+    REQUIRE(batch.GetFault() == VM_Fault::CallDepth);
+    REQUIRE(!batch.Run(pOverflow));
+    REQUIRE(batch.GetFault() == VM_Fault::StackOverflow);
+    REQUIRE(!batch.Run(pUnderflow));
+    REQUIRE(batch.GetFault() == VM_Fault::StackUnderflow);
+    REQUIRE(!batch.Run(pBadCount));
+    REQUIRE(batch.GetFault() == VM_Fault::StackUnderflow);
+    // No SetNative for it
+    REQUIRE(!batch.Run(pNative));
+    REQUIRE(batch.GetFault() == VM_Fault::BadCall);
+    REQUIRE(batch.Run(pFine));
+    REQUIRE(batch.GetFault() == VM_Fault::None);
+    REQUIRE(batch.Lanes(0)[3] == 4);
+}
+
+TEST_CASE("VM.Throws", "[VM]")
+{
+    // A throwing Add isn't a fault, but the run still unwinds so the next one starts clean
+    using TProgram = VMProgram<TValue>;
+    TProgram program;
+
+    auto addFunction = [&](const std::string& name, const TCode& code) {
+        auto spFn = std::make_shared<TProgram::VFunction>();
+        spFn->instructions = code;
+        program.AddFunction(name, spFn);
+        return spFn.get();
+    };
+    addFunction("bad_add", TCode{ { VM_IType::Mov, VM_Reg::R0, std::string("a") }, { VM_IType::Add, VM_Reg::R0, 1 } });
+    auto pThrows = addFunction("throws", TCode{ { VM_IType::Push, 1 }, { VM_IType::Push, 2 }, { VM_IType::CallArgs, std::string("bad_add"), 1 } });
+    auto pFine = addFunction("fine", TCode{ { VM_IType::Push, 4 }, { VM_IType::Pop, VM_Reg::R0 } });
+    REQUIRE(program.Link().empty());
+
+    VMContext<TValue> context(program);
+    SECTION("Fast")
+    {
+    }
+
+    SECTION("Traced")
+    {
+        context.SetTraceHook([](VMContext<TValue>&, const TProgram::VInstruction&) {});
+    }
+
+    REQUIRE_THROWS_AS(context.Run(pThrows), std::invalid_argument);
+    REQUIRE(context.m_sp == 0);
+    REQUIRE(context.m_callStack.empty());
+    REQUIRE(context.Run(pFine));
+    REQUIRE(context.m_sp == 0);
+    REQUIRE(context.m_callStack.empty());
+    REQUIRE(context.RegAs<int>(0) == 4);
+
+    VMBatch<TValue> batch(program, 4);
+    REQUIRE_THROWS_AS(batch.Run(pThrows), std::invalid_argument);
+    REQUIRE(batch.Run(pFine));
+    REQUIRE(std::get<int>(batch.Lanes(0)[3]) == 4);
+}
+
+TEST_CASE("VM.Batch", "[VM]")
+{
+    VMProgram<TValue> program;
+    auto pMain = AddVoiceProgram(program);
+    REQUIRE(program.Link().empty());
+
+    const uint32_t voices = 37;
+
+    SECTION("Values")
+    {
+        VMBatch<TValue> batch(program, voices);
+        SetBatchGain(batch);
+        for (uint32_t voice = 0; voice < voices; voice++)
+        {
+            batch.Lanes(1)[voice] = int(voice);
+        }
+        batch.Run(pMain.get());
+        for (uint32_t voice = 0; voice < voices; voice++)
+        {
+            REQUIRE(std::get<int>(batch.Lanes(0)[voice]) == VoiceResult(voice));
+            REQUIRE(std::get<int>(batch.Lanes(4)[voice]) == VoiceResult(voice));
+        }
+    }
+
+    SECTION("Numeric")
+    {
+        VMBatch<TValue, int> batch(program, voices, [](const TValue& value) { return std::get<int>(value); });
+        SetBatchGain(batch);
+
+        // The call to offset overwrites R1, so set the inputs each time
+        for (int run = 0; run < 2; run++)
+        {
+            for (uint32_t voice = 0; voice < voices; voice++)
+            {
+                batch.Lanes(1)[voice] = int(voice);
+            }
+            batch.Run(pMain.get());
+            for (uint32_t voice = 0; voice < voices; voice++)
+            {
+                REQUIRE(batch.Lanes(0)[voice] == VoiceResult(voice));
+            }
+        }
+    }
+}
+
+TEST_CASE("VM.Batch.Benchmark", "[VM][!benchmark]")
+{
+    VMProgram<TValue> program;
+    auto pMain = AddVoiceProgram(program);
+    program.Link();
+
+    const uint32_t voices = 256;
+
+    std::vector<std::unique_ptr<VMContext<TValue>>> contexts;
+    for (uint32_t voice = 0; voice < voices; voice++)
+    {
+        contexts.push_back(std::make_unique<VMContext<TValue>>(program));
+        contexts.back()->m_registers[1] = int(voice);
+    }
+
+    VMBatch<TValue> batch(program, voices);
+    SetBatchGain(batch);
+
+    VMBatch<TValue, int> numeric(program, voices, [](const TValue& value) { return std::get<int>(value); });
+    SetBatchGain(numeric);
+
+    for (uint32_t voice = 0; voice < voices; voice++)
+    {
+        batch.Lanes(1)[voice] = int(voice);
+        numeric.Lanes(1)[voice] = int(voice);
+    }
+
+    BENCHMARK("Context per voice")
+    {
+        for (auto& spContext : contexts)
+        {
+            spContext->Run(pMain.get());
+        }
+        return contexts[1]->RegAs<int>(0);
+    };
+
+    BENCHMARK("Batch")
+    {
+        batch.Run(pMain.get());
+        return std::get<int>(batch.Lanes(0)[1]);
+    };
+
+    BENCHMARK("Batch, int lanes")
+    {
+        numeric.Run(pMain.get());
+        return numeric.Lanes(0)[1];
+    };
+}
+
+TEST_CASE("VM.Optimize.Benchmark", "[VM][!benchmark]")
+{
+    std::ostringstream str;
+    TVM vm(str, DumpValue);
+    TVM optimized(str, DumpValue);
+    AddGeneratedProgram(vm);
+    AddGeneratedProgram(optimized);
+
+    auto stats = vm_optimize(optimized);
+    auto before = CountExecuted(vm);
+    auto after = CountExecuted(optimized);
+    WARN("Static: " << stats.instructionsBefore << " -> " << stats.instructionsAfter << " instructions, executed: " << before << " -> " << after);
+
+    BENCHMARK("Generated")
+    {
+        vm.Run(vm.FindFunction("main"));
+        return vm.RegAs<int>(5);
+    };
+
+    BENCHMARK("Optimized")
+    {
+        optimized.Run(optimized.FindFunction("main"));
+        return optimized.RegAs<int>(5);
+    };
+}
+
+TEST_CASE("VM.Benchmark", "[VM][!benchmark]")
+{
+    std::ostringstream str;
+    TVM vm(str, [](std::ostringstream& str, const TValue& r) {
+        if (std::holds_alternative<int>(r))
+        {
+            str << std::get<int>(r);
+        }
+    });
+
+    // A leaf function called in a loop of straight line code
+    auto pInc = std::make_shared<TVM::VFunction>();
+    pInc->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R0, 1 });
+    pInc->instructions.push_back(TVM::VInstruction{ VM_IType::Ret });
+    vm.AddFunction("inc", pInc);
+
+    auto pEntry = std::make_shared<TVM::VFunction>();
+    vm.AddFunction("main", pEntry);
+    pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R2, 0 });
+    for (int i = 0; i < 100; i++)
+    {
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Mov, VM_Reg::R1, i });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, VM_Reg::R1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Push, 1 });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Call, std::string("inc") });
+        pEntry->instructions.push_back(TVM::VInstruction{ VM_IType::Add, VM_Reg::R2, VM_Reg::R0 });
+    }
+    // 1 + 100 * 7 instructions per run
+    const double instructions = 701.0;
+
+    auto run = [&]() {
+        vm.Run(pEntry.get());
+        return vm.RegAs<int>(2);
+    };
+
+    auto report = [&](const char* pszName) {
+        const int runs = 2000;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < runs; i++)
+        {
+            run();
+            str.str("");
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        WARN(pszName << ": " << (instructions * runs / seconds) / 1e6 << "M instructions/s");
+    };
+
+    BENCHMARK("Fast")
+    {
+        return run();
+    };
+    report("Fast");
+
+    vm.TraceToLog();
+    BENCHMARK("Traced")
+    {
+        auto ret = run();
+        str.str("");
+        return ret;
+    };
+    report("Traced");
+}
+
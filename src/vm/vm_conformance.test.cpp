@@ -0,0 +1,344 @@
+#include <catch.hpp>
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <sstream>
+#include <variant>
+
+#include "mutils/vm/vm.h"
+#include "mutils/vm/vm_batch.h"
+#include "mutils/vm/vm_module.h"
+#include "mutils/vm/vm_optimize.h"
+
+using namespace MUtils;
+
+// Every case runs through each way of executing a program, and must give the same registers.
+// A different value type to vm.test.cpp, with floats and string concatenation
+using CValue = std::variant<int, float, std::string, VM_Reg>;
+
+namespace MUtils
+{
+CValue Add(const CValue& lhs, const CValue& rhs)
+{
+    if (std::holds_alternative<std::string>(lhs) && std::holds_alternative<std::string>(rhs))
+    {
+        return std::get<std::string>(lhs) + std::get<std::string>(rhs);
+    }
+
+    auto toFloat = [](const CValue& value) {
+        if (std::holds_alternative<int>(value))
+        {
+            return float(std::get<int>(value));
+        }
+        if (std::holds_alternative<float>(value))
+        {
+            return std::get<float>(value);
+        }
+        throw std::invalid_argument("Args need to be numbers");
+    };
+
+    if (std::holds_alternative<int>(lhs) && std::holds_alternative<int>(rhs))
+    {
+        return std::get<int>(lhs) + std::get<int>(rhs);
+    }
+    return toFloat(lhs) + toFloat(rhs);
+}
+} // namespace MUtils
+
+namespace
+{
+
+using CVM = VM<CValue>;
+using CProgram = VMProgram<CValue>;
+using CCode = std::vector<CProgram::VInstruction>;
+
+struct ConformanceCase
+{
+    std::string name;
+
+    // Entry function first
+    std::vector<std::pair<std::string, CCode>> functions;
+    std::map<uint32_t, CValue> expected;
+};
+
+CValue Twice(const CValue& value)
+{
+    return Add(value, value);
+}
+
+void AddNatives(CProgram& program)
+{
+    program.AddNativeFunction(
+        "twice", [](VMContext<CValue>& context, uint32_t) { return Twice(context.m_registers[0]); }, 1);
+    program.AddNativeFunction(
+        "concat", [](VMContext<CValue>& context, uint32_t argCount) {
+            CValue result = std::string();
+            for (uint32_t reg = 0; reg < argCount; reg++)
+            {
+                result = Add(result, context.m_registers[reg]);
+            }
+            return result;
+        });
+}
+
+void AddCase(CProgram& program, const ConformanceCase& test)
+{
+    for (auto& [name, code] : test.functions)
+    {
+        auto spFn = std::make_shared<CProgram::VFunction>();
+        spFn->instructions = code;
+        program.AddFunction(name, spFn);
+    }
+}
+
+CProgram::VFunction* Entry(CProgram& program, const ConformanceCase& test)
+{
+    return program.FindFunction(test.functions[0].first);
+}
+
+bool Encode(std::string& data, const CValue& value)
+{
+    data += char(value.index());
+    switch (value.index())
+    {
+    case 0:
+        data.append((const char*)&std::get<int>(value), sizeof(int));
+        return true;
+    case 1:
+        data.append((const char*)&std::get<float>(value), sizeof(float));
+        return true;
+    case 2:
+        data += std::get<std::string>(value);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Decode(const uint8_t* pData, size_t size, CValue& value)
+{
+    if (size == 0)
+    {
+        return false;
+    }
+    switch (pData[0])
+    {
+    case 0:
+    {
+        int v;
+        memcpy(&v, pData + 1, sizeof(v));
+        value = v;
+        return size == 1 + sizeof(v);
+    }
+    case 1:
+    {
+        float v;
+        memcpy(&v, pData + 1, sizeof(v));
+        value = v;
+        return size == 1 + sizeof(v);
+    }
+    case 2:
+        value = std::string((const char*)pData + 1, size - 1);
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <class TRegisters>
+void Check(const ConformanceCase& test, const char* pszMode, const TRegisters& registers)
+{
+    INFO(test.name << " (" << pszMode << ")");
+    for (auto& [reg, value] : test.expected)
+    {
+        INFO("R" << reg);
+        REQUIRE(reg < registers.size());
+        REQUIRE(registers[reg] == value);
+    }
+}
+
+void RunCase(const ConformanceCase& test)
+{
+    std::ostringstream log;
+    auto dump = [](std::ostringstream&, const CValue&) {};
+
+    // The VM facade, fast and traced
+    for (auto traced : { false, true })
+    {
+        CVM vm(log, dump);
+        AddNatives(vm);
+        AddCase(vm, test);
+        if (traced)
+        {
+            vm.TraceToLog();
+        }
+        vm.Run(Entry(vm, test));
+        Check(test, traced ? "Traced" : "Fast", vm.m_context.m_registers);
+        REQUIRE(vm.m_context.m_sp == 0);
+        REQUIRE(vm.m_context.m_callStack.empty());
+    }
+
+    // Optimized, on a separate context
+    {
+        CProgram program;
+        AddNatives(program);
+        AddCase(program, test);
+        vm_optimize(program);
+        REQUIRE(program.Link().empty());
+
+        VMContext<CValue> context(program);
+        context.Run(Entry(program, test));
+        Check(test, "Optimized", context.m_registers);
+        REQUIRE(context.m_sp == 0);
+    }
+
+    // Through a module
+    {
+        CProgram program;
+        AddNatives(program);
+        AddCase(program, test);
+
+        std::string module;
+        REQUIRE(vm_module_write<CValue>(program, Encode, module).empty());
+
+        auto spData = std::make_shared<std::vector<uint64_t>>((module.size() + 7) / 8);
+        memcpy(spData->data(), module.data(), module.size());
+
+        CProgram loaded;
+        AddNatives(loaded);
+        REQUIRE(vm_module_load<CValue>(loaded, (const uint8_t*)spData->data(), module.size(), spData, Decode).empty());
+
+        VMContext<CValue> context(loaded);
+        context.Run(Entry(loaded, test));
+        Check(test, "Module", context.m_registers);
+    }
+
+    // Batched, with lanes that should all agree
+    {
+        CProgram program;
+        AddNatives(program);
+        AddCase(program, test);
+        REQUIRE(program.Link().empty());
+
+        const uint32_t lanes = 3;
+        VMBatch<CValue> batch(program, lanes);
+        batch.SetNative("twice", [](VMBatch<CValue>& batch, uint32_t) {
+            for (uint32_t lane = 0; lane < batch.LaneCount(); lane++)
+            {
+                batch.Lanes(0)[lane] = Twice(batch.Lanes(0)[lane]);
+            }
+        });
+        batch.SetNative("concat", [](VMBatch<CValue>& batch, uint32_t argCount) {
+            for (uint32_t lane = 0; lane < batch.LaneCount(); lane++)
+            {
+                CValue result = std::string();
+                for (uint32_t reg = 0; reg < argCount; reg++)
+                {
+                    result = Add(result, batch.Lanes(reg)[lane]);
+                }
+                batch.Lanes(0)[lane] = result;
+            }
+        });
+        batch.Run(Entry(program, test));
+
+        for (uint32_t lane = 0; lane < lanes; lane++)
+        {
+            std::vector<CValue> registers;
+            for (uint32_t reg = 0; reg < batch.RegisterCount(); reg++)
+            {
+                registers.push_back(batch.Lanes(reg)[lane]);
+            }
+            Check(test, "Batch", registers);
+        }
+    }
+}
+
+} // namespace
+
+TEST_CASE("VM.Conformance", "[VM]")
+{
+    using R = VM_Reg;
+    using I = VM_IType;
+
+    std::vector<ConformanceCase> cases = {
+        { "Mov",
+            { { "main", { { I::Mov, R::R0, 3 }, { I::Mov, R::R1, R::R0 }, { I::Mov, R::R2, 1.5f }, { I::Mov, R::R3, std::string("s") } } } },
+            { { 0, 3 }, { 1, 3 }, { 2, 1.5f }, { 3, std::string("s") } } },
+
+        { "PushPop",
+            { { "main", { { I::Mov, R::R0, 7 }, { I::Push, R::R0 }, { I::Push, std::string("a") }, { I::Push, 2.0f }, { I::Pop, R::R1 }, { I::Pop, R::R2 }, { I::Pop, R::R3 } } } },
+            { { 1, 2.0f }, { 2, std::string("a") }, { 3, 7 } } },
+
+        { "Add",
+            { { "main", {
+                            { I::Mov, R::R0, 1 },
+                            { I::Add, R::R0, 2 },
+                            { I::Mov, R::R1, 0.5f },
+                            { I::Add, R::R1, R::R0 },
+                            { I::Mov, R::R2, std::string("ab") },
+                            { I::Add, R::R2, std::string("cd") },
+                            { I::Add, R::R0, R::R0 },
+                        } } },
+            { { 0, 6 }, { 1, 3.5f }, { 2, std::string("abcd") } } },
+
+        { "Ret",
+            { { "main", { { I::Mov, R::R0, 1 }, { I::Push, 5 }, { I::Ret }, { I::Mov, R::R0, 2 } } } },
+            { { 0, 1 } } },
+
+        { "Call",
+            { { "main", { { I::Push, 4 }, { I::Push, 6 }, { I::Push, 2 }, { I::Call, std::string("sum") }, { I::Mov, R::R4, R::R0 } } },
+                { "sum", { { I::Add, R::R0, R::R1 }, { I::Ret } } } },
+            { { 0, 10 }, { 1, 6 }, { 4, 10 } } },
+
+        { "CallArgs",
+            { { "main", { { I::Push, 4 }, { I::Push, 6 }, { I::CallArgs, std::string("sum"), 2 } } },
+                { "sum", { { I::Add, R::R0, R::R1 } } } },
+            { { 0, 10 } } },
+
+        { "PopArgs",
+            // The arguments are left for the callee, which takes them itself
+            { { "main", { { I::Push, 5 }, { I::Push, 7 }, { I::Push, 2 }, { I::Push, 0 }, { I::Call, std::string("take") }, { I::Push, 1 }, { I::Pop, R::R2 } } },
+                { "take", { { I::PopArgs } } } },
+            { { 0, 7 }, { 1, 5 }, { 2, 1 } } },
+
+        { "Nested",
+            { { "main", { { I::Mov, R::R5, 0 }, { I::Push, 0 }, { I::Call, std::string("a") }, { I::Add, R::R5, 1000 } } },
+                { "a", { { I::Add, R::R5, 1 }, { I::Push, std::string("junk") }, { I::Push, 0 }, { I::Call, std::string("b") }, { I::Add, R::R5, 100 } } },
+                { "b", { { I::Add, R::R5, 10 }, { I::Push, 0 }, { I::Call, std::string("c") }, { I::Ret }, { I::Add, R::R5, 5 } } },
+                { "c", { { I::Push, std::string("more junk") } } } },
+            { { 5, 1111 } } },
+
+        { "Native",
+            { { "main", { { I::Push, 21 }, { I::Push, 1 }, { I::Call, std::string("twice") }, { I::Mov, R::R3, R::R0 }, { I::Push, 1.25f }, { I::CallArgs, std::string("twice"), 1 } } } },
+            { { 0, 2.5f }, { 3, 42 } } },
+
+        { "NativeArgs",
+            { { "main", { { I::Push, std::string("x") }, { I::Push, std::string("y") }, { I::Push, std::string("z") }, { I::Push, 3 }, { I::Call, std::string("concat") } } } },
+            { { 0, std::string("xyz") }, { 1, std::string("y") } } },
+
+        { "NativeFromScript",
+            { { "main", { { I::Push, 3 }, { I::Push, 1 }, { I::Call, std::string("double_add") } } },
+                { "double_add", { { I::Push, R::R0 }, { I::Push, 1 }, { I::Call, std::string("twice") }, { I::Add, R::R0, 1 } } } },
+            { { 0, 7 } } },
+    };
+
+    for (auto& test : cases)
+    {
+        RunCase(test);
+    }
+
+    // Every opcode is covered
+    std::set<VM_IType> covered;
+    for (auto& test : cases)
+    {
+        for (auto& fn : test.functions)
+        {
+            for (auto& i : fn.second)
+            {
+                covered.insert(i.type);
+            }
+        }
+    }
+    REQUIRE(covered.size() == size_t(VM_IType::CallArgs) + 1);
+}
@@ -0,0 +1,163 @@
+// VM micro-benchmarks, for tracking the interpreter's costs between builds.
+// Prints one JSON object to stdout, so results can be stored and compared by a script:
+//   { "version": 1, "benchmarks": [ { "name": ..., "ns_per_op": ..., "ops": ..., "repeats": ... }, ... ] }
+// Each figure is the median of several repeats.  Usage: vmbench [repeats]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <variant>
+
+#include <mutils/vm/vm.h>
+#include <mutils/vm/vm_batch.h>
+
+using namespace MUtils;
+
+using TValue = std::variant<std::string, int, VM_Reg>;
+
+namespace MUtils
+{
+TValue Add(const TValue& lhs, const TValue& rhs)
+{
+    return std::get<int>(lhs) + std::get<int>(rhs);
+}
+} // namespace MUtils
+
+namespace
+{
+
+using TProgram = VMProgram<TValue>;
+using TCode = std::vector<TProgram::VInstruction>;
+
+struct BenchResult
+{
+    std::string name;
+    double nsPerOp;
+    uint64_t ops;
+};
+
+// Time fn, which does opsPerCall operations, and return the median cost of one
+template <class TFn>
+BenchResult Measure(const std::string& name, uint32_t repeats, uint64_t opsPerCall, TFn&& fn)
+{
+    using namespace std::chrono;
+
+    // Aim for a few milliseconds per repeat
+    uint64_t calls = 1;
+    for (;;)
+    {
+        auto start = steady_clock::now();
+        for (uint64_t call = 0; call < calls; call++)
+        {
+            fn();
+        }
+        if (steady_clock::now() - start > milliseconds(5) || calls >= (1ull << 30))
+        {
+            break;
+        }
+        calls *= 2;
+    }
+
+    std::vector<double> samples;
+    for (uint32_t repeat = 0; repeat < repeats; repeat++)
+    {
+        auto start = steady_clock::now();
+        for (uint64_t call = 0; call < calls; call++)
+        {
+            fn();
+        }
+        auto ns = double(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+        samples.push_back(ns / double(calls * opsPerCall));
+    }
+    std::sort(samples.begin(), samples.end());
+    return BenchResult{ name, samples[samples.size() / 2], calls * opsPerCall };
+}
+
+TProgram::VFunction* AddFunction(TProgram& program, const std::string& name, const TCode& code)
+{
+    auto spFn = std::make_shared<TProgram::VFunction>();
+    spFn->instructions = code;
+    program.AddFunction(name, spFn);
+    return spFn.get();
+}
+
+const uint32_t OpsPerRun = 1000;
+
+// Straight line register work; the cost of dispatching an instruction
+TProgram::VFunction* AddDispatch(TProgram& program)
+{
+    TCode code;
+    for (uint32_t index = 0; index < OpsPerRun / 2; index++)
+    {
+        code.push_back({ VM_IType::Mov, VM_Reg::R1, int(index) });
+        code.push_back({ VM_IType::Add, VM_Reg::R0, VM_Reg::R1 });
+    }
+    return AddFunction(program, "dispatch", code);
+}
+
+// Calls to a function that does nothing; the cost of a frame
+TProgram::VFunction* AddCalls(TProgram& program, const std::string& callee)
+{
+    TCode code;
+    for (uint32_t index = 0; index < OpsPerRun; index++)
+    {
+        code.push_back({ VM_IType::CallArgs, callee, 0 });
+    }
+    return AddFunction(program, "calls_" + callee, code);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    uint32_t repeats = argc > 1 ? uint32_t(std::max(1, atoi(argv[1]))) : 7;
+
+    TProgram program;
+    program.AddNativeFunction(
+        "native", [](VMContext<TValue>&, uint32_t) { return TValue(0); }, 0);
+    AddFunction(program, "empty", {});
+    auto pDispatch = AddDispatch(program);
+    auto pCalls = AddCalls(program, "empty");
+    auto pNatives = AddCalls(program, "native");
+
+    auto errors = program.Link();
+    if (!errors.empty())
+    {
+        fprintf(stderr, "%s\n", errors[0].c_str());
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    VMContext<TValue> context(program);
+
+    auto run = [&](TProgram::VFunction* pFn) {
+        context.m_registers[0] = 0;
+        context.Run(pFn);
+    };
+    results.push_back(Measure("dispatch", repeats, OpsPerRun, [&]() { run(pDispatch); }));
+    results.push_back(Measure("call", repeats, OpsPerRun, [&]() { run(pCalls); }));
+    results.push_back(Measure("call_native", repeats, OpsPerRun, [&]() { run(pNatives); }));
+
+    // The same straight line code over a batch of plain int lanes; the cost per instruction per lane
+    const uint32_t lanes = 64;
+    VMBatch<TValue, int> batch(program, lanes, [](const TValue& value) { return std::get<int>(value); });
+    results.push_back(Measure("batch_dispatch_lane", repeats, OpsPerRun * lanes, [&]() {
+        std::fill_n(batch.Lanes(0), lanes, 0);
+        batch.Run(pDispatch);
+    }));
+
+    printf("{\n  \"version\": 1,\n  \"benchmarks\": [\n");
+    for (size_t index = 0; index < results.size(); index++)
+    {
+        auto& result = results[index];
+        printf("    { \"name\": \"%s\", \"ns_per_op\": %.3f, \"ops\": %llu, \"repeats\": %u }%s\n",
+            result.name.c_str(),
+            result.nsPerOp,
+            (unsigned long long)result.ops,
+            repeats,
+            index + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}